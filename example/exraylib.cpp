@@ -9,6 +9,8 @@
 #include "raymath.h" // Required for: Vector3, Quaternion and Matrix functionality
 #include "rlgl.h" // OpenGL abstraction layer to OpenGL 1.1, 2.1, 3.3+ or ES2
 
+#include "external/glad.h" // GL 3.3 entry points, as loaded by rlgl
+
 
 //----------------------------------------------------------------------------------
 // Defines and Macros
@@ -21,6 +23,8 @@
 // #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void
 Print(char const* text, Matrix const& mat)
@@ -129,6 +133,282 @@ DrawRotatedCube(Vector3 position, Vector3 dimensions, float* mat4x4, Color color
     rlPopMatrix();
 }
 
+// Draws an indexed triangle batch built on the CPU in one go. Vertices are
+// interleaved: position (3 floats), texcoord (2 floats), colour (4 bytes),
+// stride bytes apart. texture_id 0 draws untextured.
+void
+DrawParticleBatch(void const*         vertices,
+                  int                 stride,
+                  unsigned int const* indices,
+                  int                 index_count,
+                  unsigned int        texture_id)
+{
+    // rlgl's immediate mode has no index buffer, so expand the indices as we
+    // go, in chunks the internal vertex buffer can hold.
+    int const chunk = 3 * 1024;
+
+    auto* bytes = static_cast<unsigned char const*>(vertices);
+
+    rlSetTexture(texture_id);
+    for (int begin = 0; begin < index_count; begin += chunk)
+    {
+        int end = (begin + chunk < index_count) ? begin + chunk : index_count;
+        rlCheckRenderBatchLimit(end - begin);
+
+        rlBegin(RL_TRIANGLES);
+        for (int i = begin; i < end; ++i)
+        {
+            auto* v        = bytes + size_t(indices[i]) * stride;
+            auto* position = reinterpret_cast<float const*>(v);
+            auto* uv       = position + 3;
+            auto* color    = reinterpret_cast<unsigned char const*>(uv + 2);
+
+            rlColor4ub(color[0], color[1], color[2], color[3]);
+            rlTexCoord2f(uv[0], uv[1]);
+            rlVertex3f(position[0], position[1], position[2]);
+        }
+        rlEnd();
+    }
+    rlSetTexture(0);
+}
+
+//----------------------------------------------------------------------------------
+// Streamed particle vertices
+//----------------------------------------------------------------------------------
+// Billboard vertices are written straight into GPU memory. The buffer is
+// split into three sections used round robin: each is fenced when drawn and
+// only handed out again once the GPU is done with it, so neither side waits
+// on the other. With GL_ARB_buffer_storage the whole buffer is mapped once,
+// persistently. Without it, each section is mapped unsynchronised as it
+// comes round, still a direct write with no staging copy. Either way
+// ParticleStream_Begin and ParticleStream_Draw belong to the GL thread, but
+// the pointer in between may be filled from any thread. Both paths run on
+// Mesa's llvmpipe (LIBGL_ALWAYS_SOFTWARE=1); set
+// PARTICLE_STREAM_NO_PERSISTENT to force the second.
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+extern "C" void* glfwGetProcAddress(char const* name);
+
+typedef void (*Proc_BufferStorage)(GLenum target, GLsizeiptr size, void const* data, GLbitfield flags);
+
+static int const Stream_Sections = 3;
+
+struct Particle_Stream
+{
+    GLuint vao { 0 };
+    GLuint vbo { 0 };
+    GLuint ebo { 0 };
+
+    int    stride { 0 };
+    int    max_quads { 0 }; // Per section.
+    int    section { 0 };
+    GLsync fences[Stream_Sections] {};
+
+    bool           persistent { false };
+    unsigned char* mapped { nullptr }; // Whole buffer, persistent only.
+};
+
+static Particle_Stream stream;
+
+
+static bool
+HasExtension(char const* name)
+{
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; ++i)
+    {
+        auto* ext = reinterpret_cast<char const*>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext && strcmp(ext, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Vertex layout as DrawParticleBatch. Returns whether the persistent path is
+// in use.
+bool
+ParticleStream_Init(int max_quads, int stride)
+{
+    auto& s     = stream;
+    s.stride    = stride;
+    s.max_quads = max_quads;
+    s.section   = 0;
+
+    auto section_bytes = GLsizeiptr(max_quads) * 4 * stride;
+    auto total_bytes   = section_bytes * Stream_Sections;
+
+    glGenVertexArrays(1, &s.vao);
+    glBindVertexArray(s.vao);
+
+    glGenBuffers(1, &s.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+
+    auto buffer_storage = reinterpret_cast<Proc_BufferStorage>(glfwGetProcAddress("glBufferStorage"));
+    s.persistent        = buffer_storage && HasExtension("GL_ARB_buffer_storage") && !getenv("PARTICLE_STREAM_NO_PERSISTENT");
+    if (s.persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        buffer_storage(GL_ARRAY_BUFFER, total_bytes, nullptr, flags);
+        s.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, total_bytes, flags));
+        if (!s.mapped)
+        {
+            // Storage is immutable now, so start over with a fresh buffer.
+            glDeleteBuffers(1, &s.vbo);
+            glGenBuffers(1, &s.vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+            s.persistent = false;
+        }
+    }
+    if (!s.persistent)
+    {
+        glBufferData(GL_ARRAY_BUFFER, total_bytes, nullptr, GL_STREAM_DRAW);
+    }
+
+    // The quad pattern never changes, so indices are uploaded once.
+    auto* indices = static_cast<unsigned int*>(malloc(size_t(max_quads) * 6 * sizeof(unsigned int)));
+    for (int q = 0; q < max_quads; ++q)
+    {
+        unsigned int v     = 4 * q;
+        indices[6 * q + 0] = v;
+        indices[6 * q + 1] = v + 1;
+        indices[6 * q + 2] = v + 2;
+        indices[6 * q + 3] = v;
+        indices[6 * q + 4] = v + 2;
+        indices[6 * q + 5] = v + 3;
+    }
+    glGenBuffers(1, &s.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(max_quads) * 6 * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    free(indices);
+
+    // Position, texcoord and colour, at rlgl's default shader locations.
+    glEnableVertexAttribArray(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+    glVertexAttribPointer(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(RL_DEFAULT_SHADER_ATTRIB_LOCATION_TEXCOORD);
+    glVertexAttribPointer(RL_DEFAULT_SHADER_ATTRIB_LOCATION_TEXCOORD, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(RL_DEFAULT_SHADER_ATTRIB_LOCATION_COLOR);
+    glVertexAttribPointer(RL_DEFAULT_SHADER_ATTRIB_LOCATION_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(5 * sizeof(float)));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return s.persistent;
+}
+
+
+// Waits, normally not at all, for the GPU to finish with the next section
+// and returns it, with room for max_quads quads.
+void*
+ParticleStream_Begin()
+{
+    auto& s     = stream;
+    auto& fence = s.fences[s.section];
+    if (fence)
+    {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    auto section_bytes = GLsizeiptr(s.max_quads) * 4 * s.stride;
+    auto offset        = section_bytes * s.section;
+    if (s.persistent)
+    {
+        return s.mapped + offset;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+    auto* p = glMapBufferRange(GL_ARRAY_BUFFER,
+                               offset,
+                               section_bytes,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return p;
+}
+
+
+// Draws quad_count quads from the section ParticleStream_Begin returned,
+// fences it and moves on. texture_id 0 draws untextured.
+void
+ParticleStream_Draw(int quad_count, unsigned int texture_id)
+{
+    auto& s = stream;
+
+    // Anything rlgl has batched so far goes first, to keep draw order.
+    rlDrawRenderBatchActive();
+
+    if (!s.persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    if (quad_count > 0)
+    {
+        auto* locs = rlGetShaderLocsDefault();
+        auto  mvp  = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+        float tint[4] { 1.0f, 1.0f, 1.0f, 1.0f };
+
+        glUseProgram(rlGetShaderIdDefault());
+        glUniformMatrix4fv(locs[RL_SHADER_LOC_MATRIX_MVP], 1, GL_FALSE, MatrixToFloat(mvp));
+        glUniform4fv(locs[RL_SHADER_LOC_COLOR_DIFFUSE], 1, tint);
+        glUniform1i(locs[RL_SHADER_LOC_MAP_DIFFUSE], 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture_id ? texture_id : rlGetTextureIdDefault());
+
+        glBindVertexArray(s.vao);
+        glDrawElementsBaseVertex(GL_TRIANGLES,
+                                 quad_count * 6,
+                                 GL_UNSIGNED_INT,
+                                 nullptr,
+                                 s.section * s.max_quads * 4);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+    }
+
+    s.fences[s.section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.section           = (s.section + 1) % Stream_Sections;
+}
+
+
+void
+ParticleStream_Free()
+{
+    auto& s = stream;
+    for (auto& fence : s.fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (s.persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, s.vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        s.mapped = nullptr;
+    }
+    glDeleteBuffers(1, &s.vbo);
+    glDeleteBuffers(1, &s.ebo);
+    glDeleteVertexArrays(1, &s.vao);
+    s = Particle_Stream {};
+}
+
 void
 DrawTerrain()
 {
@@ -1,9 +1,19 @@
 #include "Base/typedefs.h"
 #include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/atlas.h"
+#include "Particles/billboard.h"
+#include "Particles/collision.h"
+#include "Particles/depth_sort.h"
+#include "Particles/frame_pipeline.h"
 #include "Particles/particle.h"
+#include "Particles/ribbon.h"
+#include "Particles/simulation_lod.h"
+#include "Particles/snapshot.h"
 #include "SmallLib/smallmath.h"
 #include "extras/raygui.h"
 #include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
 #include <cassert>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +22,16 @@ extern void
 DrawRotatedCube(Vector3 position, Vector3 dimensions, float* mat4x4, Color color);
 extern void
 DrawTerrain();
+extern void
+DrawParticleBatch(void const* vertices, int stride, unsigned int const* indices, int index_count, unsigned int texture_id);
+extern bool
+ParticleStream_Init(int max_quads, int stride);
+extern void*
+ParticleStream_Begin();
+extern void
+ParticleStream_Draw(int quad_count, unsigned int texture_id);
+extern void
+ParticleStream_Free();
 
 struct Player
 {
@@ -64,17 +84,105 @@ struct Viewport
 };
 
 
+// Each stage of the frame runs at its own rate; see InputStage, SimulateStage
+// and RenderStage.
+constexpr float POLLS_PER_SEC   = 120.0f;
+constexpr float SIMS_PER_SEC    = 60.0f;
+constexpr float RENDERS_PER_SEC = 60.0f;
+
+using Demo_Emitter = Emitter_Of<Particle_Features_Default | Particle_Feature_Trail>;
+
+// What the render thread tells the simulation each frame.
+struct Sim_Input
+{
+    LOD_Camera  camera;
+    float       rate { 0.5f };
+    Render_Mode render_mode { Render_Mode_Cube };
+};
+
+
 struct GameStruct
 {
-    int      framerate { 60 };
     Window   window;
     Viewport viewport;
 
     Particle particle;
-    Emitter  emitter;
+
+    // Owned by the simulate stage once the pipeline starts. Rendering only
+    // sees snapshots, and only steers the simulation through inputs.
+    Demo_Emitter emitter;
+    Trail_Pool   trails;
+    Emitter_LOD  emitter_lod;
+    LOD_Settings lod_settings;
+
+    // The terrain DrawTerrain draws, as the simulation sees it.
+    Height_Field       ground;
+    Collision_World    world;
+    Collision_Material material;
+
+    Triple_Buffer<Emitter_Snapshot<Demo_Emitter::features, 40>> snapshots;
+    Triple_Buffer<Sim_Input>                                    inputs;
+    Triple_Buffer<Camera>                                       views;
+    Sim_Input                                                   controls;
+
+    Frame_Pipeline pipeline;
+
+    // Render stage state. Cull, render prep and present run in turn, so
+    // each frame's state is only ever touched by one thread at a time.
+    Camera           view;
+    Render_Batch     ribbons;
+    Particle_Vertex* stream { nullptr }; // Mapped billboard section for the next frame.
+    size_t           stream_quads { 0 };
+
+    // Set when the latest poll saw a click, until a present has shown it to
+    // the GUI.
+    bool unseen_click { false };
+
+    Sprite_Atlas atlas;
+    Texture2D    atlas_texture;
+    Flipbook     puff;
+
+    Depth_Sort depth_sort;
 };
 
 
+// A soft disc that swells and fades over cols * rows frames. Stands in for
+// an artist's flipbook until the example loads real sprites.
+void
+MakePuffSheet(std::vector<uint8>& pixels, int frame_size, int cols, int rows)
+{
+    int w = frame_size * cols;
+    int h = frame_size * rows;
+    pixels.assign(size_t(w) * h * 4, 0);
+
+    int frames = cols * rows;
+    for (int f = 0; f < frames; ++f)
+    {
+        float t      = (f + 0.5f) / frames;
+        float radius = 0.5f * frame_size * (0.4f + 0.6f * t);
+        float fade   = 1.0f - t;
+        int   ox     = (f % cols) * frame_size;
+        int   oy     = (f / cols) * frame_size;
+        for (int y = 0; y < frame_size; ++y)
+        {
+            for (int x = 0; x < frame_size; ++x)
+            {
+                float dx = x + 0.5f - 0.5f * frame_size;
+                float dy = y + 0.5f - 0.5f * frame_size;
+                float d  = sqrtf(dx * dx + dy * dy) / radius;
+                float a  = (d < 1.0f) ? (1.0f - d * d) * fade : 0.0f;
+
+                auto* p = &pixels[(size_t(oy + y) * w + ox + x) * 4];
+                p[0]    = 255;
+                p[1]    = 255;
+                p[2]    = 255;
+                p[3]    = static_cast<uint8>(a * 255.0f);
+            }
+        }
+    }
+}
+
+
 void
 Print(char const* text, Vector2 const& v)
 {
@@ -177,12 +285,57 @@ Battle_Intergrate(Battle& battle, float time_secs)
     }
 }
 
+// Input stage. Hands the camera and controls to the simulation, and the
+// camera to rendering.
 void
 UpdateGame(GameStruct& game)
 {
     auto& particle = game.particle;
-    Particle_Integrate(particle, 1.0f / game.framerate);
-    Emitter_Integrate(game.emitter, 1.0f / game.framerate);
+    Particle_Integrate(particle, 1.0f / POLLS_PER_SEC);
+
+    auto& camera = game.viewport.camera;
+    auto& input  = TripleBuffer_Back(game.inputs);
+    input        = game.controls;
+    input.camera = LOD_CameraFromLookAt(Vec { camera.position.x, camera.position.y, camera.position.z },
+                                        Vec { camera.target.x, camera.target.y, camera.target.z },
+                                        camera.fovy,
+                                        (float)game.viewport.w / game.viewport.h);
+    TripleBuffer_Publish(game.inputs);
+
+    TripleBuffer_Back(game.views) = camera;
+    TripleBuffer_Publish(game.views);
+}
+
+
+// Simulation stage, on a worker. Publishes a snapshot after each tick.
+Stage_Task
+SimulateStage(GameStruct& game)
+{
+    auto tick_sec = 1.0f / SIMS_PER_SEC;
+    auto clock    = StageClock_FromRate(SIMS_PER_SEC);
+    for (;;)
+    {
+        co_await Pipeline_Tick { game.pipeline, clock, Pipeline_Any };
+
+        TripleBuffer_Acquire(game.inputs);
+        auto const& input = TripleBuffer_Front(game.inputs);
+
+        game.emitter.rate        = input.rate;
+        game.emitter.render_mode = input.render_mode;
+
+        // Until the first particle there is nothing to bound, so fall back
+        // on a rough guess around the origin.
+        auto& box    = game.emitter.bounds.box;
+        bool  empty  = Bounds_IsEmpty(box);
+        Vec   center = empty ? Vec { 0.0f, 0.0f, 0.0f } : Bounds_Center(box);
+        float radius = empty ? 10.0f : Bounds_Radius(box);
+        LOD_Classify(game.emitter_lod, game.lod_settings, input.camera, center, radius);
+        Emitter_TickLOD(game.emitter, game.emitter_lod, game.lod_settings, tick_sec);
+        Emitter_Collide(game.emitter, game.world, game.material);
+
+        Snapshot_Capture(TripleBuffer_Back(game.snapshots), game.emitter, clock.ticks);
+        TripleBuffer_Publish(game.snapshots);
+    }
 }
 
 
@@ -199,6 +352,12 @@ UpdateKeyboard(GameStruct& game)
 
         Viewport_ChangeSize(game.viewport, game.window);
     }
+
+    if (IsKeyPressed('B'))
+    {
+        auto& mode = game.controls.render_mode;
+        mode       = (mode == Render_Mode_Cube) ? Render_Mode_Billboard : Render_Mode_Cube;
+    }
 }
 
 struct Grid
@@ -341,231 +500,411 @@ Gui_WidgetFromProperty(Property& property, Rectangle const& rect)
     }
 }
 
-int
-main(void)
+// GUI state, touched only by the present stage.
+struct Demo_Gui
 {
-    // Initialization
-    //--------------------------------------------------------------------------------------
-    GameStruct game;
+    Grid  grid;
+    float theta_e1e2;
+    float theta_e1e3;
+    float theta_e2e3;
+};
 
-    InitWindow(game.window.w, game.window.h, game.window.title);
 
-    Viewport_Init(game.viewport, game.window);
+Vector3 const Cube_Dimensions = { 2.0f * 0.707f, 2.0f * 0.707f, 2.0f * 0.707f };
 
-    // Define the camera to look into our 3d world
-    auto& camera    = game.viewport.camera;
-    camera.position = { 15.0f, 15.0f, 25.0f };
 
-    auto cube_position   = Vector3 { 0.0f, 0.0f, 0.0f };
-    auto cube_dimensions = Vector3 { 2.0f * 0.707f, 2.0f * 0.707f, 2.0f * 0.707f };
+// Input stage, on the main thread as the window requires. The only place
+// input is polled.
+Stage_Task
+InputStage(GameStruct& game)
+{
+    auto clock = StageClock_FromRate(POLLS_PER_SEC);
+    for (;;)
+    {
+        co_await Pipeline_Tick { game.pipeline, clock, Pipeline_Main };
 
-    SetCameraMode(camera, CAMERA_FREE); // Set a free camera mode
+        // raygui reads clicks from the latest poll, and polls outpace
+        // presents, so a click holds polling until one present has seen it.
+        if (!game.unseen_click)
+        {
+            PollInputEvents();
+            game.unseen_click = IsMouseButtonPressed(MOUSE_LEFT_BUTTON) || IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
 
-    // Set our game to run at 60 frames-per-second
-    SetTargetFPS(game.framerate);
+            UpdateCamera(&game.viewport.camera);
+            UpdateKeyboard(game);
+        }
+        UpdateGame(game);
 
-    //--------------------------------------------------------------------------------------
-    Particle_Init(game.particle);
-    Emitter_Init(game.emitter);
+        if (WindowShouldClose()) // Detect window close button or ESC key
+        {
+            Pipeline_Quit(game.pipeline);
+        }
+    }
+}
 
-    auto theta_e1e2 = game.particle.omega.x;
-    auto theta_e1e3 = game.particle.omega.y;
-    auto theta_e2e3 = game.particle.omega.z;
 
-    int  x_offset = game.window.w - (50 + 150 + 25 + 25) - (4 * 4);
-    Grid grid;
-    int  Grid_Rows    = 7;
-    int  Grid_Cols    = 5;
-    int  Grid_Spacing = 4;
-    Grid_Init(grid, x_offset, 4, Grid_Rows, Grid_Cols, Grid_Spacing);
-    Grid_ConfigureRows(grid, 20);
-    Grid_ConfigureColumns(grid, 50);
-    // Grid_ConfigureColumn(grid, 1, 100);
-    Grid_ConfigureColumn(grid, 1, 150);
-    Grid_ConfigureColumn(grid, 2, 25);
-    Grid_ConfigureColumn(grid, 3, 25);
+// Takes the latest snapshot and camera and sorts what is in view.
+Stage_Task
+CullStage(GameStruct& game)
+{
+    // The latest finished tick, or the last one again if the simulation
+    // hasn't finished another since.
+    TripleBuffer_Acquire(game.snapshots);
+    TripleBuffer_Acquire(game.views);
+    auto& emitter = TripleBuffer_Front(game.snapshots).emitter;
+    auto& camera  = game.view;
+    camera        = TripleBuffer_Front(game.views);
+
+    auto forward = Vec { camera.target.x - camera.position.x,
+                         camera.target.y - camera.position.y,
+                         camera.target.z - camera.position.z };
+    forward      = forward * (1.0f / Vector3Length(Vector3 { forward.x, forward.y, forward.z }));
+
+    // The whole emitter goes if its bounds are off screen.
+    auto  cone = LOD_CameraFromLookAt(Vec { camera.position.x, camera.position.y, camera.position.z },
+                                     Vec { camera.target.x, camera.target.y, camera.target.z },
+                                     camera.fovy,
+                                     (float)game.viewport.w / game.viewport.h);
+    auto& box  = emitter.bounds.box;
+    if (Bounds_IsEmpty(box) || !LOD_Visible(cone, Bounds_Center(box), Bounds_Radius(box)))
+    {
+        game.depth_sort.order.clear();
+        co_return;
+    }
 
+    DepthSort_Update(game.depth_sort,
+                     emitter.particles,
+                     Vec { camera.position.x, camera.position.y, camera.position.z },
+                     forward,
+                     0.1f,
+                     100.0f);
+    co_return;
+}
 
-    int  val     = 0;
-    bool pressed = false;
-    // Main game loop
-    while (!WindowShouldClose()) // Detect window close button or ESC key
+
+// Builds vertices. Billboards go straight into the mapped section the last
+// present left for us, ribbons into a CPU batch.
+Stage_Task
+RenderPrepStage(GameStruct& game)
+{
+    auto& emitter = TripleBuffer_Front(game.snapshots).emitter;
+    auto& camera  = game.view;
+
+    // Same width as the cubes at the spawn size.
+    game.stream_quads = 0;
+    if (game.stream && !game.depth_sort.order.empty())
     {
-        // Update
-        //----------------------------------------------------------------------------------
-        UpdateCamera(&camera);
-        UpdateKeyboard(game);
-        UpdateGame(game);
+        game.stream_quads = Emitter_WriteBillboards(game.stream,
+                                                    emitter.particles.capacity(),
+                                                    emitter,
+                                                    Billboard_CameraFromLookAt(Vec { camera.position.x, camera.position.y, camera.position.z },
+                                                                               Vec { camera.target.x, camera.target.y, camera.target.z },
+                                                                               Vec { camera.up.x, camera.up.y, camera.up.z }),
+                                                    Cube_Dimensions.x / emitter.params.size,
+                                                    Particle_Color { 230, 41, 55, 255 },
+                                                    game.depth_sort.order.data());
+    }
 
-        // Draw
-        //----------------------------------------------------------------------------------
-        BeginDrawing();
-        ClearBackground(WHITE);
+    Render_Clear(game.ribbons);
+    Emitter_BuildRibbons(game.ribbons,
+                         emitter,
+                         Vec { camera.position.x, camera.position.y, camera.position.z },
+                         0.5f,
+                         Particle_Color { 255, 160, 0, 200 });
+    co_return;
+}
 
-        BeginTextureMode(game.viewport.texture);
-        ClearBackground(SKYBLUE);
-        BeginMode3D(camera);
 
-        DrawGrid(100, 1.0f);
-        // DrawTerrain();
+// Draws and swaps, on the main thread.
+Stage_Task
+PresentStage(GameStruct& game, Demo_Gui& gui)
+{
+    co_await Pipeline_Switch { game.pipeline, Pipeline_Main };
 
-#if 0
-        cube_position = {
-            game.particle.pos.x,
-            game.particle.pos.y,
-            game.particle.pos.z,
-        };
-        DrawRotatedCube(cube_position,
-                        cube_dimensions,
-                        &game.particle.rot_mat[0],
-                        RED);
-#else
-        for (auto& particle : game.emitter.particles)
+    auto& emitter = TripleBuffer_Front(game.snapshots).emitter;
+
+    BeginDrawing();
+    ClearBackground(WHITE);
+
+    BeginTextureMode(game.viewport.texture);
+    ClearBackground(SKYBLUE);
+    BeginMode3D(game.view);
+
+    DrawGrid(100, 1.0f);
+    DrawTerrain();
+
+    if (emitter.render_mode == Render_Mode_Cube)
+    {
+        for (auto index : game.depth_sort.order)
         {
-            cube_position = {
+            auto& particle      = emitter.particles[index];
+            auto  cube_position = Vector3 {
                 particle.pos.x,
                 particle.pos.y,
                 particle.pos.z,
             };
             DrawRotatedCube(cube_position,
-                            cube_dimensions,
+                            Cube_Dimensions,
                             &particle.rot_mat[0],
                             RED);
         }
-#endif
+    }
 
+    // Always drawn, even if empty, so the section is fenced and the ring
+    // moves on.
+    ParticleStream_Draw((int)game.stream_quads, game.atlas_texture.id);
 
-        EndMode3D();
-        EndTextureMode();
+    DrawParticleBatch(game.ribbons.vertices.data(),
+                      sizeof(Particle_Vertex),
+                      game.ribbons.indices.data(),
+                      (int)game.ribbons.indices.size(),
+                      0);
 
-        DrawTextureRec(game.viewport.texture.texture,
-                       Rectangle { 0.0f, 0.0f, (float)game.viewport.w, -(float)game.viewport.h },
-                       Vector2 { 0, 0 },
-                       WHITE);
+    EndMode3D();
+    EndTextureMode();
 
-        // DrawRectangle(11, 10, 320, 133, Fade(SKYBLUE, 0.5f));
-        // DrawRectangleLines(11, 10, 320, 133, BLUE);
+    DrawTextureRec(game.viewport.texture.texture,
+                   Rectangle { 0.0f, 0.0f, (float)game.viewport.w, -(float)game.viewport.h },
+                   Vector2 { 0, 0 },
+                   WHITE);
 
-        // DrawText("Free camera default controls:", 21, 20, 10, BLACK);
-        // DrawText("- Mouse Wheel to Zoom in-out", 41, 40, 10, DARKGRAY);
-        // DrawText("- Mouse Wheel Pressed to Pan", 41, 60, 10, DARKGRAY);
-        // DrawText("- Alt + Mouse Wheel Pressed to Rotate", 41, 80, 10, DARKGRAY);
-        // DrawText("- Alt + Ctrl + Mouse Wheel Pressed for Smooth Zoom", 41, 100, 10, DARKGRAY);
-        // DrawText("- Z to zoom to (1, 0, 0)", 40, 120, 10, DARKGRAY);
+    int       row = 0;
+    int       col = 0;
+    Rectangle r;
+    {
+        col = 0;
 
-        int       row = 0;
-        int       col = 0;
-        Rectangle r;
+        ++col;
+        r            = Grid_GetRect(gui.grid, row, col++);
+        auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, "reset"));
+        if (pressed)
         {
-            col = 0;
-
-            ++col;
-            r            = Grid_GetRect(grid, row, col++);
-            auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, "reset"));
-            if (pressed)
-            {
-                theta_e1e2          = 0;
-                theta_e1e3          = 0;
-                theta_e2e3          = 0;
-                game.particle.theta = { 0.0, 0.0, 0.0 };
-                game.particle.omega = { 0.0, 0.0, 0.0 };
-            }
-
-            row += 1;
+            gui.theta_e1e2      = 0;
+            gui.theta_e1e3      = 0;
+            gui.theta_e2e3      = 0;
+            game.particle.theta = { 0.0, 0.0, 0.0 };
+            game.particle.omega = { 0.0, 0.0, 0.0 };
         }
-        {
-            col = 0;
-
-            GuiLabel(Grid_GetRect(grid, row, col++), "e1e2");
-            // if (GuiValueBox(Grid_GetRect(grid, row, col++), "Hello", &val, RoundFloatToInt(-M_PI * RAD2DEG), RoundFloatToInt(M_PI * RAD2DEG), pressed))
-            // {
-            //     pressed = !pressed;
-            // }
-            theta_e1e2 = GuiSliderBar(Grid_GetRect(grid, row, col++), "", "", theta_e1e2, -2 * M_PI, 2 * M_PI);
-
-            ++col;
-            r            = Grid_GetRect(grid, row, col++);
-            auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
-            if (pressed)
-            {
-                theta_e1e2 = 0;
-            }
 
-            row += 1;
-        }
+        row += 1;
+    }
+    {
+        col = 0;
+
+        GuiLabel(Grid_GetRect(gui.grid, row, col++), "e1e2");
+        // if (GuiValueBox(Grid_GetRect(gui.grid, row, col++), "Hello", &val, RoundFloatToInt(-M_PI * RAD2DEG), RoundFloatToInt(M_PI * RAD2DEG), pressed))
+        // {
+        //     pressed = !pressed;
+        // }
+        gui.theta_e1e2 = GuiSliderBar(Grid_GetRect(gui.grid, row, col++), "", "", gui.theta_e1e2, -2 * M_PI, 2 * M_PI);
+
+        ++col;
+        r            = Grid_GetRect(gui.grid, row, col++);
+        auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
+        if (pressed)
         {
-            col = 0;
+            gui.theta_e1e2 = 0;
+        }
 
-            r = Grid_GetRect(grid, row, col++);
-            GuiLabel(r, "e1e3");
+        row += 1;
+    }
+    {
+        col = 0;
 
-            r          = Grid_GetRect(grid, row, col++);
-            theta_e1e3 = GuiSliderBar(r, "-pi", "pi", theta_e1e3, -2 * M_PI, 2 * M_PI);
-            ++col;
-            r            = Grid_GetRect(grid, row, col++);
-            auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
-            if (pressed)
-            {
-                theta_e1e3 = 0;
-            }
+        r = Grid_GetRect(gui.grid, row, col++);
+        GuiLabel(r, "e1e3");
 
-            row += 1;
-        }
+        r              = Grid_GetRect(gui.grid, row, col++);
+        gui.theta_e1e3 = GuiSliderBar(r, "-pi", "pi", gui.theta_e1e3, -2 * M_PI, 2 * M_PI);
+        ++col;
+        r            = Grid_GetRect(gui.grid, row, col++);
+        auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
+        if (pressed)
         {
-            col = 0;
+            gui.theta_e1e3 = 0;
+        }
 
-            r = Grid_GetRect(grid, row, col++);
-            GuiLabel(r, "e2e3");
+        row += 1;
+    }
+    {
+        col = 0;
 
-            r          = Grid_GetRect(grid, row, col++);
-            theta_e2e3 = GuiSliderBar(r, "-pi", "pi", theta_e2e3, -2 * M_PI, 2 * M_PI);
+        r = Grid_GetRect(gui.grid, row, col++);
+        GuiLabel(r, "e2e3");
 
-            ++col;
-            r            = Grid_GetRect(grid, row, col++);
-            auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
-            if (pressed)
-            {
-                theta_e2e3 = 0;
-            }
+        r              = Grid_GetRect(gui.grid, row, col++);
+        gui.theta_e2e3 = GuiSliderBar(r, "-pi", "pi", gui.theta_e2e3, -2 * M_PI, 2 * M_PI);
 
-            row += 1;
-        }
+        ++col;
+        r            = Grid_GetRect(gui.grid, row, col++);
+        auto pressed = GuiButton(r, GuiIconText(RICON_UNDO, ""));
+        if (pressed)
         {
-            col = 0;
+            gui.theta_e2e3 = 0;
+        }
 
-            auto emitter_props = Emitter_Properties(game.emitter);
-            assert(emitter_props.size() > 0);
+        row += 1;
+    }
+    {
+        col = 0;
 
-            r = Grid_GetRect(grid, row, col++);
-            GuiLabel(r, emitter_props[0].name);
+        auto emitter_props = Emitter_Properties(emitter);
+        assert(emitter_props.size() > 0);
 
-            r = Grid_GetRect(grid, row, col++);
-            Gui_WidgetFromProperty(emitter_props[0], r);
-            row += 1;
-        }
-        {
-            col = 0;
+        r = Grid_GetRect(gui.grid, row, col++);
+        GuiLabel(r, emitter_props[0].name);
 
-            auto emitter_props = Emitter_Properties(game.emitter);
-            assert(emitter_props.size() > 0);
+        r = Grid_GetRect(gui.grid, row, col++);
+        Gui_WidgetFromProperty(emitter_props[0], r);
+        row += 1;
+    }
+    {
+        col = 0;
 
-            r = Grid_GetRect(grid, row, col++);
-            GuiLabel(r, emitter_props[1].name);
+        auto emitter_props = Emitter_Properties(emitter);
+        assert(emitter_props.size() > 0);
 
-            r = Grid_GetRect(grid, row, col++);
-            Gui_WidgetFromProperty(emitter_props[1], r);
+        // Edit the control rather than the snapshot; the simulation
+        // picks it up next tick.
+        emitter_props[1].prop_float.ptr = &game.controls.rate;
 
-            row += 1;
-        }
+        r = Grid_GetRect(gui.grid, row, col++);
+        GuiLabel(r, emitter_props[1].name);
 
-        game.particle.omega = { theta_e1e2, theta_e1e3, theta_e2e3 };
+        r = Grid_GetRect(gui.grid, row, col++);
+        Gui_WidgetFromProperty(emitter_props[1], r);
 
-        EndDrawing();
-        //----------------------------------------------------------------------------------
+        row += 1;
     }
 
+    game.particle.omega = { gui.theta_e1e2, gui.theta_e1e3, gui.theta_e2e3 };
+    game.unseen_click   = false;
+
+    // EndDrawing would poll input too, and eat edges the input stage has
+    // not seen; pacing is the pipeline's job.
+    rlDrawRenderBatchActive();
+    SwapScreenBuffer();
+
+    // Map the next frame's section now, on the GL thread, so render prep
+    // can fill it from a worker.
+    game.stream = static_cast<Particle_Vertex*>(ParticleStream_Begin());
+}
+
+
+// Render stage. Cull and render prep run on a worker, present on the main
+// thread, one frame after another at RENDERS_PER_SEC; neither input nor the
+// simulation waits on them.
+Stage_Task
+RenderStage(GameStruct& game, Demo_Gui& gui)
+{
+    auto clock = StageClock_FromRate(RENDERS_PER_SEC);
+    for (;;)
+    {
+        co_await Pipeline_Tick { game.pipeline, clock, Pipeline_Any };
+        co_await CullStage(game);
+        co_await RenderPrepStage(game);
+        co_await PresentStage(game, gui);
+    }
+}
+
+
+int
+main(void)
+{
+    // Initialization
+    //--------------------------------------------------------------------------------------
+    GameStruct game;
+
+    InitWindow(game.window.w, game.window.h, game.window.title);
+
+    Viewport_Init(game.viewport, game.window);
+
+    // Define the camera to look into our 3d world
+    auto& camera    = game.viewport.camera;
+    camera.position = { 15.0f, 15.0f, 25.0f };
+
+    SetCameraMode(camera, CAMERA_FREE); // Set a free camera mode
+
+    //--------------------------------------------------------------------------------------
+    Particle_Init(game.particle);
+    Emitter_Init(game.emitter);
+
+    Trail_Init(game.trails, game.emitter.particles.capacity(), 32);
+    Ribbon_Reserve(game.ribbons, game.trails);
+
+    // Billboards skip the CPU batch and are written straight into GPU memory.
+    bool persistent = ParticleStream_Init((int)game.emitter.particles.capacity(), sizeof(Particle_Vertex));
+    TraceLog(LOG_INFO, "PARTICLES: Streaming billboards through a %s buffer", persistent ? "persistently mapped" : "per frame mapped");
+
+    // Every sprite goes in the one atlas, so all billboards share a texture.
+    {
+        std::vector<uint8> sheet;
+        MakePuffSheet(sheet, 32, 4, 4);
+
+        Atlas_Init(game.atlas, 256, 256);
+        Atlas_Add(game.atlas, sheet.data(), 32 * 4, 32 * 4, game.puff.sheet);
+        game.puff.cols   = 4;
+        game.puff.rows   = 4;
+        game.puff.frames = 16;
+
+        Image image           = { game.atlas.pixels.data(), game.atlas.width, game.atlas.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        game.atlas_texture    = LoadTextureFromImage(image);
+        game.emitter.flipbook = &game.puff;
+    }
+    game.emitter.trails = &game.trails;
+
+    // A flat 40 x 40 floor and the four cones on it, matching DrawTerrain.
+    HeightField_Init(game.ground, Vec { -20.0f, 0.0f, -20.0f }, 2.5f, 16, 16);
+    HeightField_BuildMips(game.ground);
+    game.world.ground = &game.ground;
+    for (float x : { -5.0f, 5.0f })
+    {
+        for (float z : { -5.0f, 5.0f })
+        {
+            game.world.cylinders.push_back({ Vec { x, 0.0f, z }, 2.0f, 0.0f, 5.0f });
+        }
+    }
+
+    game.controls.rate        = game.emitter.rate;
+    game.controls.render_mode = game.emitter.render_mode;
+    UpdateGame(game);
+
+    // The first frame's billboard section.
+    game.stream = static_cast<Particle_Vertex*>(ParticleStream_Begin());
+
+    Demo_Gui gui;
+    gui.theta_e1e2 = game.particle.omega.x;
+    gui.theta_e1e3 = game.particle.omega.y;
+    gui.theta_e2e3 = game.particle.omega.z;
+
+    int   x_offset     = game.window.w - (50 + 150 + 25 + 25) - (4 * 4);
+    int   Grid_Rows    = 7;
+    int   Grid_Cols    = 5;
+    int   Grid_Spacing = 4;
+    auto& grid         = gui.grid;
+    Grid_Init(grid, x_offset, 4, Grid_Rows, Grid_Cols, Grid_Spacing);
+    Grid_ConfigureRows(grid, 20);
+    Grid_ConfigureColumns(grid, 50);
+    // Grid_ConfigureColumn(grid, 1, 100);
+    Grid_ConfigureColumn(grid, 1, 150);
+    Grid_ConfigureColumn(grid, 2, 25);
+    Grid_ConfigureColumn(grid, 3, 25);
+
+    // Main game loop
+    //--------------------------------------------------------------------------------------
+    Pipeline_Init(game.pipeline, 2);
+    Pipeline_Start(game.pipeline, SimulateStage(game), Pipeline_Any);
+    Pipeline_Start(game.pipeline, RenderStage(game, gui), Pipeline_Any);
+    Pipeline_Start(game.pipeline, InputStage(game), Pipeline_Main);
+    Pipeline_RunMain(game.pipeline); // Until the input stage sees the window close.
+    //--------------------------------------------------------------------------------------
+
     // De-Initialization
     //--------------------------------------------------------------------------------------
+    Pipeline_Free(game.pipeline);
+
+    ParticleStream_Free();
+    UnloadTexture(game.atlas_texture);
     CloseWindow(); // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
 
@@ -0,0 +1,133 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <string.h>
+#include <vector>
+
+
+// One texture for every particle sprite in a scene, so all billboards bind
+// the same texture and a frame draws in a handful of calls. Sprites are
+// packed into shelves: rows filled left to right, a new row starting when
+// one is full. Shelves waste some space but packing is trivial and sprites
+// of similar heights, as flipbook sheets tend to be, pack well.
+
+struct Atlas_Rect
+{
+    float u0 { 0.0f };
+    float v0 { 0.0f };
+    float u1 { 1.0f };
+    float v1 { 1.0f };
+};
+
+struct Sprite_Atlas
+{
+    int                width { 0 };
+    int                height { 0 };
+    std::vector<uint8> pixels; // RGBA8, width * height.
+
+    // Shelf packer state.
+    int shelf_y { 0 };
+    int shelf_h { 0 };
+    int cursor_x { 0 };
+    int padding { 1 }; // Keeps filtering from bleeding between sprites.
+};
+
+
+void
+Atlas_Init(Sprite_Atlas& atlas, int width, int height)
+{
+    atlas.width  = width;
+    atlas.height = height;
+    atlas.pixels.assign(size_t(width) * height * 4, 0);
+
+    atlas.shelf_y  = 0;
+    atlas.shelf_h  = 0;
+    atlas.cursor_x = 0;
+}
+
+
+// Copies a w by h RGBA8 image into the atlas. Returns false, leaving rect
+// alone, when it doesn't fit.
+bool
+Atlas_Add(Sprite_Atlas& atlas, uint8 const* pixels, int w, int h, Atlas_Rect& rect)
+{
+    // Padding goes after each sprite, so it may hang off the far edges.
+    int pad     = atlas.padding;
+    int x       = atlas.cursor_x;
+    int y       = atlas.shelf_y;
+    int tallest = atlas.shelf_h;
+    if (x + w > atlas.width)
+    {
+        x       = 0;
+        y       = atlas.shelf_y + atlas.shelf_h;
+        tallest = 0;
+    }
+    if (w > atlas.width || y + h > atlas.height)
+    {
+        return false;
+    }
+
+    for (int row = 0; row < h; ++row)
+    {
+        memcpy(&atlas.pixels[(size_t(y + row) * atlas.width + x) * 4], pixels + size_t(row) * w * 4, size_t(w) * 4);
+    }
+
+    atlas.cursor_x = x + w + pad;
+    atlas.shelf_y  = y;
+    atlas.shelf_h  = (h + pad > tallest) ? h + pad : tallest;
+
+    rect.u0 = float(x) / atlas.width;
+    rect.v0 = float(y) / atlas.height;
+    rect.u1 = float(x + w) / atlas.width;
+    rect.v1 = float(y + h) / atlas.height;
+    return true;
+}
+
+
+// An animated sprite sheet inside the atlas: cols by rows frames, left to
+// right, top to bottom. With fps zero the animation plays once over the
+// particle's life; otherwise it plays at fps, looping or holding the last
+// frame.
+struct Flipbook
+{
+    Atlas_Rect sheet;
+    uint16     cols { 1 };
+    uint16     rows { 1 };
+    uint16     frames { 1 };
+    float      fps { 0.0f };
+    bool       loop { true };
+};
+
+
+uint32
+Flipbook_Frame(Flipbook const& flipbook, float age, float elapsed_sec)
+{
+    // A flipbook with no frames shows its first.
+    int frames = (flipbook.frames > 0) ? flipbook.frames : 1;
+    int frame  = (flipbook.fps > 0.0f) ? int(elapsed_sec * flipbook.fps) : int(age * frames);
+    if (flipbook.fps > 0.0f && flipbook.loop)
+    {
+        frame %= frames;
+    }
+    frame = (frame < 0) ? 0 : frame;
+    frame = (frame >= frames) ? frames - 1 : frame;
+    return static_cast<uint32>(frame);
+}
+
+
+Atlas_Rect
+Flipbook_FrameRect(Flipbook const& flipbook, uint32 frame)
+{
+    uint32 cols = (flipbook.cols > 0) ? flipbook.cols : 1;
+    uint32 rows = (flipbook.rows > 0) ? flipbook.rows : 1;
+    float  w    = (flipbook.sheet.u1 - flipbook.sheet.u0) / cols;
+    float  h    = (flipbook.sheet.v1 - flipbook.sheet.v0) / rows;
+    auto   c    = frame % cols;
+    auto   r    = frame / cols;
+
+    Atlas_Rect rect;
+    rect.u0 = flipbook.sheet.u0 + c * w;
+    rect.v0 = flipbook.sheet.v0 + r * h;
+    rect.u1 = rect.u0 + w;
+    rect.v1 = rect.v0 + h;
+    return rect;
+}
@@ -0,0 +1,444 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/billboard.h"
+#include "Particles/particle.h"
+#include "Particles/thread_pool.h"
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Interchangeable implementations of an emitter's stages, picked at run
+// time. Emitter_Integrate and its stages (Emitter_Spawn,
+// Emitter_IntegrateParticles, Emitter_Affect, Emitter_Compact) stay the
+// readable reference, and every backend must give bit identical particles,
+// events and vertices to it; the cross backend test holds them to that.
+// As with the golden traces, that assumes the build doesn't contract
+// multiply adds (-ffp-contract=off where FMA is enabled).
+//
+//     Particle_Backend backend = { Backend_Threaded, &pool };
+//     Backend_Integrate(backend, emitter, dt);
+//
+// Spawning draws from the emitter's one random stream in particle order and
+// curves and trails are already batched passes, so every backend shares
+// those stages; they differ in integration, compaction and render prep.
+
+enum Backend_Kind : uint32
+{
+    Backend_Scalar,   // The reference stages, a particle at a time.
+    Backend_SIMD,     // Batches of 64 gathered into flat arrays.
+    Backend_Threaded, // Backend_SIMD with the batches split across a pool.
+    Backend_Kind_Count
+};
+
+struct Particle_Backend
+{
+    Backend_Kind kind { Backend_Scalar };
+    Thread_Pool* pool { nullptr }; // Backend_Threaded only. Without one it runs as Backend_SIMD.
+};
+
+
+char const* const Backend_Names[Backend_Kind_Count] = { "scalar", "simd", "threaded" };
+
+
+// Parses a backend name, as in Backend_Names. Leaves kind alone and returns
+// false for anything else.
+bool
+Backend_Parse(char const* name, Backend_Kind& kind)
+{
+    for (uint32 k = 0; k < Backend_Kind_Count; ++k)
+    {
+        if (name && strcmp(name, Backend_Names[k]) == 0)
+        {
+            kind = static_cast<Backend_Kind>(k);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+Backend_Kind
+Backend_Resolve(Particle_Backend const& backend)
+{
+    if (backend.kind == Backend_Threaded && !backend.pool)
+    {
+        return Backend_SIMD;
+    }
+    return backend.kind;
+}
+
+
+// Integrates particles [begin, begin + count), count at most 64, as
+// Emitter_IntegrateParticles does, without raising events, and grows
+// bounds around the survivors. Normalised ages from before the step go to
+// before when it is given. Safe to run on disjoint batches in parallel.
+template <uint32 Features, size_t Capacity>
+void
+Backend_IntegrateBatch(Emitter_Of<Features, Capacity>& emitter,
+                       size_t                          begin,
+                       size_t                          count,
+                       float                           time_sec,
+                       float*                          before,
+                       Bounds_Partial&                 bounds)
+{
+    constexpr size_t Batch = 64;
+    constexpr bool   Acc   = Particle_Has(Features, Particle_Feature_Acceleration);
+
+    auto& particles = emitter.particles;
+    auto& params    = emitter.params;
+
+    float px[Batch], py[Batch], pz[Batch];
+    float vx[Batch], vy[Batch], vz[Batch];
+    float ax[Batch], ay[Batch], az[Batch];
+    float life[Batch], speed2[Batch], acc2[Batch];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& particle = particles[begin + i];
+        px[i]          = particle.pos.x;
+        py[i]          = particle.pos.y;
+        pz[i]          = particle.pos.z;
+        vx[i]          = particle.vel.x;
+        vy[i]          = particle.vel.y;
+        vz[i]          = particle.vel.z;
+        if constexpr (Acc)
+        {
+            ax[i] = particle.acc.x;
+            ay[i] = particle.acc.y;
+            az[i] = particle.acc.z;
+        }
+        life[i] = particle.lifetime_sec;
+        if (before)
+        {
+            before[i] = 1.0f - particle.lifetime_sec / particle.duration_sec;
+        }
+    }
+
+    // The whole batch takes its fastest particle's step count, as
+    // Emitter_IntegrateSubsteps does.
+    int steps = 1;
+    if (params.substep_cell > 0.0f)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            speed2[i] = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+        }
+        steps = Particle_SubstepCount(sqrtf(Particle_MaxSpeedSquared(speed2, count)), time_sec, params);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        life[i] -= time_sec;
+    }
+
+    // As Particle_IntegrateMotion. Dead particles are stepped too but never
+    // written back.
+    float t    = time_sec / steps;
+    Vec   g    = params.gravity;
+    float keep = 1.0f - params.drag * t;
+    keep       = (keep < 0.0f) ? 0.0f : keep;
+    bool  drag = params.drag > 0.0f;
+    for (int step = 0; step < steps; ++step)
+    {
+        if constexpr (Acc)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                ax[i] += g.x * t;
+                ay[i] += g.y * t;
+                az[i] += g.z * t;
+                vx[i] += ax[i] * t;
+                vy[i] += ay[i] * t;
+                vz[i] += az[i] * t;
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                vx[i] += g.x * t;
+                vy[i] += g.y * t;
+                vz[i] += g.z * t;
+            }
+        }
+        if (drag)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                vx[i] *= keep;
+                vy[i] *= keep;
+                vz[i] *= keep;
+            }
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            px[i] += vx[i] * t;
+            py[i] += vy[i] * t;
+            pz[i] += vz[i] * t;
+        }
+    }
+
+    // Survivors are packed to the front of the position arrays as they are
+    // written back, ready for the bounds.
+    size_t live = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& particle        = particles[begin + i];
+        particle.lifetime_sec = life[i];
+        if (life[i] < 0)
+        {
+            continue;
+        }
+
+        particle.pos.x = px[i];
+        particle.pos.y = py[i];
+        particle.pos.z = pz[i];
+        particle.vel.x = vx[i];
+        particle.vel.y = vy[i];
+        particle.vel.z = vz[i];
+        speed2[live]   = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+        if constexpr (Acc)
+        {
+            particle.acc.x = ax[i];
+            particle.acc.y = ay[i];
+            particle.acc.z = az[i];
+            acc2[live]     = ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i];
+        }
+        Particle_IntegrateRotation(particle);
+
+        px[live] = px[i];
+        py[live] = py[i];
+        pz[live] = pz[i];
+        ++live;
+    }
+
+    Bounds_Reduce(bounds.box, px, py, pz, live);
+    float s2          = Particle_MaxSpeedSquared(speed2, live);
+    bounds.max_speed2 = (s2 > bounds.max_speed2) ? s2 : bounds.max_speed2;
+    if constexpr (Acc)
+    {
+        float a2        = Particle_MaxSpeedSquared(acc2, live);
+        bounds.max_acc2 = (a2 > bounds.max_acc2) ? a2 : bounds.max_acc2;
+    }
+}
+
+
+// Age events in particle order, from the ages Backend_IntegrateBatch saved.
+template <uint32 Features, size_t Capacity>
+void
+Backend_EmitAgeEvents(Emitter_Of<Features, Capacity>& emitter, float const* before)
+{
+    auto& particles = emitter.particles;
+    for (size_t i = 0; i < particles.size(); ++i)
+    {
+        auto& particle = particles[i];
+        float after    = 1.0f - particle.lifetime_sec / particle.duration_sec;
+        if (Event_AgeCrossed(before[i], after, emitter.event_age))
+        {
+            Event_Emit(*emitter.events, Particle_Event_Age, emitter.event_id, particle.pos, particle.vel);
+        }
+    }
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+Backend_IntegrateParticles(Particle_Backend const&         backend,
+                           Emitter_Of<Features, Capacity>& emitter,
+                           float                           time_sec)
+{
+    constexpr size_t Batch = 64;
+
+    auto kind = Backend_Resolve(backend);
+    if (kind == Backend_Scalar)
+    {
+        Emitter_IntegrateParticles(emitter, time_sec);
+        return;
+    }
+
+    // One set of bounds a worker, merged after.
+    int   n_workers = (kind == Backend_Threaded) ? ThreadPool_Size(*backend.pool) : 1;
+    auto& bounds    = emitter.worker_bounds;
+    bounds.assign(n_workers, Bounds_Partial {});
+
+    bool   age_events = emitter.events && emitter.event_age >= 0.0f;
+    auto   n          = emitter.particles.size();
+    size_t n_batches  = (n + Batch - 1) / Batch;
+    float* before     = nullptr;
+    if (age_events)
+    {
+        emitter.ages.resize(n);
+        before = emitter.ages.data();
+    }
+    auto   run        = [&](int worker, size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b)
+        {
+            size_t begin = b * Batch;
+            size_t count = (n - begin < Batch) ? n - begin : Batch;
+            Backend_IntegrateBatch(emitter, begin, count, time_sec, before ? before + begin : nullptr, bounds[worker]);
+        }
+    };
+
+    if (kind == Backend_Threaded)
+    {
+        ThreadPool_For(*backend.pool, n_batches, run);
+    }
+    else
+    {
+        run(0, 0, n_batches);
+    }
+
+    // Min, max and so the merge are exact, so the result is the reference's
+    // whatever the split.
+    Bounds_Partial all;
+    for (auto& b : bounds)
+    {
+        Bounds_Union(all.box, b.box);
+        all.max_speed2 = (b.max_speed2 > all.max_speed2) ? b.max_speed2 : all.max_speed2;
+        all.max_acc2   = (b.max_acc2 > all.max_acc2) ? b.max_acc2 : all.max_acc2;
+    }
+    emitter.bounds.box       = all.box;
+    emitter.bounds.measured  = all.box;
+    emitter.bounds.max_speed = sqrtf(all.max_speed2);
+    emitter.bounds.max_acc   = sqrtf(all.max_acc2);
+
+    // Events go out afterwards, in particle order, whichever thread
+    // integrated the particle.
+    if (age_events)
+    {
+        Backend_EmitAgeEvents(emitter, before);
+    }
+}
+
+
+// Finds expired particles a batch at a time, skipping batches with none in
+// them four lifetimes to a compare.
+template <uint32 Features, size_t Capacity>
+void
+Backend_Compact(Particle_Backend const& backend, Emitter_Of<Features, Capacity>& emitter)
+{
+    constexpr size_t Batch = 64;
+
+    if (Backend_Resolve(backend) == Backend_Scalar)
+    {
+        Emitter_Compact(emitter);
+        return;
+    }
+
+    auto& particles = emitter.particles;
+    float life[Batch];
+
+    auto& to_remove = emitter.dead;
+    to_remove.clear();
+    for (size_t begin = 0; begin < particles.size(); begin += Batch)
+    {
+        size_t count = (particles.size() - begin < Batch) ? particles.size() - begin : Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            life[i] = particles[begin + i].lifetime_sec;
+        }
+
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        auto zero = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            int dead = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(life + i), zero));
+            for (int lane = 0; dead; ++lane, dead >>= 1)
+            {
+                if (dead & 1)
+                {
+                    to_remove.push_back(begin + i + lane);
+                }
+            }
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            if (life[i] < 0)
+            {
+                to_remove.push_back(begin + i);
+            }
+        }
+    }
+
+    if (!to_remove.empty())
+    {
+        Emitter_RemoveDead(emitter, to_remove);
+    }
+}
+
+
+// As Emitter_WriteBillboards. Backend_Scalar writes a quad at a time, the
+// others in batches, Backend_Threaded with the batches split across the
+// pool.
+template <uint32 Features, size_t Capacity>
+size_t
+Backend_WriteBillboards(Particle_Backend const&               backend,
+                        Particle_Vertex*                      out,
+                        size_t                                max_quads,
+                        Emitter_Of<Features, Capacity> const& emitter,
+                        Billboard_Camera const&               camera,
+                        float                                 scale,
+                        Particle_Color                        color,
+                        uint32 const*                         order = nullptr)
+{
+    constexpr size_t Batch = 64;
+
+    if (emitter.render_mode != Render_Mode_Billboard)
+    {
+        return 0;
+    }
+
+    auto n = emitter.particles.size();
+    n      = (n < max_quads) ? n : max_quads;
+
+    switch (Backend_Resolve(backend))
+    {
+        case Backend_Scalar:
+            for (size_t i = 0; i < n; ++i)
+            {
+                Emitter_WriteBillboardRange(out, emitter, camera, scale, color, order, i, i + 1);
+            }
+            break;
+
+        case Backend_SIMD:
+            Emitter_WriteBillboardRange(out, emitter, camera, scale, color, order, 0, n);
+            break;
+
+        default:
+        {
+            size_t n_batches = (n + Batch - 1) / Batch;
+            ThreadPool_For(*backend.pool, n_batches, [&](int, size_t first, size_t last) {
+                size_t end = (last * Batch < n) ? last * Batch : n;
+                Emitter_WriteBillboardRange(out, emitter, camera, scale, color, order, first * Batch, end);
+            });
+            break;
+        }
+    }
+    return n;
+}
+
+
+// One tick, as Emitter_Integrate. Only the scalar backend needs a separate
+// pass to measure bounds; the others measure as they integrate.
+template <uint32 Features, size_t Capacity>
+void
+Backend_Integrate(Particle_Backend const& backend, Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    Emitter_Spawn(emitter, time_sec);
+    Backend_IntegrateParticles(backend, emitter, time_sec);
+    Emitter_Affect(emitter, time_sec);
+    Backend_Compact(backend, emitter);
+    if (Backend_Resolve(backend) == Backend_Scalar)
+    {
+        Emitter_MeasureBounds(emitter);
+    }
+    Emitter_Reorder(emitter);
+}
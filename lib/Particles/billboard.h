@@ -0,0 +1,305 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/atlas.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include "Particles/render_batch.h"
+#include <math.h>
+
+
+// Camera facing quads for Render_Mode_Billboard: four vertices and six
+// indices a particle instead of a cube's thirty six vertices. Every quad
+// shares the camera's right and up axes, so expansion is a gather into flat
+// arrays followed by straight loops over a batch, and a whole emitter, or a
+// whole system, lands in one Render_Batch for one draw call.
+
+struct Billboard_Camera
+{
+    Vec right;
+    Vec up;
+};
+
+
+Billboard_Camera
+Billboard_CameraFromLookAt(Vec eye, Vec target, Vec world_up)
+{
+    Vec f = { target.x - eye.x, target.y - eye.y, target.z - eye.z };
+    Vec r = { f.y * world_up.z - f.z * world_up.y, f.z * world_up.x - f.x * world_up.z, f.x * world_up.y - f.y * world_up.x };
+    Vec u = { r.y * f.z - r.z * f.y, r.z * f.x - r.x * f.z, r.x * f.y - r.y * f.x };
+
+    float r_len = sqrtf(r.x * r.x + r.y * r.y + r.z * r.z);
+    float u_len = sqrtf(u.x * u.x + u.y * u.y + u.z * u.z);
+
+    Billboard_Camera camera;
+    camera.right = (r_len > 0.0f) ? r * (1.0f / r_len) : Vec { 1.0f, 0.0f, 0.0f };
+    camera.up    = (u_len > 0.0f) ? u * (1.0f / u_len) : Vec { 0.0f, 1.0f, 0.0f };
+    return camera;
+}
+
+
+// Reserves room for n quads on top of what the batch already holds.
+void
+Billboard_Reserve(Render_Batch& batch, size_t n)
+{
+    Render_Reserve(batch, batch.vertices.size() + 4 * n, batch.indices.size() + 6 * n);
+}
+
+
+// Writes four vertices for each of n quads centred on x, y, z with half
+// widths half, each textured with its own atlas rect. out may be mapped GPU
+// memory; it is only ever written, in order.
+void
+Billboard_WriteVertices(Particle_Vertex*        out,
+                        Billboard_Camera const& camera,
+                        float const*            x,
+                        float const*            y,
+                        float const*            z,
+                        float const*            half,
+                        Particle_Color const*   color,
+                        Atlas_Rect const*       uv,
+                        size_t                  n)
+{
+    constexpr size_t Batch = 64;
+
+    // Corner offsets from the centre, right + up and right - up. The other
+    // two corners are their negations.
+    float ax[Batch], ay[Batch], az[Batch];
+    float bx[Batch], by[Batch], bz[Batch];
+
+    for (size_t begin = 0; begin < n; begin += Batch)
+    {
+        size_t count = (n - begin < Batch) ? n - begin : Batch;
+        auto*  h     = half + begin;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            ax[i] = (camera.right.x + camera.up.x) * h[i];
+            ay[i] = (camera.right.y + camera.up.y) * h[i];
+            az[i] = (camera.right.z + camera.up.z) * h[i];
+            bx[i] = (camera.right.x - camera.up.x) * h[i];
+            by[i] = (camera.right.y - camera.up.y) * h[i];
+            bz[i] = (camera.right.z - camera.up.z) * h[i];
+        }
+
+        auto* v = out + 4 * begin;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto  j = begin + i;
+            auto  c = color[j];
+            auto& t = uv[j];
+
+            v[4 * i + 0] = { x[j] - bx[i], y[j] - by[i], z[j] - bz[i], t.u0, t.v0, c }; // Top left.
+            v[4 * i + 1] = { x[j] - ax[i], y[j] - ay[i], z[j] - az[i], t.u0, t.v1, c }; // Bottom left.
+            v[4 * i + 2] = { x[j] + bx[i], y[j] + by[i], z[j] + bz[i], t.u1, t.v1, c }; // Bottom right.
+            v[4 * i + 3] = { x[j] + ax[i], y[j] + ay[i], z[j] + az[i], t.u1, t.v0, c }; // Top right.
+        }
+    }
+}
+
+
+// Two triangles for each of n quads whose vertices start at base. The
+// pattern never changes, so a GPU index buffer can be filled once.
+void
+Billboard_WriteIndices(uint32* out, uint32 base, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32 q = base + 4 * static_cast<uint32>(i);
+
+        out[6 * i + 0] = q;
+        out[6 * i + 1] = q + 1;
+        out[6 * i + 2] = q + 2;
+        out[6 * i + 3] = q;
+        out[6 * i + 4] = q + 2;
+        out[6 * i + 5] = q + 3;
+    }
+}
+
+
+// Appends n quads to a batch, see Billboard_WriteVertices.
+void
+Billboard_Expand(Render_Batch&           batch,
+                 Billboard_Camera const& camera,
+                 float const*            x,
+                 float const*            y,
+                 float const*            z,
+                 float const*            half,
+                 Particle_Color const*   color,
+                 Atlas_Rect const*       uv,
+                 size_t                  n)
+{
+    auto v0 = batch.vertices.size();
+    auto i0 = batch.indices.size();
+    batch.vertices.resize(v0 + 4 * n);
+    batch.indices.resize(i0 + 6 * n);
+
+    Billboard_WriteVertices(batch.vertices.data() + v0, camera, x, y, z, half, color, uv, n);
+    Billboard_WriteIndices(batch.indices.data() + i0, static_cast<uint32>(v0), n);
+}
+
+
+// Gathers one particle into slot i of a Billboard_Expand batch. Width is
+// particle.size * scale, or scale for particles without a size channel;
+// colour is the particle's own where it has one. The flipbook frame comes
+// from the particle's age.
+template <typename Particle_Type>
+void
+Billboard_Gather(Particle_Type const& particle,
+                 size_t               i,
+                 float                scale,
+                 Particle_Color       color,
+                 Flipbook const*      flipbook,
+                 float*               x,
+                 float*               y,
+                 float*               z,
+                 float*               half,
+                 Particle_Color*      colors,
+                 Atlas_Rect*          uvs)
+{
+    constexpr uint32 Features = Particle_Type::features;
+
+    x[i]    = particle.pos.x;
+    y[i]    = particle.pos.y;
+    z[i]    = particle.pos.z;
+    half[i] = 0.5f * scale;
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        half[i] *= particle.size;
+    }
+
+    colors[i] = color;
+    if constexpr (Particle_Has(Features, Particle_Feature_Color))
+    {
+        colors[i] = particle.color;
+    }
+
+    uvs[i] = Atlas_Rect {};
+    if (flipbook)
+    {
+        float elapsed = particle.duration_sec - particle.lifetime_sec;
+        float age     = elapsed / particle.duration_sec;
+        uvs[i]        = Flipbook_FrameRect(*flipbook, Flipbook_Frame(*flipbook, age, elapsed));
+    }
+}
+
+
+// Writes four vertices for each of the particles [begin, end) in draw
+// order, starting at out + 4 * begin. Disjoint ranges can be written in
+// parallel.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_WriteBillboardRange(Particle_Vertex*                      out,
+                            Emitter_Of<Features, Capacity> const& emitter,
+                            Billboard_Camera const&               camera,
+                            float                                 scale,
+                            Particle_Color                        color,
+                            uint32 const*                         order,
+                            size_t                                begin,
+                            size_t                                end)
+{
+    constexpr size_t Batch = 64;
+
+    float          x[Batch], y[Batch], z[Batch], half[Batch];
+    Particle_Color colors[Batch];
+    Atlas_Rect     uvs[Batch];
+
+    for (size_t first = begin; first < end; first += Batch)
+    {
+        size_t count = (end - first < Batch) ? end - first : Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto index = order ? order[first + i] : first + i;
+            Billboard_Gather(emitter.particles[index], i, scale, color, emitter.flipbook, x, y, z, half, colors, uvs);
+        }
+        Billboard_WriteVertices(out + 4 * first, camera, x, y, z, half, colors, uvs, count);
+    }
+}
+
+
+// Writes four vertices for each particle of a billboard emitter, at most
+// max_quads of them, and returns how many quads were written. order, when
+// given, is a draw order over the emitter's particles (Depth_Sort::order),
+// for blended sprites.
+template <uint32 Features, size_t Capacity>
+size_t
+Emitter_WriteBillboards(Particle_Vertex*                      out,
+                        size_t                                max_quads,
+                        Emitter_Of<Features, Capacity> const& emitter,
+                        Billboard_Camera const&               camera,
+                        float                                 scale,
+                        Particle_Color                        color,
+                        uint32 const*                         order = nullptr)
+{
+    if (emitter.render_mode != Render_Mode_Billboard)
+    {
+        return 0;
+    }
+
+    auto n = emitter.particles.size();
+    n      = (n < max_quads) ? n : max_quads;
+    Emitter_WriteBillboardRange(out, emitter, camera, scale, color, order, 0, n);
+    return n;
+}
+
+
+// Appends a quad for every particle of a billboard emitter, see
+// Emitter_WriteBillboards.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_BuildBillboards(Render_Batch&                         batch,
+                        Emitter_Of<Features, Capacity> const& emitter,
+                        Billboard_Camera const&               camera,
+                        float                                 scale,
+                        Particle_Color                        color,
+                        uint32 const*                         order = nullptr)
+{
+    if (emitter.render_mode != Render_Mode_Billboard)
+    {
+        return;
+    }
+
+    auto n  = emitter.particles.size();
+    auto v0 = batch.vertices.size();
+    auto i0 = batch.indices.size();
+    batch.vertices.resize(v0 + 4 * n);
+    batch.indices.resize(i0 + 6 * n);
+
+    Emitter_WriteBillboards(batch.vertices.data() + v0, n, emitter, camera, scale, color, order);
+    Billboard_WriteIndices(batch.indices.data() + i0, static_cast<uint32>(v0), n);
+}
+
+
+// Appends a quad for every particle whose emitter draws billboards, in one
+// pass over the pooled particles.
+template <uint32 Features>
+void
+ParticleSystem_BuildBillboards(Render_Batch&                      batch,
+                               ParticleSystem_Of<Features> const& system,
+                               Billboard_Camera const&            camera,
+                               float                              scale,
+                               Particle_Color                     color)
+{
+    constexpr size_t Batch = 64;
+
+    float          x[Batch], y[Batch], z[Batch], half[Batch];
+    Particle_Color colors[Batch];
+    Atlas_Rect     uvs[Batch];
+
+    size_t count = 0;
+    for (size_t i = 0; i < system.particles.size(); ++i)
+    {
+        auto& emitter = system.emitters[system.owners[i]];
+        if (emitter.render_mode != Render_Mode_Billboard)
+        {
+            continue;
+        }
+
+        Billboard_Gather(system.particles[i], count, scale, color, emitter.flipbook, x, y, z, half, colors, uvs);
+        if (++count == Batch)
+        {
+            Billboard_Expand(batch, camera, x, y, z, half, colors, uvs, count);
+            count = 0;
+        }
+    }
+    Billboard_Expand(batch, camera, x, y, z, half, colors, uvs, count);
+}
@@ -0,0 +1,220 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/spawn_shapes.h"
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Where an emitter's particles are. Each emitter keeps a box around its live
+// particles, measured as it integrates, so the camera and collision can skip
+// whole emitters without touching their particles. An emitter that skips
+// ticks (throttled by simulation LOD) isn't measured; its box is grown
+// instead by how far anything in it could have moved since.
+
+struct Bounds_Box
+{
+    Vec min { HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    Vec max { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+};
+
+
+bool
+Bounds_IsEmpty(Bounds_Box const& box)
+{
+    return box.min.x > box.max.x;
+}
+
+
+void
+Bounds_Add(Bounds_Box& box, Vec const& p)
+{
+    box.min.x = (p.x < box.min.x) ? p.x : box.min.x;
+    box.min.y = (p.y < box.min.y) ? p.y : box.min.y;
+    box.min.z = (p.z < box.min.z) ? p.z : box.min.z;
+    box.max.x = (p.x > box.max.x) ? p.x : box.max.x;
+    box.max.y = (p.y > box.max.y) ? p.y : box.max.y;
+    box.max.z = (p.z > box.max.z) ? p.z : box.max.z;
+}
+
+
+void
+Bounds_Union(Bounds_Box& box, Bounds_Box const& other)
+{
+    if (Bounds_IsEmpty(other))
+    {
+        return;
+    }
+    Bounds_Add(box, other.min);
+    Bounds_Add(box, other.max);
+}
+
+
+bool
+Bounds_Overlap(Bounds_Box const& a, Bounds_Box const& b)
+{
+    return a.min.x <= b.max.x && b.min.x <= a.max.x
+           && a.min.y <= b.max.y && b.min.y <= a.max.y
+           && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+
+// Grows a box by r on every side. Empty stays empty.
+Bounds_Box
+Bounds_Inflate(Bounds_Box const& box, float r)
+{
+    if (Bounds_IsEmpty(box))
+    {
+        return box;
+    }
+    return { Vec { box.min.x - r, box.min.y - r, box.min.z - r }, Vec { box.max.x + r, box.max.y + r, box.max.z + r } };
+}
+
+
+Vec
+Bounds_Center(Bounds_Box const& box)
+{
+    return Vec { 0.5f * (box.min.x + box.max.x), 0.5f * (box.min.y + box.max.y), 0.5f * (box.min.z + box.max.z) };
+}
+
+
+// Radius of the sphere around the box.
+float
+Bounds_Radius(Bounds_Box const& box)
+{
+    float dx = box.max.x - box.min.x;
+    float dy = box.max.y - box.min.y;
+    float dz = box.max.z - box.min.z;
+    return 0.5f * sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+
+// Grows a box around n points, four at a time where SSE is available.
+void
+Bounds_Reduce(Bounds_Box& box, float const* x, float const* y, float const* z, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    if (n >= 4)
+    {
+        auto min_x = _mm_set1_ps(box.min.x), max_x = _mm_set1_ps(box.max.x);
+        auto min_y = _mm_set1_ps(box.min.y), max_y = _mm_set1_ps(box.max.y);
+        auto min_z = _mm_set1_ps(box.min.z), max_z = _mm_set1_ps(box.max.z);
+        for (; i + 4 <= n; i += 4)
+        {
+            auto px = _mm_loadu_ps(x + i);
+            auto py = _mm_loadu_ps(y + i);
+            auto pz = _mm_loadu_ps(z + i);
+            min_x   = _mm_min_ps(min_x, px);
+            max_x   = _mm_max_ps(max_x, px);
+            min_y   = _mm_min_ps(min_y, py);
+            max_y   = _mm_max_ps(max_y, py);
+            min_z   = _mm_min_ps(min_z, pz);
+            max_z   = _mm_max_ps(max_z, pz);
+        }
+
+        float lo[3][4], hi[3][4];
+        _mm_storeu_ps(lo[0], min_x);
+        _mm_storeu_ps(lo[1], min_y);
+        _mm_storeu_ps(lo[2], min_z);
+        _mm_storeu_ps(hi[0], max_x);
+        _mm_storeu_ps(hi[1], max_y);
+        _mm_storeu_ps(hi[2], max_z);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            Bounds_Add(box, Vec { lo[0][lane], lo[1][lane], lo[2][lane] });
+            Bounds_Add(box, Vec { hi[0][lane], hi[1][lane], hi[2][lane] });
+        }
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        Bounds_Add(box, Vec { x[i], y[i], z[i] });
+    }
+}
+
+
+// Every position Spawn_Sample can return for a shape.
+Bounds_Box
+Bounds_OfSpawn(Spawn_Desc const& desc)
+{
+    Bounds_Box box;
+    auto&      e = desc.extents;
+    switch (desc.shape)
+    {
+    case Spawn_Shape_Sphere:
+        box = { Vec { -e.x, -e.x, -e.x }, Vec { e.x, e.x, e.x } };
+        break;
+    case Spawn_Shape_Hemisphere:
+        box = { Vec { -e.x, 0.0f, -e.x }, Vec { e.x, e.x, e.x } };
+        break;
+    case Spawn_Shape_Box:
+        box = { Vec { -e.x, -e.y, -e.z }, Vec { e.x, e.y, e.z } };
+        break;
+    case Spawn_Shape_Disc:
+        box = { Vec { -e.x, 0.0f, -e.x }, Vec { e.x, 0.0f, e.x } };
+        break;
+    case Spawn_Shape_Mesh:
+        if (desc.mesh && !desc.mesh->prob.empty())
+        {
+            for (auto& v : desc.mesh->vertices)
+            {
+                Bounds_Add(box, v);
+            }
+            break;
+        }
+        Bounds_Add(box, Vec { 0.0f, 0.0f, 0.0f });
+        break;
+    default:
+        Bounds_Add(box, Vec { 0.0f, 0.0f, 0.0f });
+        break;
+    }
+    return box;
+}
+
+
+// An emitter's box, and what it needs to grow it between measurements.
+struct Emitter_Bounds
+{
+    Bounds_Box box;      // Holds every live particle. What queries use.
+    Bounds_Box measured; // As of the last tick.
+    float      max_speed { 0.0f };
+    float      max_acc { 0.0f }; // Particles with an acceleration channel.
+};
+
+
+// Emitter_MeasureBounds over part of an emitter, gathered batch by batch
+// while integrating and merged after. Speeds are kept squared until then.
+struct Bounds_Partial
+{
+    Bounds_Box box;
+    float      max_speed2 { 0.0f };
+    float      max_acc2 { 0.0f };
+};
+
+
+// Furthest a particle can move in time_sec from speed and acc under gravity,
+// however the time is split into steps. Per step of dt, velocity grows by at
+// most |acc| dt and acceleration by |g| dt, and drag only ever slows, so
+// over n steps the distance is at most
+//
+//     speed n dt + acc dt^2 n(n+1)/2 + |g| dt^3 n(n+1)(n+2)/6
+//
+// which is under speed t + acc t^2 + |g| t^3 for n >= 1. Without an
+// acceleration channel gravity acts on velocity directly, one order down.
+float
+Bounds_Reach(float speed, float acc, Vec gravity, bool has_acc, float time_sec)
+{
+    float t = time_sec;
+    float g = sqrtf(gravity.x * gravity.x + gravity.y * gravity.y + gravity.z * gravity.z);
+    if (has_acc)
+    {
+        return speed * t + acc * t * t + g * t * t * t;
+    }
+    return speed * t + g * t * t;
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/bounds.h"
+#include "Particles/simulation_lod.h"
+#include <algorithm>
+#include <vector>
+
+
+// A bounding volume hierarchy over the boxes of a scene's emitters, so
+// culling and collision visit only the emitters near what they are looking
+// for. Build it when emitters come and go; in between, refit it once a frame
+// from the emitters' current boxes, which keeps the shape of the tree and
+// only recomputes node boxes.
+//
+//     BoundsTree_Build(tree, boxes.data(), boxes.size());
+//     ...
+//     BoundsTree_Refit(tree, boxes.data());
+//     BoundsTree_Visible(tree, boxes.data(), camera, visible);
+//
+// Any test that passes a box whenever it passes a box inside it will do for
+// BoundsTree_Collect, Collision_Touches among them.
+
+constexpr uint32 BoundsTree_LeafSize = 4;
+
+struct Bounds_Node
+{
+    Bounds_Box box;
+    uint32     first { 0 }; // Leaves: first item. Otherwise: first of two children, side by side.
+    uint32     count { 0 }; // Items in a leaf, which may be none. Zero otherwise.
+    bool       leaf { true };
+};
+
+struct Bounds_Tree
+{
+    std::vector<Bounds_Node> nodes; // nodes[0] is the root. Children come after their parent.
+    std::vector<uint32>      items; // Indices into the boxes the tree was built from.
+};
+
+
+// Builds the tree over n boxes, top down, splitting each node at the median
+// centre along its longest axis. Empty boxes are kept, split as if centred
+// on the origin, so a refit picks them up once they hold something.
+void
+BoundsTree_Build(Bounds_Tree& tree, Bounds_Box const* boxes, size_t n)
+{
+    tree.nodes.clear();
+    tree.items.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        tree.items.push_back(static_cast<uint32>(i));
+    }
+
+    auto centre = [boxes](uint32 item) {
+        return Bounds_IsEmpty(boxes[item]) ? Vec { 0.0f, 0.0f, 0.0f } : Bounds_Center(boxes[item]);
+    };
+
+    tree.nodes.push_back({ Bounds_Box {}, 0, static_cast<uint32>(tree.items.size()) });
+
+    std::vector<uint32> stack = { 0 };
+    while (!stack.empty())
+    {
+        auto index = stack.back();
+        stack.pop_back();
+
+        auto first = tree.nodes[index].first;
+        auto count = tree.nodes[index].count;
+
+        Bounds_Box box, centres;
+        for (uint32 i = first; i < first + count; ++i)
+        {
+            Bounds_Union(box, boxes[tree.items[i]]);
+            Bounds_Add(centres, centre(tree.items[i]));
+        }
+        tree.nodes[index].box = box;
+        if (count <= BoundsTree_LeafSize)
+        {
+            continue;
+        }
+
+        float extent[3] = { centres.max.x - centres.min.x, centres.max.y - centres.min.y, centres.max.z - centres.min.z };
+        int   axis      = (extent[1] > extent[0]) ? 1 : 0;
+        axis            = (extent[2] > extent[axis]) ? 2 : axis;
+
+        auto begin = tree.items.begin() + first;
+        auto mid   = begin + count / 2;
+        std::nth_element(begin, mid, begin + count, [&](uint32 a, uint32 b) {
+            Vec ca = centre(a);
+            Vec cb = centre(b);
+            return (&ca.x)[axis] < (&cb.x)[axis];
+        });
+
+        auto left = static_cast<uint32>(tree.nodes.size());
+        tree.nodes.push_back({ Bounds_Box {}, first, count / 2 });
+        tree.nodes.push_back({ Bounds_Box {}, first + count / 2, count - count / 2 });
+        tree.nodes[index].first = left;
+        tree.nodes[index].count = 0;
+        tree.nodes[index].leaf  = false;
+        stack.push_back(left);
+        stack.push_back(left + 1);
+    }
+}
+
+
+// Recomputes every node's box from the same boxes, moved. Children come
+// after their parents, so one backwards pass does it.
+void
+BoundsTree_Refit(Bounds_Tree& tree, Bounds_Box const* boxes)
+{
+    for (size_t k = tree.nodes.size(); k-- > 0;)
+    {
+        auto&      node = tree.nodes[k];
+        Bounds_Box box;
+        if (node.leaf)
+        {
+            for (uint32 i = node.first; i < node.first + node.count; ++i)
+            {
+                Bounds_Union(box, boxes[tree.items[i]]);
+            }
+        }
+        else
+        {
+            Bounds_Union(box, tree.nodes[node.first].box);
+            Bounds_Union(box, tree.nodes[node.first + 1].box);
+        }
+        node.box = box;
+    }
+}
+
+
+// Appends the item of every leaf box that passes test, skipping whole
+// subtrees whose box fails it. test must pass any box that holds one that
+// passes.
+template <typename Test>
+void
+BoundsTree_Collect(Bounds_Tree const& tree, Bounds_Box const* boxes, Test const& test, std::vector<uint32>& out)
+{
+    if (tree.nodes.empty())
+    {
+        return;
+    }
+
+    uint32 stack[64];
+    int    top    = 0;
+    stack[top++]  = 0;
+    while (top > 0)
+    {
+        auto& node = tree.nodes[stack[--top]];
+        if (Bounds_IsEmpty(node.box) || !test(node.box))
+        {
+            continue;
+        }
+
+        if (node.leaf)
+        {
+            for (uint32 i = node.first; i < node.first + node.count; ++i)
+            {
+                auto item = tree.items[i];
+                if (!Bounds_IsEmpty(boxes[item]) && test(boxes[item]))
+                {
+                    out.push_back(item);
+                }
+            }
+        }
+        else
+        {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+    }
+}
+
+
+// Items whose box overlaps box, for collision against a world's bounds.
+void
+BoundsTree_Overlapping(Bounds_Tree const& tree, Bounds_Box const* boxes, Bounds_Box const& box, std::vector<uint32>& out)
+{
+    BoundsTree_Collect(tree, boxes, [&](Bounds_Box const& b) { return Bounds_Overlap(b, box); }, out);
+}
+
+
+// Items the camera may see any of.
+void
+BoundsTree_Visible(Bounds_Tree const& tree, Bounds_Box const* boxes, LOD_Camera const& camera, std::vector<uint32>& out)
+{
+    BoundsTree_Collect(tree, boxes, [&](Bounds_Box const& b) { return LOD_Visible(camera, Bounds_Center(b), Bounds_Radius(b)); }, out);
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <assert.h>
+#include <stddef.h>
+
+
+// A hard ceiling on particle memory, shared by any number of emitters.
+// Emitters carry a quota and a priority. As the budget fills, lower
+// priorities stop getting new particles first, so the effects that matter
+// keep spawning and the totals never pass the ceiling. Accounting is a pair
+// of counters, updated as particles are admitted and as they die.
+
+enum Budget_Priority : uint8
+{
+    Budget_Priority_Low,
+    Budget_Priority_Normal,
+    Budget_Priority_High,
+
+    Budget_Priority_Count,
+};
+
+// What an emitter does with spawns the budget turns away.
+enum Budget_Policy : uint8
+{
+    Budget_Policy_Throttle,      // Drop them; the emitter's rate falls.
+    Budget_Policy_RecycleOldest, // Respawn its own oldest particles instead.
+};
+
+constexpr uint32 Budget_Unlimited = ~0u;
+
+struct Particle_Budget
+{
+    uint32 max_particles { Budget_Unlimited };
+
+    // Fraction of max_particles each priority may fill.
+    float ceiling[Budget_Priority_Count] { 0.7f, 0.9f, 1.0f };
+
+    uint32 used { 0 };
+
+    // Spawns turned away and particles recycled, since Budget_ResetStats.
+    uint32 throttled { 0 };
+    uint32 recycled { 0 };
+};
+
+// Per emitter.
+struct Budget_Quota
+{
+    uint32          quota { Budget_Unlimited }; // Most live particles.
+    Budget_Priority priority { Budget_Priority_Normal };
+    Budget_Policy   policy { Budget_Policy_Throttle };
+};
+
+
+// A budget from a byte limit, for particles of the given size.
+Particle_Budget
+Budget_FromBytes(size_t max_bytes, size_t bytes_per_particle)
+{
+    Particle_Budget budget;
+    auto            n    = max_bytes / bytes_per_particle;
+    budget.max_particles = (n < Budget_Unlimited) ? static_cast<uint32>(n) : Budget_Unlimited - 1;
+    return budget;
+}
+
+
+size_t
+Budget_Bytes(Particle_Budget const& budget, size_t bytes_per_particle)
+{
+    return size_t(budget.used) * bytes_per_particle;
+}
+
+
+// How many of n wanted particles an emitter with live particles may
+// allocate, and accounts for them. budget may be null, leaving only the
+// emitter's quota.
+uint32
+Budget_Admit(Particle_Budget* budget, Budget_Quota const& quota, uint32 live, uint32 n)
+{
+    uint32 room = (live < quota.quota) ? quota.quota - live : 0;
+    if (budget && budget->max_particles != Budget_Unlimited)
+    {
+        auto ceiling = static_cast<uint32>(budget->ceiling[quota.priority] * budget->max_particles);
+        ceiling      = (ceiling < budget->max_particles) ? ceiling : budget->max_particles;
+
+        uint32 free = (budget->used < ceiling) ? ceiling - budget->used : 0;
+        room        = (free < room) ? free : room;
+    }
+
+    uint32 admitted = (n < room) ? n : room;
+    if (budget)
+    {
+        budget->used += admitted;
+        budget->throttled += n - admitted;
+    }
+    return admitted;
+}
+
+
+// Returns n particles that went through Budget_Admit. Releasing more than
+// was admitted means a spawn path skipped the budget.
+void
+Budget_Release(Particle_Budget* budget, uint32 n)
+{
+    if (budget)
+    {
+        assert(n <= budget->used);
+        budget->used -= (n < budget->used) ? n : budget->used;
+    }
+}
+
+
+void
+Budget_ResetStats(Particle_Budget& budget)
+{
+    budget.throttled = 0;
+    budget.recycled  = 0;
+}
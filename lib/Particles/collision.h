@@ -0,0 +1,701 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/bounds.h"
+#include "Particles/events.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Particles against the ground and a few solid obstacles, run after
+// integration. The ground is a heightfield with a max-height mip chain, so a
+// batch of particles that is above the highest point under it is rejected
+// with one lookup; most particles in most effects are in the air. Obstacles
+// are capsules and upright cylinders (cones when the top radius is zero),
+// each tested against a whole batch of positions four at a time, after a
+// bounds test against the batch. Each particle keeps only its deepest
+// contact.
+
+// Max height over blocks of 2^level cells.
+struct Height_Mip
+{
+    int                cols { 0 };
+    int                rows { 0 };
+    std::vector<float> max;
+};
+
+struct Height_Field
+{
+    Vec   origin { 0.0f, 0.0f, 0.0f }; // Vertex (0, 0). Columns run along x, rows along z.
+    float cell { 1.0f };
+    int   cols { 0 };
+    int   rows { 0 };
+
+    // (cols + 1) * (rows + 1) vertex heights, row major, relative to
+    // origin.y. Call HeightField_BuildMips after changing them.
+    std::vector<float> heights;
+
+    std::vector<Height_Mip> mips; // mips[0] is per cell.
+};
+
+
+enum Collision_Response : uint32
+{
+    Collision_Bounce, // Reflect, scaled by restitution, and slow by friction.
+    Collision_Kill,   // Dies on contact, see below.
+};
+
+// A killed particle is a death like any other. Particle_Event_Death is raised
+// at the contact, in the same call as its Particle_Event_Collision, and not
+// again when the particle is removed. Emitter_Collide and
+// ParticleSystem_Collide behave the same.
+
+struct Collision_Material
+{
+    Collision_Response response { Collision_Bounce };
+    float              restitution { 0.4f }; // Normal speed kept.
+    float              friction { 0.2f };    // Tangential speed lost a contact.
+};
+
+struct Collision_Capsule
+{
+    Vec   a;
+    Vec   b;
+    float radius;
+};
+
+// Upright, standing on base.
+struct Collision_Cylinder
+{
+    Vec   base;
+    float radius_bottom;
+    float radius_top;
+    float height;
+};
+
+struct Collision_World
+{
+    Height_Field const*             ground { nullptr };
+    std::vector<Collision_Capsule>  capsules;
+    std::vector<Collision_Cylinder> cylinders;
+};
+
+
+constexpr size_t Collision_Batch = 64;
+
+// Deepest contact for each particle of a batch. depth is how far to move the
+// particle along n to clear the surface; zero for no contact.
+struct Collision_Contacts
+{
+    float depth[Collision_Batch];
+    float nx[Collision_Batch];
+    float ny[Collision_Batch];
+    float nz[Collision_Batch];
+};
+
+
+// A flat field of cols by rows cells at origin.y.
+void
+HeightField_Init(Height_Field& field, Vec origin, float cell, int cols, int rows)
+{
+    field.origin = origin;
+    field.cell   = cell;
+    field.cols   = cols;
+    field.rows   = rows;
+    field.heights.assign(size_t(cols + 1) * (rows + 1), 0.0f);
+}
+
+
+float&
+HeightField_At(Height_Field& field, int col, int row)
+{
+    return field.heights[size_t(row) * (field.cols + 1) + col];
+}
+
+
+void
+HeightField_BuildMips(Height_Field& field)
+{
+    field.mips.clear();
+
+    Height_Mip base;
+    base.cols = field.cols;
+    base.rows = field.rows;
+    base.max.resize(size_t(base.cols) * base.rows);
+    for (int r = 0; r < base.rows; ++r)
+    {
+        for (int c = 0; c < base.cols; ++c)
+        {
+            auto* h0 = &field.heights[size_t(r) * (field.cols + 1) + c];
+            auto* h1 = h0 + field.cols + 1;
+            float m  = (h0[0] > h0[1]) ? h0[0] : h0[1];
+            m        = (h1[0] > m) ? h1[0] : m;
+            m        = (h1[1] > m) ? h1[1] : m;
+
+            base.max[size_t(r) * base.cols + c] = m;
+        }
+    }
+    field.mips.push_back(std::move(base));
+
+    while (field.mips.back().cols > 1 || field.mips.back().rows > 1)
+    {
+        auto&      prev = field.mips.back();
+        Height_Mip next;
+        next.cols = (prev.cols + 1) / 2;
+        next.rows = (prev.rows + 1) / 2;
+        next.max.resize(size_t(next.cols) * next.rows);
+        for (int r = 0; r < next.rows; ++r)
+        {
+            for (int c = 0; c < next.cols; ++c)
+            {
+                // Odd edges repeat the last texel.
+                int   c1 = (2 * c + 1 < prev.cols) ? 2 * c + 1 : 2 * c;
+                int   r1 = (2 * r + 1 < prev.rows) ? 2 * r + 1 : 2 * r;
+                float a  = prev.max[size_t(2 * r) * prev.cols + 2 * c];
+                float b  = prev.max[size_t(2 * r) * prev.cols + c1];
+                float d  = prev.max[size_t(r1) * prev.cols + 2 * c];
+                float e  = prev.max[size_t(r1) * prev.cols + c1];
+                float m  = (a > b) ? a : b;
+                m        = (d > m) ? d : m;
+                m        = (e > m) ? e : m;
+
+                next.max[size_t(r) * next.cols + c] = m;
+            }
+        }
+        field.mips.push_back(std::move(next));
+    }
+}
+
+
+// Highest ground anywhere under the rectangle [x0, x1] by [z0, z1], in world
+// space. Never lower than the truth, and -HUGE_VALF off the field. Reads at
+// most two by two texels, from the finest level where the rectangle spans
+// no more than two.
+float
+HeightField_MaxOver(Height_Field const& field, float x0, float z0, float x1, float z1)
+{
+    if (field.mips.empty())
+    {
+        return -HUGE_VALF;
+    }
+
+    float inv = 1.0f / field.cell;
+    int   c0  = static_cast<int>(floorf((x0 - field.origin.x) * inv));
+    int   c1  = static_cast<int>(floorf((x1 - field.origin.x) * inv));
+    int   r0  = static_cast<int>(floorf((z0 - field.origin.z) * inv));
+    int   r1  = static_cast<int>(floorf((z1 - field.origin.z) * inv));
+    if (c1 < 0 || r1 < 0 || c0 >= field.cols || r0 >= field.rows)
+    {
+        return -HUGE_VALF;
+    }
+    c0 = (c0 < 0) ? 0 : c0;
+    r0 = (r0 < 0) ? 0 : r0;
+    c1 = (c1 >= field.cols) ? field.cols - 1 : c1;
+    r1 = (r1 >= field.rows) ? field.rows - 1 : r1;
+
+    size_t level = 0;
+    while (level + 1 < field.mips.size() && ((c1 >> level) - (c0 >> level) > 1 || (r1 >> level) - (r0 >> level) > 1))
+    {
+        level += 1;
+    }
+
+    auto& mip = field.mips[level];
+    float m   = -HUGE_VALF;
+    for (int r = r0 >> level; r <= r1 >> level; ++r)
+    {
+        for (int c = c0 >> level; c <= c1 >> level; ++c)
+        {
+            float h = mip.max[size_t(r) * mip.cols + c];
+            m       = (h > m) ? h : m;
+        }
+    }
+    return field.origin.y + m;
+}
+
+
+// Ground height and upward normal at x, z, bilinear between vertices.
+// Returns false off the field.
+bool
+HeightField_Sample(Height_Field const& field, float x, float z, float& height, Vec& normal)
+{
+    float inv = 1.0f / field.cell;
+    float fx  = (x - field.origin.x) * inv;
+    float fz  = (z - field.origin.z) * inv;
+    if (!(fx >= 0.0f && fz >= 0.0f && fx < float(field.cols) && fz < float(field.rows)))
+    {
+        return false;
+    }
+
+    int   c  = static_cast<int>(fx);
+    int   r  = static_cast<int>(fz);
+    float tx = fx - c;
+    float tz = fz - r;
+
+    auto* h0 = &field.heights[size_t(r) * (field.cols + 1) + c];
+    auto* h1 = h0 + field.cols + 1;
+
+    float top    = h0[0] + (h0[1] - h0[0]) * tx;
+    float bottom = h1[0] + (h1[1] - h1[0]) * tx;
+    height       = field.origin.y + top + (bottom - top) * tz;
+
+    // Slopes along x and z, then n = (-dh/dx, 1, -dh/dz) normalised.
+    float dx  = ((h0[1] - h0[0]) * (1.0f - tz) + (h1[1] - h1[0]) * tz) * inv;
+    float dz  = ((h1[0] - h0[0]) * (1.0f - tx) + (h1[1] - h0[1]) * tx) * inv;
+    float len = 1.0f / sqrtf(dx * dx + 1.0f + dz * dz);
+    normal    = Vec { -dx * len, len, -dz * len };
+    return true;
+}
+
+
+#if defined(__SSE2__)
+__m128
+Collision_Select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+
+// Keeps the capsule contact for points where it is deeper.
+void
+Collision_CapsuleContacts(Collision_Capsule const& capsule,
+                          float const*             x,
+                          float const*             y,
+                          float const*             z,
+                          size_t                   n,
+                          Collision_Contacts&      contacts)
+{
+    auto& a   = capsule.a;
+    float r   = capsule.radius;
+    float abx = capsule.b.x - a.x, aby = capsule.b.y - a.y, abz = capsule.b.z - a.z;
+    float ab2 = abx * abx + aby * aby + abz * abz;
+    float inv = (ab2 > 0.0f) ? 1.0f / ab2 : 0.0f;
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    auto ax   = _mm_set1_ps(a.x);
+    auto ay   = _mm_set1_ps(a.y);
+    auto az   = _mm_set1_ps(a.z);
+    auto dirx = _mm_set1_ps(abx);
+    auto diry = _mm_set1_ps(aby);
+    auto dirz = _mm_set1_ps(abz);
+    auto inv4 = _mm_set1_ps(inv);
+    auto r4   = _mm_set1_ps(r);
+    auto zero = _mm_setzero_ps();
+    auto one  = _mm_set1_ps(1.0f);
+    auto eps  = _mm_set1_ps(1e-6f);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        auto px = _mm_sub_ps(_mm_loadu_ps(x + i), ax);
+        auto py = _mm_sub_ps(_mm_loadu_ps(y + i), ay);
+        auto pz = _mm_sub_ps(_mm_loadu_ps(z + i), az);
+
+        auto t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, dirx), _mm_mul_ps(py, diry)), _mm_mul_ps(pz, dirz));
+        t      = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, inv4), zero), one);
+
+        auto dx = _mm_sub_ps(px, _mm_mul_ps(dirx, t));
+        auto dy = _mm_sub_ps(py, _mm_mul_ps(diry, t));
+        auto dz = _mm_sub_ps(pz, _mm_mul_ps(dirz, t));
+        auto d  = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        auto s  = _mm_div_ps(one, _mm_max_ps(d, eps));
+        auto p  = _mm_sub_ps(r4, d);
+
+        auto old    = _mm_loadu_ps(contacts.depth + i);
+        auto deeper = _mm_and_ps(_mm_cmpgt_ps(p, old), _mm_cmpgt_ps(d, eps));
+        _mm_storeu_ps(contacts.depth + i, Collision_Select(deeper, p, old));
+        _mm_storeu_ps(contacts.nx + i, Collision_Select(deeper, _mm_mul_ps(dx, s), _mm_loadu_ps(contacts.nx + i)));
+        _mm_storeu_ps(contacts.ny + i, Collision_Select(deeper, _mm_mul_ps(dy, s), _mm_loadu_ps(contacts.ny + i)));
+        _mm_storeu_ps(contacts.nz + i, Collision_Select(deeper, _mm_mul_ps(dz, s), _mm_loadu_ps(contacts.nz + i)));
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        float px = x[i] - a.x;
+        float py = y[i] - a.y;
+        float pz = z[i] - a.z;
+        float t  = (px * abx + py * aby + pz * abz) * inv;
+        t        = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+
+        float dx = px - abx * t;
+        float dy = py - aby * t;
+        float dz = pz - abz * t;
+        float d  = sqrtf(dx * dx + dy * dy + dz * dz);
+        float s  = 1.0f / ((d > 1e-6f) ? d : 1e-6f);
+        float p  = r - d;
+        if (p > contacts.depth[i] && d > 1e-6f)
+        {
+            contacts.depth[i] = p;
+            contacts.nx[i]    = dx * s;
+            contacts.ny[i]    = dy * s;
+            contacts.nz[i]    = dz * s;
+        }
+    }
+}
+
+
+// Keeps the cylinder contact for points where it is deeper. The side is the
+// line from (radius_bottom, 0) to (radius_top, height) in (distance from the
+// axis, height) space, with outward normal (1, slope) normalised; a cone has
+// no top to push out through. A cylinder without height has no side either,
+// and is skipped.
+void
+Collision_CylinderContacts(Collision_Cylinder const& cylinder,
+                           float const*              x,
+                           float const*              y,
+                           float const*              z,
+                           size_t                    n,
+                           Collision_Contacts&       contacts)
+{
+    if (!(cylinder.height > 0.0f))
+    {
+        return;
+    }
+
+    auto& base   = cylinder.base;
+    float inv_h  = 1.0f / cylinder.height;
+    float taper  = cylinder.radius_top - cylinder.radius_bottom;
+    float slope  = -taper * inv_h;
+    float inv_n  = 1.0f / sqrtf(1.0f + slope * slope);
+    float top_y  = base.y + cylinder.height;
+    bool  capped = cylinder.radius_top > 0.0f;
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    auto bx     = _mm_set1_ps(base.x);
+    auto by     = _mm_set1_ps(base.y);
+    auto bz     = _mm_set1_ps(base.z);
+    auto inv_h4 = _mm_set1_ps(inv_h);
+    auto rb     = _mm_set1_ps(cylinder.radius_bottom);
+    auto taper4 = _mm_set1_ps(taper);
+    auto inv_n4 = _mm_set1_ps(inv_n);
+    auto side_y = _mm_set1_ps(slope * inv_n);
+    auto top4   = _mm_set1_ps(top_y);
+    auto cap4   = _mm_castsi128_ps(_mm_set1_epi32(capped ? -1 : 0));
+    auto zero   = _mm_setzero_ps();
+    auto one    = _mm_set1_ps(1.0f);
+    auto eps    = _mm_set1_ps(1e-6f);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        auto py = _mm_loadu_ps(y + i);
+        auto dx = _mm_sub_ps(_mm_loadu_ps(x + i), bx);
+        auto dz = _mm_sub_ps(_mm_loadu_ps(z + i), bz);
+        auto h  = _mm_mul_ps(_mm_sub_ps(py, by), inv_h4);
+        auto d  = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)));
+        auto s  = _mm_mul_ps(_mm_div_ps(one, _mm_max_ps(d, eps)), inv_n4);
+
+        auto side    = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(rb, _mm_mul_ps(taper4, h)), d), inv_n4);
+        auto top     = _mm_sub_ps(top4, py);
+        auto use_top = _mm_and_ps(cap4, _mm_cmplt_ps(top, side));
+        auto p       = Collision_Select(use_top, top, side);
+
+        auto old    = _mm_loadu_ps(contacts.depth + i);
+        auto inside = _mm_and_ps(_mm_cmpge_ps(h, zero), _mm_cmple_ps(h, one));
+        auto deeper = _mm_and_ps(_mm_and_ps(inside, _mm_cmpgt_ps(p, old)), _mm_cmpgt_ps(d, eps));
+
+        auto nx = Collision_Select(use_top, zero, _mm_mul_ps(dx, s));
+        auto ny = Collision_Select(use_top, one, side_y);
+        auto nz = Collision_Select(use_top, zero, _mm_mul_ps(dz, s));
+        _mm_storeu_ps(contacts.depth + i, Collision_Select(deeper, p, old));
+        _mm_storeu_ps(contacts.nx + i, Collision_Select(deeper, nx, _mm_loadu_ps(contacts.nx + i)));
+        _mm_storeu_ps(contacts.ny + i, Collision_Select(deeper, ny, _mm_loadu_ps(contacts.ny + i)));
+        _mm_storeu_ps(contacts.nz + i, Collision_Select(deeper, nz, _mm_loadu_ps(contacts.nz + i)));
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        float dx = x[i] - base.x;
+        float dz = z[i] - base.z;
+        float h  = (y[i] - base.y) * inv_h;
+        float d  = sqrtf(dx * dx + dz * dz);
+        float s  = inv_n / ((d > 1e-6f) ? d : 1e-6f);
+
+        float side    = (cylinder.radius_bottom + taper * h - d) * inv_n;
+        float top     = top_y - y[i];
+        bool  use_top = capped && top < side;
+        float p       = use_top ? top : side;
+        if (h >= 0.0f && h <= 1.0f && p > contacts.depth[i] && d > 1e-6f)
+        {
+            contacts.depth[i] = p;
+            contacts.nx[i]    = use_top ? 0.0f : dx * s;
+            contacts.ny[i]    = use_top ? 1.0f : slope * inv_n;
+            contacts.nz[i]    = use_top ? 0.0f : dz * s;
+        }
+    }
+}
+
+
+Bounds_Box
+Collision_CapsuleBounds(Collision_Capsule const& capsule)
+{
+    Bounds_Box box;
+    Bounds_Add(box, capsule.a);
+    Bounds_Add(box, capsule.b);
+    return Bounds_Inflate(box, capsule.radius);
+}
+
+
+// Empty for a cylinder without height, so nothing touches it.
+Bounds_Box
+Collision_CylinderBounds(Collision_Cylinder const& cylinder)
+{
+    if (!(cylinder.height > 0.0f))
+    {
+        return {};
+    }
+
+    auto& base = cylinder.base;
+    float r    = (cylinder.radius_bottom > cylinder.radius_top) ? cylinder.radius_bottom : cylinder.radius_top;
+    return { Vec { base.x - r, base.y, base.z - r }, Vec { base.x + r, base.y + cylinder.height, base.z + r } };
+}
+
+
+// Whether anything in box could touch the world: below the highest ground
+// under it, or overlapping an obstacle.
+bool
+Collision_Touches(Collision_World const& world, Bounds_Box const& box)
+{
+    if (world.ground && box.min.y < HeightField_MaxOver(*world.ground, box.min.x, box.min.z, box.max.x, box.max.z))
+    {
+        return true;
+    }
+    for (auto& capsule : world.capsules)
+    {
+        if (Bounds_Overlap(box, Collision_CapsuleBounds(capsule)))
+        {
+            return true;
+        }
+    }
+    for (auto& cylinder : world.cylinders)
+    {
+        if (Bounds_Overlap(box, Collision_CylinderBounds(cylinder)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Fills contacts for n positions, at most Collision_Batch.
+void
+Collision_FindContacts(Collision_World const& world,
+                       float const*           x,
+                       float const*           y,
+                       float const*           z,
+                       size_t                 n,
+                       Collision_Contacts&    contacts)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        contacts.depth[i] = 0.0f;
+        contacts.nx[i]    = 0.0f;
+        contacts.ny[i]    = 1.0f;
+        contacts.nz[i]    = 0.0f;
+    }
+
+    Bounds_Box box;
+    Bounds_Reduce(box, x, y, z, n);
+
+    if (world.ground && box.min.y < HeightField_MaxOver(*world.ground, box.min.x, box.min.z, box.max.x, box.max.z))
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            float height;
+            Vec   normal;
+            if (HeightField_Sample(*world.ground, x[i], z[i], height, normal) && y[i] < height)
+            {
+                // Straight up to the surface is (height - y) along y, which
+                // is (height - y) * ny along the normal.
+                contacts.depth[i] = (height - y[i]) * normal.y;
+                contacts.nx[i]    = normal.x;
+                contacts.ny[i]    = normal.y;
+                contacts.nz[i]    = normal.z;
+            }
+        }
+    }
+
+    for (auto& capsule : world.capsules)
+    {
+        if (Bounds_Overlap(box, Collision_CapsuleBounds(capsule)))
+        {
+            Collision_CapsuleContacts(capsule, x, y, z, n, contacts);
+        }
+    }
+
+    for (auto& cylinder : world.cylinders)
+    {
+        if (Bounds_Overlap(box, Collision_CylinderBounds(cylinder)))
+        {
+            Collision_CylinderContacts(cylinder, x, y, z, n, contacts);
+        }
+    }
+}
+
+
+// Moves a particle out along n and applies the material. Returns whether
+// the particle was killed.
+template <typename Particle_Type>
+bool
+Collision_Respond(Particle_Type& particle, Vec n, float depth, Collision_Material const& material)
+{
+    constexpr uint32 Features = Particle_Type::features;
+
+    particle.pos += n * depth;
+    if (material.response == Collision_Kill)
+    {
+        particle.lifetime_sec = -1.0f;
+        return true;
+    }
+
+    auto& v  = particle.vel;
+    float vn = v.x * n.x + v.y * n.y + v.z * n.z;
+    if (vn < 0.0f)
+    {
+        float keep = 1.0f - material.friction;
+        keep       = (keep < 0.0f) ? 0.0f : keep;
+        float bn   = -material.restitution * vn;
+
+        // Tangential part slowed, normal part reversed.
+        v = Vec { (v.x - n.x * vn) * keep + n.x * bn,
+                  (v.y - n.y * vn) * keep + n.y * bn,
+                  (v.z - n.z * vn) * keep + n.z * bn };
+    }
+
+    // The surface holds back whatever acceleration pushes into it, or a
+    // resting particle would keep gaining speed into the ground.
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        auto& acc = particle.acc;
+        float an  = acc.x * n.x + acc.y * n.y + acc.z * n.z;
+        if (an < 0.0f)
+        {
+            acc = Vec { acc.x - n.x * an, acc.y - n.y * an, acc.z - n.z * an };
+        }
+    }
+    return false;
+}
+
+
+// Collides every live particle of an emitter. Each contact raises
+// Particle_Event_Collision when the emitter has an event buffer, and killed
+// particles are compacted away before returning, see Collision_Kill. An
+// emitter whose bounds can't touch the world is skipped without reading its
+// particles; one with no bounds yet is always checked.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Collide(Emitter_Of<Features, Capacity>& emitter,
+                Collision_World const&          world,
+                Collision_Material const&       material)
+{
+    float              x[Collision_Batch], y[Collision_Batch], z[Collision_Batch];
+    Collision_Contacts contacts;
+
+    auto& box = emitter.bounds.box;
+    if (!Bounds_IsEmpty(box) && !Collision_Touches(world, box))
+    {
+        return;
+    }
+
+    bool  killed    = false;
+    auto& particles = emitter.particles;
+    for (size_t begin = 0; begin < particles.size(); begin += Collision_Batch)
+    {
+        size_t count = (particles.size() - begin < Collision_Batch) ? particles.size() - begin : Collision_Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& pos = particles[begin + i].pos;
+            x[i]      = pos.x;
+            y[i]      = pos.y;
+            z[i]      = pos.z;
+        }
+
+        Collision_FindContacts(world, x, y, z, count, contacts);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& particle = particles[begin + i];
+            if (contacts.depth[i] <= 0.0f || particle.lifetime_sec < 0)
+            {
+                continue;
+            }
+
+            Vec n = { contacts.nx[i], contacts.ny[i], contacts.nz[i] };
+            killed |= Collision_Respond(particle, n, contacts.depth[i], material);
+            Emitter_GrowBounds(emitter, particle);
+            if (emitter.events)
+            {
+                Event_Emit(*emitter.events, Particle_Event_Collision, emitter.event_id, particle.pos, particle.vel);
+            }
+        }
+    }
+
+    // Compaction raises the death events.
+    if (killed)
+    {
+        Emitter_Compact(emitter);
+    }
+}
+
+
+// As Emitter_Collide, over the pooled particles, after
+// ParticleSystem_Integrate. Collision and death events go on the end of this
+// tick's merged events, so sub-emitters see them along with the rest. Killed
+// particles are already dead, so the next tick compacts them away without
+// reporting them again.
+template <uint32 Features>
+void
+ParticleSystem_Collide(ParticleSystem_Of<Features>& system,
+                       Collision_World const&       world,
+                       Collision_Material const&    material)
+{
+    float              x[Collision_Batch], y[Collision_Batch], z[Collision_Batch];
+    Collision_Contacts contacts;
+
+    auto& particles = system.particles;
+    for (size_t begin = 0; begin < particles.size(); begin += Collision_Batch)
+    {
+        size_t count = (particles.size() - begin < Collision_Batch) ? particles.size() - begin : Collision_Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& pos = particles[begin + i].pos;
+            x[i]      = pos.x;
+            y[i]      = pos.y;
+            z[i]      = pos.z;
+        }
+
+        Collision_FindContacts(world, x, y, z, count, contacts);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& particle = particles[begin + i];
+            if (contacts.depth[i] <= 0.0f || particle.lifetime_sec < 0)
+            {
+                continue;
+            }
+
+            Vec  n      = { contacts.nx[i], contacts.ny[i], contacts.nz[i] };
+            bool killed = Collision_Respond(particle, n, contacts.depth[i], material);
+            if (system.events)
+            {
+                auto owner = system.owners[begin + i];
+                system.events->merged.push_back({ particle.pos, particle.vel, owner, Particle_Event_Collision });
+                if (killed)
+                {
+                    system.events->merged.push_back({ particle.pos, particle.vel, owner, Particle_Event_Death });
+                }
+            }
+        }
+    }
+}
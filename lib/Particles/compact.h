@@ -0,0 +1,547 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/particle.h"
+#include "Particles/random.h"
+#include "Particles/spawn_shapes.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+
+// Compact storage for effects with a bounded extent. Positions are 16 bit
+// fixed point relative to the emitter's origin, the remaining lifetime is a
+// 16 bit fraction of the duration, and everything else is half precision.
+// A default particle drops from 148 bytes to 36. Integration unpacks a batch
+// to float, runs the same maths as Particle_Integrate, and packs it back, so
+// the pass moves a quarter of the bytes.
+//
+// Positions are rounded to extent / 32767 every tick, and the error builds
+// up, so keep the extent as tight as the effect allows. Only plain effects:
+// no curves, trails or events, and rot_mat is left for the renderer to build
+// from theta.
+
+// Float to half, round to nearest even. Matches F16C, so both paths give the
+// same bits.
+uint16
+Half_FromFloat(float value)
+{
+    uint32 x;
+    memcpy(&x, &value, sizeof(x));
+
+    uint32 const f32_infinity = 255u << 23;
+    uint32 const f16_max      = (127u + 16u) << 23;
+    uint32 const denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32 sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32 h;
+    if (x >= f16_max)
+    {
+        h = (x > f32_infinity) ? 0x7e00u : 0x7c00u; // NaN stays NaN, the rest saturate to infinity.
+    }
+    else if (x < (113u << 23))
+    {
+        // Subnormal or zero. Adding the magic number lets the FPU do the
+        // rounding.
+        float f, magic;
+        memcpy(&f, &x, sizeof(f));
+        memcpy(&magic, &denorm_magic, sizeof(magic));
+        f += magic;
+        memcpy(&h, &f, sizeof(h));
+        h -= denorm_magic;
+    }
+    else
+    {
+        uint32 odd = (x >> 13) & 1u;
+        x += ((15u - 127u) << 23) + 0xfffu;
+        x += odd;
+        h = x >> 13;
+    }
+    return static_cast<uint16>(h | (sign >> 16));
+}
+
+
+float
+Half_ToFloat(uint16 half)
+{
+    uint32 const shifted_exp = 0x7c00u << 13;
+    uint32 const magic_bits  = 113u << 23;
+
+    uint32 x   = (half & 0x7fffu) << 13;
+    uint32 exp = x & shifted_exp;
+    x += (127u - 15u) << 23;
+
+    float value;
+    if (exp == shifted_exp)
+    {
+        x += (128u - 16u) << 23; // Infinity or NaN.
+        memcpy(&value, &x, sizeof(value));
+    }
+    else if (exp == 0)
+    {
+        // Subnormal. Renormalise.
+        float magic;
+        x += 1u << 23;
+        memcpy(&value, &x, sizeof(value));
+        memcpy(&magic, &magic_bits, sizeof(magic));
+        value -= magic;
+    }
+    else
+    {
+        memcpy(&value, &x, sizeof(value));
+    }
+
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits |= uint32(half & 0x8000u) << 16;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+void
+Half_Unpack(uint16 const* in, float* out, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+    {
+        auto h = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        out[i] = Half_ToFloat(in[i]);
+    }
+}
+
+
+void
+Half_Pack(float const* in, uint16* out, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+    {
+        auto h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), h);
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        out[i] = Half_FromFloat(in[i]);
+    }
+}
+
+
+// Three half precision arrays.
+struct Compact_Vec
+{
+    std::vector<uint16> x;
+    std::vector<uint16> y;
+    std::vector<uint16> z;
+};
+
+
+template <uint32 Features, size_t Capacity = 1024>
+struct Compact_Emitter_Of
+{
+    static constexpr uint32 features = Features;
+
+    uint32 count { 0 };
+
+    // Fixed point, origin + q * extent / 32767. Particles that leave the
+    // extent die.
+    std::vector<int16> px;
+    std::vector<int16> py;
+    std::vector<int16> pz;
+    Vec                origin { 0.0f, 0.0f, 0.0f };
+    float              extent { 32.0f };
+
+    Compact_Vec         vel;
+    std::vector<uint16> life;     // Remaining lifetime, 65535 is the whole duration.
+    std::vector<uint16> duration; // Half.
+
+    // Per feature, empty when the feature is off.
+    Compact_Vec         acc;
+    Compact_Vec         theta;
+    Compact_Vec         omega;
+    std::vector<uint16> size;
+
+    float  rate { 0.5f };
+    float  timer { 0.5f };
+    bool   paused { false };
+    Random rng;
+
+    Emitter_Params params;
+};
+
+using Compact_Emitter = Compact_Emitter_Of<Particle_Features_Default>;
+
+
+void
+CompactVec_Resize(Compact_Vec& v, size_t n)
+{
+    v.x.resize(n);
+    v.y.resize(n);
+    v.z.resize(n);
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+CompactEmitter_Init(Compact_Emitter_Of<Features, Capacity>& emitter, Vec origin, float extent)
+{
+    emitter.count  = 0;
+    emitter.origin = origin;
+    emitter.extent = extent;
+
+    emitter.px.resize(Capacity);
+    emitter.py.resize(Capacity);
+    emitter.pz.resize(Capacity);
+    CompactVec_Resize(emitter.vel, Capacity);
+    emitter.life.resize(Capacity);
+    emitter.duration.resize(Capacity);
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        CompactVec_Resize(emitter.acc, Capacity);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        CompactVec_Resize(emitter.theta, Capacity);
+        CompactVec_Resize(emitter.omega, Capacity);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        emitter.size.resize(Capacity);
+    }
+}
+
+
+int16
+Compact_Quantise(float value, float inv_scale)
+{
+    float q = roundf(value * inv_scale);
+    q       = (q < -32767.0f) ? -32767.0f : q;
+    q       = (q > 32767.0f) ? 32767.0f : q;
+    return static_cast<int16>(q);
+}
+
+
+// Unit angles only need [-pi, pi) and fp16 is most precise near zero.
+float
+Compact_WrapAngle(float a)
+{
+    return a - 2.0f * float(M_PI) * floorf((a + float(M_PI)) / (2.0f * float(M_PI)));
+}
+
+
+// Writes a full particle into slot i.
+template <uint32 Features, size_t Capacity>
+void
+CompactEmitter_Store(Compact_Emitter_Of<Features, Capacity>& emitter, size_t i, Particle_Of<Features> const& particle)
+{
+    float inv_scale = 32767.0f / emitter.extent;
+
+    emitter.px[i]       = Compact_Quantise(particle.pos.x - emitter.origin.x, inv_scale);
+    emitter.py[i]       = Compact_Quantise(particle.pos.y - emitter.origin.y, inv_scale);
+    emitter.pz[i]       = Compact_Quantise(particle.pos.z - emitter.origin.z, inv_scale);
+    emitter.vel.x[i]    = Half_FromFloat(particle.vel.x);
+    emitter.vel.y[i]    = Half_FromFloat(particle.vel.y);
+    emitter.vel.z[i]    = Half_FromFloat(particle.vel.z);
+    emitter.duration[i] = Half_FromFloat(particle.duration_sec);
+
+    float life      = (particle.duration_sec > 0.0f) ? particle.lifetime_sec / particle.duration_sec : 0.0f;
+    life            = (life < 0.0f) ? 0.0f : (life > 1.0f) ? 1.0f : life;
+    emitter.life[i] = static_cast<uint16>(life * 65535.0f + 0.5f);
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        emitter.acc.x[i] = Half_FromFloat(particle.acc.x);
+        emitter.acc.y[i] = Half_FromFloat(particle.acc.y);
+        emitter.acc.z[i] = Half_FromFloat(particle.acc.z);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        emitter.theta.x[i] = Half_FromFloat(Compact_WrapAngle(particle.theta.x));
+        emitter.theta.y[i] = Half_FromFloat(Compact_WrapAngle(particle.theta.y));
+        emitter.theta.z[i] = Half_FromFloat(Compact_WrapAngle(particle.theta.z));
+        emitter.omega.x[i] = Half_FromFloat(particle.omega.x);
+        emitter.omega.y[i] = Half_FromFloat(particle.omega.y);
+        emitter.omega.z[i] = Half_FromFloat(particle.omega.z);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        emitter.size[i] = Half_FromFloat(particle.size);
+    }
+}
+
+
+// Expands slot i back to a full particle, rot_mat included, for rendering
+// and tools.
+template <uint32 Features, size_t Capacity>
+Particle_Of<Features>
+CompactEmitter_Load(Compact_Emitter_Of<Features, Capacity> const& emitter, size_t i)
+{
+    float scale = emitter.extent / 32767.0f;
+
+    Particle_Of<Features> particle;
+    Particle_Init(particle);
+    particle.pos = Vec { emitter.px[i] * scale, emitter.py[i] * scale, emitter.pz[i] * scale };
+    particle.pos += emitter.origin;
+    particle.vel          = Vec { Half_ToFloat(emitter.vel.x[i]), Half_ToFloat(emitter.vel.y[i]), Half_ToFloat(emitter.vel.z[i]) };
+    particle.duration_sec = Half_ToFloat(emitter.duration[i]);
+    particle.lifetime_sec = emitter.life[i] * (particle.duration_sec / 65535.0f);
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        particle.acc = Vec { Half_ToFloat(emitter.acc.x[i]), Half_ToFloat(emitter.acc.y[i]), Half_ToFloat(emitter.acc.z[i]) };
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        particle.theta = Vec { Half_ToFloat(emitter.theta.x[i]), Half_ToFloat(emitter.theta.y[i]), Half_ToFloat(emitter.theta.z[i]) };
+        particle.omega = Vec { Half_ToFloat(emitter.omega.x[i]), Half_ToFloat(emitter.omega.y[i]), Half_ToFloat(emitter.omega.z[i]) };
+
+        auto R           = RotorFromEuler(particle.theta.y, particle.theta.z, particle.theta.x);
+        particle.rot_mat = ToMatrix4(R);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        particle.size = Half_ToFloat(emitter.size[i]);
+    }
+    return particle;
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+CompactEmitter_Spawn(Compact_Emitter_Of<Features, Capacity>& emitter, int n)
+{
+    constexpr int Batch = 64;
+
+    Vec pos[Batch];
+    Vec dir[Batch];
+    while (n > 0 && emitter.count < Capacity)
+    {
+        int count = (n < Batch) ? n : Batch;
+        Spawn_Sample(emitter.params.spawn, emitter.rng, count, pos, dir);
+        for (int i = 0; i < count && emitter.count < Capacity; ++i)
+        {
+            Particle_Of<Features> particle;
+            Particle_SpawnAt(particle, emitter.rng, emitter.params, pos[i], dir[i]);
+            particle.pos += emitter.origin;
+            CompactEmitter_Store(emitter, emitter.count++, particle);
+        }
+        n -= count;
+    }
+}
+
+
+// Unpacks a half array batch, or packs it back.
+void
+CompactVec_Unpack(Compact_Vec const& v, size_t begin, size_t n, float* x, float* y, float* z)
+{
+    Half_Unpack(v.x.data() + begin, x, n);
+    Half_Unpack(v.y.data() + begin, y, n);
+    Half_Unpack(v.z.data() + begin, z, n);
+}
+
+
+void
+CompactVec_Pack(Compact_Vec& v, size_t begin, size_t n, float const* x, float const* y, float const* z)
+{
+    Half_Pack(x, v.x.data() + begin, n);
+    Half_Pack(y, v.y.data() + begin, n);
+    Half_Pack(z, v.z.data() + begin, n);
+}
+
+
+// The Particle_Integrate step on a whole emitter, 64 particles at a time.
+// Survivors are packed back down in order, so the pass also compacts.
+template <uint32 Features, size_t Capacity>
+void
+CompactEmitter_Integrate(Compact_Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    constexpr size_t Batch = 64;
+    constexpr bool   Acc   = Particle_Has(Features, Particle_Feature_Acceleration);
+    constexpr bool   Rot   = Particle_Has(Features, Particle_Feature_Rotation);
+    constexpr bool   Size  = Particle_Has(Features, Particle_Feature_Size);
+
+    auto n_spawn = Emitter_SpawnCount(emitter.timer, emitter.rate, emitter.paused, time_sec);
+    CompactEmitter_Spawn(emitter, n_spawn);
+
+    float t         = time_sec;
+    Vec   g         = emitter.params.gravity;
+    float keep      = 1.0f - emitter.params.drag * t;
+    keep            = (emitter.params.drag > 0.0f) ? ((keep < 0.0f) ? 0.0f : keep) : 1.0f;
+    float scale     = emitter.extent / 32767.0f;
+    float inv_scale = 32767.0f / emitter.extent;
+
+    float px[Batch], py[Batch], pz[Batch];
+    float vx[Batch], vy[Batch], vz[Batch];
+    float ax[Batch], ay[Batch], az[Batch];
+    float tx[Batch], ty[Batch], tz[Batch];
+    float wx[Batch], wy[Batch], wz[Batch];
+    float life[Batch], duration[Batch], size[Batch];
+    bool  alive[Batch];
+
+    size_t w = 0;
+    for (size_t begin = 0; begin < emitter.count; begin += Batch)
+    {
+        size_t n = (emitter.count - begin < Batch) ? emitter.count - begin : Batch;
+
+        // Unpack.
+        for (size_t i = 0; i < n; ++i)
+        {
+            px[i] = emitter.px[begin + i] * scale;
+            py[i] = emitter.py[begin + i] * scale;
+            pz[i] = emitter.pz[begin + i] * scale;
+        }
+        CompactVec_Unpack(emitter.vel, begin, n, vx, vy, vz);
+        Half_Unpack(emitter.duration.data() + begin, duration, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            life[i] = emitter.life[begin + i] * (duration[i] / 65535.0f);
+        }
+        if constexpr (Acc)
+        {
+            CompactVec_Unpack(emitter.acc, begin, n, ax, ay, az);
+        }
+        if constexpr (Rot)
+        {
+            CompactVec_Unpack(emitter.theta, begin, n, tx, ty, tz);
+            CompactVec_Unpack(emitter.omega, begin, n, wx, wy, wz);
+        }
+        if constexpr (Size)
+        {
+            Half_Unpack(emitter.size.data() + begin, size, n);
+        }
+
+        // Integrate, as Particle_Integrate.
+        for (size_t i = 0; i < n; ++i)
+        {
+            life[i] -= t;
+        }
+        if constexpr (Acc)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                ax[i] += g.x * t;
+                ay[i] += g.y * t;
+                az[i] += g.z * t;
+                vx[i] += ax[i] * t;
+                vy[i] += ay[i] * t;
+                vz[i] += az[i] * t;
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                vx[i] += g.x * t;
+                vy[i] += g.y * t;
+                vz[i] += g.z * t;
+            }
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            vx[i] *= keep;
+            vy[i] *= keep;
+            vz[i] *= keep;
+            px[i] += vx[i] * t;
+            py[i] += vy[i] * t;
+            pz[i] += vz[i] * t;
+        }
+        if constexpr (Rot)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                tx[i] = Compact_WrapAngle(tx[i] + wx[i] / 60.0f);
+                ty[i] = Compact_WrapAngle(ty[i] + wy[i] / 60.0f);
+                tz[i] = Compact_WrapAngle(tz[i] + wz[i] / 60.0f);
+            }
+        }
+
+        // Survivors move down to w. Everything of this batch has been read,
+        // and w never passes begin, so nothing unread is overwritten.
+        float e = emitter.extent;
+        for (size_t i = 0; i < n; ++i)
+        {
+            alive[i] = life[i] >= 0.0f && fabsf(px[i]) <= e && fabsf(py[i]) <= e && fabsf(pz[i]) <= e;
+        }
+
+        size_t m = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!alive[i])
+            {
+                continue;
+            }
+            px[m]       = px[i];
+            py[m]       = py[i];
+            pz[m]       = pz[i];
+            vx[m]       = vx[i];
+            vy[m]       = vy[i];
+            vz[m]       = vz[i];
+            life[m]     = life[i];
+            duration[m] = duration[i];
+            if constexpr (Acc)
+            {
+                ax[m] = ax[i];
+                ay[m] = ay[i];
+                az[m] = az[i];
+            }
+            if constexpr (Rot)
+            {
+                tx[m] = tx[i];
+                ty[m] = ty[i];
+                tz[m] = tz[i];
+                wx[m] = wx[i];
+                wy[m] = wy[i];
+                wz[m] = wz[i];
+            }
+            if constexpr (Size)
+            {
+                size[m] = size[i];
+            }
+            ++m;
+        }
+
+        // Pack.
+        for (size_t i = 0; i < m; ++i)
+        {
+            emitter.px[w + i] = Compact_Quantise(px[i], inv_scale);
+            emitter.py[w + i] = Compact_Quantise(py[i], inv_scale);
+            emitter.pz[w + i] = Compact_Quantise(pz[i], inv_scale);
+
+            float fraction      = (duration[i] > 0.0f) ? life[i] / duration[i] : 0.0f;
+            fraction            = (fraction > 1.0f) ? 1.0f : fraction;
+            emitter.life[w + i] = static_cast<uint16>(fraction * 65535.0f + 0.5f);
+        }
+        CompactVec_Pack(emitter.vel, w, m, vx, vy, vz);
+        Half_Pack(duration, emitter.duration.data() + w, m);
+        if constexpr (Acc)
+        {
+            CompactVec_Pack(emitter.acc, w, m, ax, ay, az);
+        }
+        if constexpr (Rot)
+        {
+            CompactVec_Pack(emitter.theta, w, m, tx, ty, tz);
+            CompactVec_Pack(emitter.omega, w, m, wx, wy, wz);
+        }
+        if constexpr (Size)
+        {
+            Half_Pack(size, emitter.size.data() + w, m);
+        }
+        w += m;
+    }
+    emitter.count = static_cast<uint32>(w);
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <array>
+#include <assert.h>
+#include <stddef.h>
+
+
+// Curves are authored as a handful of keys, but particles only ever see the
+// baked lookup table. Never evaluate the spline per particle per frame.
+constexpr size_t Curve_LUT_Size = 64;
+
+struct Curve_Key
+{
+    float t; // Normalised age, 0 at spawn and 1 at death.
+    float value;
+};
+
+struct Curve_LUT
+{
+    std::array<float, Curve_LUT_Size> values;
+};
+
+
+enum Curve_Channel : uint32
+{
+    Curve_Channel_Size           = 1u << 0,
+    Curve_Channel_Color          = 1u << 1,
+    Curve_Channel_AngularDamping = 1u << 2,
+};
+
+
+// Everything that varies over a particle's life. One per emitter, baked at
+// configuration time.
+struct Emitter_Curves
+{
+    uint32 channels { 0 };
+
+    Curve_LUT size;
+    Curve_LUT r, g, b, a;
+    Curve_LUT angular_damping; // Fraction of omega lost per second.
+};
+
+
+// Catmull-Rom through the keys, with the end keys repeated so the curve
+// passes through the first and last values.
+float
+Curve_Evaluate(Curve_Key const* keys, size_t n_keys, float t)
+{
+    assert(n_keys > 0);
+    if (n_keys == 1 || t <= keys[0].t)
+    {
+        return keys[0].value;
+    }
+    if (t >= keys[n_keys - 1].t)
+    {
+        return keys[n_keys - 1].value;
+    }
+
+    size_t i = 0;
+    while (i + 1 < n_keys - 1 && keys[i + 1].t < t)
+    {
+        ++i;
+    }
+
+    auto& k1 = keys[i];
+    auto& k2 = keys[i + 1];
+    auto& k0 = (i > 0) ? keys[i - 1] : k1;
+    auto& k3 = (i + 2 < n_keys) ? keys[i + 2] : k2;
+
+    float span = k2.t - k1.t;
+    float u    = (span > 0.0f) ? (t - k1.t) / span : 0.0f;
+    float u2   = u * u;
+    float u3   = u2 * u;
+
+    return 0.5f * ((2.0f * k1.value)
+                   + (-k0.value + k2.value) * u
+                   + (2.0f * k0.value - 5.0f * k1.value + 4.0f * k2.value - k3.value) * u2
+                   + (-k0.value + 3.0f * k1.value - 3.0f * k2.value + k3.value) * u3);
+}
+
+
+void
+Curve_Bake(Curve_LUT& lut, Curve_Key const* keys, size_t n_keys)
+{
+    for (size_t i = 0; i < Curve_LUT_Size; ++i)
+    {
+        float t       = i / float(Curve_LUT_Size - 1);
+        lut.values[i] = Curve_Evaluate(keys, n_keys, t);
+    }
+}
+
+
+void
+Curve_BakeConstant(Curve_LUT& lut, float value)
+{
+    lut.values.fill(value);
+}
+
+
+// Linear filtered lookup. age is clamped to [0, 1].
+float
+Curve_Sample(Curve_LUT const& lut, float age)
+{
+    age     = (age < 0.0f) ? 0.0f : ((age > 1.0f) ? 1.0f : age);
+    float x = age * (Curve_LUT_Size - 1);
+    auto  i = static_cast<size_t>(x);
+    i       = (i < Curve_LUT_Size - 1) ? i : Curve_LUT_Size - 2;
+    float f = x - i;
+    return lut.values[i] + (lut.values[i + 1] - lut.values[i]) * f;
+}
+
+
+// Maps a [0, 1] curve value to a colour channel.
+uint8
+Curve_ToByte(float value)
+{
+    float v = value * 255.0f + 0.5f;
+    v       = (v < 0.0f) ? 0.0f : ((v > 255.0f) ? 255.0f : v);
+    return static_cast<uint8>(v);
+}
+
+
+// Samples a whole batch of normalised ages. Kept as a flat loop over plain
+// arrays so the compiler vectorises it.
+void
+Curve_SampleBatch(Curve_LUT const& lut, float const* ages, float* out, size_t n)
+{
+    for (size_t k = 0; k < n; ++k)
+    {
+        out[k] = Curve_Sample(lut, ages[k]);
+    }
+}
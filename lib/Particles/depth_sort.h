@@ -0,0 +1,219 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Back-to-front draw order for blended particles. Depth along the view
+// direction is quantised to 16 bits and sorted with a two pass LSD radix
+// sort. Draw order barely changes between frames, so last frame's order is
+// tried first and repaired with a bounded insertion sort; the radix sort only
+// runs when that repair gets too expensive.
+
+struct Depth_Sort
+{
+    // Indices into the particle array, back to front.
+    std::vector<uint32> order;
+
+    std::vector<uint16> keys;
+    std::vector<uint16> keys_tmp;
+    std::vector<uint32> order_tmp;
+
+    // Insertion sort gives up after this many moves per particle.
+    uint32 max_moves_per_particle { 4 };
+};
+
+
+// Larger key = nearer, so ascending order draws back to front.
+uint16
+DepthSort_Quantise(float depth, float near_dist, float inv_range)
+{
+    float t = (depth - near_dist) * inv_range;
+    t       = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+    return static_cast<uint16>((1.0f - t) * 65535.0f);
+}
+
+
+template <typename Particles>
+void
+DepthSort_ExtractKeys(Depth_Sort&      sort,
+                      Particles const& particles,
+                      Vec              eye,
+                      Vec              forward,
+                      float            near_dist,
+                      float            far_dist)
+{
+    auto n         = sort.order.size();
+    auto inv_range = 1.0f / (far_dist - near_dist);
+
+    // Depth relative to the eye is dot(pos, forward) - dot(eye, forward).
+    float eye_depth = eye.x * forward.x + eye.y * forward.y + eye.z * forward.z;
+
+    sort.keys.resize(n);
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    auto fx    = _mm_set1_ps(forward.x);
+    auto fy    = _mm_set1_ps(forward.y);
+    auto fz    = _mm_set1_ps(forward.z);
+    auto off   = _mm_set1_ps(eye_depth + near_dist);
+    auto scale = _mm_set1_ps(inv_range);
+    auto zero  = _mm_setzero_ps();
+    auto one   = _mm_set1_ps(1.0f);
+    auto max16 = _mm_set1_ps(65535.0f);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        auto& p0 = particles[sort.order[i + 0]].pos;
+        auto& p1 = particles[sort.order[i + 1]].pos;
+        auto& p2 = particles[sort.order[i + 2]].pos;
+        auto& p3 = particles[sort.order[i + 3]].pos;
+
+        auto x = _mm_set_ps(p3.x, p2.x, p1.x, p0.x);
+        auto y = _mm_set_ps(p3.y, p2.y, p1.y, p0.y);
+        auto z = _mm_set_ps(p3.z, p2.z, p1.z, p0.z);
+
+        auto d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, fx), _mm_mul_ps(y, fy)), _mm_mul_ps(z, fz));
+        auto t = _mm_mul_ps(_mm_sub_ps(d, off), scale);
+        t      = _mm_min_ps(_mm_max_ps(t, zero), one);
+
+        auto q = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(one, t), max16));
+
+        alignas(16) int32 out[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(out), q);
+        sort.keys[i + 0] = static_cast<uint16>(out[0]);
+        sort.keys[i + 1] = static_cast<uint16>(out[1]);
+        sort.keys[i + 2] = static_cast<uint16>(out[2]);
+        sort.keys[i + 3] = static_cast<uint16>(out[3]);
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        auto& p      = particles[sort.order[i]].pos;
+        float d      = p.x * forward.x + p.y * forward.y + p.z * forward.z - eye_depth;
+        sort.keys[i] = DepthSort_Quantise(d, near_dist, inv_range);
+    }
+}
+
+
+// Repairs a nearly sorted order in place. Returns false, leaving the arrays
+// partially sorted, if it needs more than max_moves shifts.
+bool
+DepthSort_Insertion(Depth_Sort& sort, size_t max_moves)
+{
+    auto&  keys  = sort.keys;
+    auto&  order = sort.order;
+    size_t moves = 0;
+
+    for (size_t i = 1; i < keys.size(); ++i)
+    {
+        auto   key   = keys[i];
+        auto   index = order[i];
+        size_t k     = i;
+        while (k > 0 && keys[k - 1] > key)
+        {
+            keys[k]  = keys[k - 1];
+            order[k] = order[k - 1];
+            --k;
+            if (++moves > max_moves)
+            {
+                keys[k]  = key;
+                order[k] = index;
+                return false;
+            }
+        }
+        keys[k]  = key;
+        order[k] = index;
+    }
+    return true;
+}
+
+
+// Two 8 bit LSD passes. Stable, so equal depths keep last frame's order and
+// don't flicker.
+void
+DepthSort_Radix(Depth_Sort& sort)
+{
+    auto n = sort.keys.size();
+    sort.keys_tmp.resize(n);
+    sort.order_tmp.resize(n);
+
+    uint16* keys_in   = sort.keys.data();
+    uint16* keys_out  = sort.keys_tmp.data();
+    uint32* order_in  = sort.order.data();
+    uint32* order_out = sort.order_tmp.data();
+
+    for (int shift = 0; shift < 16; shift += 8)
+    {
+        uint32 counts[256] = {};
+        for (size_t i = 0; i < n; ++i)
+        {
+            counts[(keys_in[i] >> shift) & 0xFF] += 1;
+        }
+
+        uint32 sum = 0;
+        for (auto& count : counts)
+        {
+            auto c = count;
+            count  = sum;
+            sum += c;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto dst       = counts[(keys_in[i] >> shift) & 0xFF]++;
+            keys_out[dst]  = keys_in[i];
+            order_out[dst] = order_in[i];
+        }
+
+        std::swap(keys_in, keys_out);
+        std::swap(order_in, order_out);
+    }
+
+    // An even number of passes leaves the result back in keys/order.
+}
+
+
+// Sorts particles back to front along forward as seen from eye. Depths
+// outside [near_dist, far_dist] are clamped.
+template <typename Particles>
+void
+DepthSort_Update(Depth_Sort&      sort,
+                 Particles const& particles,
+                 Vec              eye,
+                 Vec              forward,
+                 float            near_dist,
+                 float            far_dist)
+{
+    auto n = static_cast<uint32>(particles.size());
+
+    // Reuse last frame's order. Indices past the end are gone, new
+    // particles are appended; the sort fixes up the rest.
+    auto   prev = static_cast<uint32>(sort.order.size());
+    size_t w    = 0;
+    for (size_t i = 0; i < sort.order.size(); ++i)
+    {
+        if (sort.order[i] < n)
+        {
+            sort.order[w++] = sort.order[i];
+        }
+    }
+    sort.order.resize(w);
+    for (uint32 i = prev; i < n; ++i)
+    {
+        sort.order.push_back(i);
+    }
+
+    DepthSort_ExtractKeys(sort, particles, eye, forward, near_dist, far_dist);
+
+    if (!DepthSort_Insertion(sort, size_t(n) * sort.max_moves_per_particle))
+    {
+        DepthSort_Radix(sort);
+    }
+}
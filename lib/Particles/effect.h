@@ -0,0 +1,680 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+// Data driven emitters. Effects are authored as text:
+//
+//     # A burst of short lived sparks.
+//     effect sparks
+//         features color
+//         rate     0.05
+//         shape    sphere 0.5
+//         velocity 0 8 0
+//         speed    2
+//         spread   30
+//         spin     0
+//         lifetime 1.5 0.25
+//         size     4
+//         gravity  0 -9.81 0
+//         drag     0.2
+//         substep  0.5 8
+//     end
+//
+// and compiled offline to a flat binary: a header followed by an array of
+// fixed size definitions sorted by name hash. Loading the binary is a
+// validation and a pointer cast, nothing is parsed or copied, so thousands of
+// effects load in well under a millisecond.
+
+constexpr uint32 Effect_Magic   = 0x31584650; // "PFX1"
+constexpr uint32 Effect_Version = 3;
+
+struct Effect_Header
+{
+    uint32 magic;
+    uint32 version;
+    uint32 count;
+    uint32 def_size;
+};
+
+// Plain floats rather than Vec so the layout doesn't depend on how the maths
+// library pads its types.
+struct Effect_Def
+{
+    uint32 name_hash;
+    char   name[32];
+    uint32 features;
+    float  rate;
+
+    uint32 shape;
+    float  extents[3];
+    float  cone_angle_deg;
+    float  velocity[3];
+    int32  spread_deg;
+    float  speed;
+    int32  spin_deg;
+    float  lifetime_sec;
+    float  lifetime_jitter_sec;
+    float  size;
+    float  gravity[3];
+    float  drag;
+    float  substep_cell;
+    int32  max_substeps;
+};
+
+static_assert(std::is_trivially_copyable<Effect_Def>::value, "Effect_Def is memory mapped");
+
+
+// A view over a compiled binary. Does not own the memory.
+struct Effect_Library
+{
+    Effect_Header const* header { nullptr };
+    Effect_Def const*    defs { nullptr };
+    uint32               count { 0 };
+};
+
+
+uint32
+Effect_HashName(char const* name)
+{
+    uint32 hash = 0x811c9dc5u;
+    for (; *name; ++name)
+    {
+        hash ^= static_cast<uint8>(*name);
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+
+// The feature sets there are compiled emitters for. An effect may only ask
+// for one of these.
+template <typename Fn>
+bool
+Effect_DispatchFeatures(uint32 features, Fn&& fn)
+{
+    switch (features)
+    {
+    case Particle_Features_Default:
+        fn(std::integral_constant<uint32, Particle_Features_Default> {});
+        return true;
+    case Particle_Features_Spark:
+        fn(std::integral_constant<uint32, Particle_Features_Spark> {});
+        return true;
+    case Particle_Features_Default | Particle_Feature_Color:
+        fn(std::integral_constant<uint32, Particle_Features_Default | Particle_Feature_Color> {});
+        return true;
+    }
+    return false;
+}
+
+
+// A pooled system for each feature set above, so an effect whose features
+// are only known once it's loaded can still be instanced, see Effect_Spawn.
+struct Effect_Systems
+{
+    ParticleSystem_Of<Particle_Features_Default>                          basic;
+    ParticleSystem_Of<Particle_Features_Spark>                            spark;
+    ParticleSystem_Of<Particle_Features_Default | Particle_Feature_Color> colored;
+};
+
+
+template <uint32 Features>
+ParticleSystem_Of<Features>&
+Effect_System(Effect_Systems& systems)
+{
+    if constexpr (Features == Particle_Features_Default)
+    {
+        return systems.basic;
+    }
+    else if constexpr (Features == Particle_Features_Spark)
+    {
+        return systems.spark;
+    }
+    else
+    {
+        static_assert(Features == (Particle_Features_Default | Particle_Feature_Color), "no system for this feature set");
+        return systems.colored;
+    }
+}
+
+
+// An effect's emitter, in the system for its feature set.
+struct Effect_Instance
+{
+    uint32     features { 0 };
+    Emitter_ID id { Emitter_ID_None };
+};
+
+
+Effect_Def
+Effect_DefaultDef()
+{
+    Emitter_Params params;
+    Effect_Def     def = {};
+
+    def.features            = Particle_Features_Default;
+    def.rate                = 0.5f;
+    def.shape               = params.spawn.shape;
+    def.cone_angle_deg      = params.spawn.cone_angle_deg;
+    def.velocity[0]         = params.velocity.x;
+    def.velocity[1]         = params.velocity.y;
+    def.velocity[2]         = params.velocity.z;
+    def.spread_deg          = params.spread_deg;
+    def.speed               = params.speed;
+    def.spin_deg            = params.spin_deg;
+    def.lifetime_sec        = params.lifetime_sec;
+    def.lifetime_jitter_sec = params.lifetime_jitter_sec;
+    def.size                = params.size;
+    def.gravity[0]          = params.gravity.x;
+    def.gravity[1]          = params.gravity.y;
+    def.gravity[2]          = params.gravity.z;
+    def.drag                = params.drag;
+    def.substep_cell        = params.substep_cell;
+    def.max_substeps        = params.max_substeps;
+    return def;
+}
+
+
+Emitter_Params
+Effect_Params(Effect_Def const& def)
+{
+    Emitter_Params params;
+    params.spawn.shape          = static_cast<Spawn_Shape>(def.shape);
+    params.spawn.extents        = Vec { def.extents[0], def.extents[1], def.extents[2] };
+    params.spawn.cone_angle_deg = def.cone_angle_deg;
+
+    params.velocity            = Vec { def.velocity[0], def.velocity[1], def.velocity[2] };
+    params.spread_deg          = def.spread_deg;
+    params.speed               = def.speed;
+    params.spin_deg            = def.spin_deg;
+    params.lifetime_sec        = def.lifetime_sec;
+    params.lifetime_jitter_sec = def.lifetime_jitter_sec;
+    params.size                = def.size;
+    params.gravity             = Vec { def.gravity[0], def.gravity[1], def.gravity[2] };
+    params.drag                = def.drag;
+    params.substep_cell        = def.substep_cell;
+    params.max_substeps        = def.max_substeps;
+    return params;
+}
+
+
+// As above, for an emitter that's already running: what the effect format
+// can't carry, the spawn mesh, is attached in code and kept from current.
+Emitter_Params
+Effect_Params(Effect_Def const& def, Emitter_Params const& current)
+{
+    auto params       = Effect_Params(def);
+    params.spawn.mesh = current.spawn.mesh;
+    return params;
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+Effect_Apply(Emitter_Of<Features, Capacity>& emitter, Effect_Def const& def)
+{
+    assert(def.features == Features);
+    emitter.rate        = def.rate;
+    emitter.params      = Effect_Params(def, emitter.params);
+    emitter.effect_hash = def.name_hash;
+}
+
+
+template <uint32 Features>
+void
+Effect_Apply(ParticleSystem_Of<Features>& system, Emitter_ID id, Effect_Def const& def)
+{
+    assert(def.features == Features);
+    if (auto* emitter = ParticleSystem_Find(system, id))
+    {
+        emitter->rate        = def.rate;
+        emitter->params      = Effect_Params(def, emitter->params);
+        emitter->effect_hash = def.name_hash;
+    }
+}
+
+
+// Creates an emitter for def in the system matching its feature set, which
+// need only be known at run time. The id is Emitter_ID_None for a feature
+// set no emitter is compiled for; loaded libraries never hold one.
+Effect_Instance
+Effect_Spawn(Effect_Systems& systems, Effect_Def const& def)
+{
+    Effect_Instance instance;
+    Effect_DispatchFeatures(def.features, [&](auto features) {
+        constexpr uint32 Features = decltype(features)::value;
+
+        auto& system      = Effect_System<Features>(systems);
+        instance.features = Features;
+        instance.id       = ParticleSystem_CreateEmitter(system);
+        Effect_Apply(system, instance.id, def);
+    });
+    return instance;
+}
+
+
+void
+Effect_Despawn(Effect_Systems& systems, Effect_Instance instance)
+{
+    Effect_DispatchFeatures(instance.features, [&](auto features) {
+        ParticleSystem_DestroyEmitter(Effect_System<decltype(features)::value>(systems), instance.id);
+    });
+}
+
+
+void
+Effect_Integrate(Effect_Systems& systems, float time_sec, Thread_Pool* pool = nullptr)
+{
+    ParticleSystem_Integrate(systems.basic, time_sec, pool);
+    ParticleSystem_Integrate(systems.spark, time_sec, pool);
+    ParticleSystem_Integrate(systems.colored, time_sec, pool);
+}
+
+
+// Whether a def, compiled or loaded, is one the emitters can run: a known
+// shape and feature set, and values in range and finite.
+bool
+Effect_ValidDef(Effect_Def const& def)
+{
+    float const values[] = { def.rate,
+                             def.extents[0],
+                             def.extents[1],
+                             def.extents[2],
+                             def.cone_angle_deg,
+                             def.velocity[0],
+                             def.velocity[1],
+                             def.velocity[2],
+                             def.speed,
+                             def.lifetime_sec,
+                             def.lifetime_jitter_sec,
+                             def.size,
+                             def.gravity[0],
+                             def.gravity[1],
+                             def.gravity[2],
+                             def.drag,
+                             def.substep_cell };
+    for (float value : values)
+    {
+        if (!isfinite(value))
+        {
+            return false;
+        }
+    }
+
+    return def.name[sizeof(def.name) - 1] == '\0'
+        && def.shape <= Spawn_Shape_Mesh
+        && Effect_DispatchFeatures(def.features, [](auto) {})
+        && def.rate >= 0.0f
+        && def.spread_deg >= 0
+        && def.spin_deg >= 0
+        && def.lifetime_sec > 0.0f
+        && def.lifetime_jitter_sec >= 0.0f
+        && def.lifetime_jitter_sec < def.lifetime_sec
+        && def.substep_cell >= 0.0f
+        && def.max_substeps >= 1;
+}
+
+
+bool
+Effect_ParseFloats(char const* args, float* out, int n)
+{
+    char* end = nullptr;
+    for (int i = 0; i < n; ++i)
+    {
+        out[i] = strtof(args, &end);
+        if (end == args)
+        {
+            return false;
+        }
+        args = end;
+    }
+    return true;
+}
+
+
+bool
+Effect_Error(std::string* error, int line, char const* message)
+{
+    if (error)
+    {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "line %d: %s", line, message);
+        *error = buffer;
+    }
+    return false;
+}
+
+
+// Compiles effect source text to the binary form.
+bool
+Effect_Compile(char const* source, std::vector<uint8>& out, std::string* error = nullptr)
+{
+    std::vector<Effect_Def> defs;
+    Effect_Def              def;
+    bool                    in_effect = false;
+    int                     line_no   = 0;
+
+    char const* cursor = source;
+    while (*cursor)
+    {
+        char const* eol = strchr(cursor, '\n');
+        size_t      len = eol ? size_t(eol - cursor) : strlen(cursor);
+
+        char line[256];
+        len = (len < sizeof(line) - 1) ? len : sizeof(line) - 1;
+        memcpy(line, cursor, len);
+        line[len] = '\0';
+        cursor    = eol ? eol + 1 : cursor + strlen(cursor);
+        line_no += 1;
+
+        if (char* hash = strchr(line, '#'))
+        {
+            *hash = '\0';
+        }
+
+        char key[32];
+        int  consumed = 0;
+        if (sscanf(line, " %31s %n", key, &consumed) != 1)
+        {
+            continue;
+        }
+        char const* args = line + consumed;
+
+        if (strcmp(key, "effect") == 0)
+        {
+            if (in_effect)
+            {
+                return Effect_Error(error, line_no, "missing 'end'");
+            }
+            def = Effect_DefaultDef();
+            if (sscanf(args, "%31s", def.name) != 1)
+            {
+                return Effect_Error(error, line_no, "effect needs a name");
+            }
+            def.name_hash = Effect_HashName(def.name);
+            in_effect     = true;
+            continue;
+        }
+
+        if (!in_effect)
+        {
+            return Effect_Error(error, line_no, "expected 'effect'");
+        }
+
+        bool ok = true;
+        if (strcmp(key, "end") == 0)
+        {
+            if (!Effect_ValidDef(def))
+            {
+                return Effect_Error(error, line_no, "effect out of range");
+            }
+            defs.push_back(def);
+            in_effect = false;
+        }
+        else if (strcmp(key, "features") == 0)
+        {
+            def.features = 0;
+            char name[32];
+            int  n = 0;
+            while (sscanf(args, "%31s %n", name, &n) == 1)
+            {
+                if (strcmp(name, "acceleration") == 0)
+                {
+                    def.features |= Particle_Feature_Acceleration;
+                }
+                else if (strcmp(name, "rotation") == 0)
+                {
+                    def.features |= Particle_Feature_Rotation;
+                }
+                else if (strcmp(name, "size") == 0)
+                {
+                    def.features |= Particle_Feature_Size;
+                }
+                else if (strcmp(name, "color") == 0)
+                {
+                    def.features |= Particle_Feature_Color;
+                }
+                else if (strcmp(name, "none") != 0)
+                {
+                    return Effect_Error(error, line_no, "unknown feature");
+                }
+                args += n;
+            }
+            if (!Effect_DispatchFeatures(def.features, [](auto) {}))
+            {
+                return Effect_Error(error, line_no, "no emitter is compiled for this feature set");
+            }
+        }
+        else if (strcmp(key, "rate") == 0)
+        {
+            ok = Effect_ParseFloats(args, &def.rate, 1);
+        }
+        else if (strcmp(key, "shape") == 0)
+        {
+            char name[32];
+            int  n = 0;
+            ok     = sscanf(args, "%31s %n", name, &n) == 1;
+            if (ok && strcmp(name, "point") == 0)
+            {
+                def.shape = Spawn_Shape_Point;
+            }
+            else if (ok && strcmp(name, "sphere") == 0)
+            {
+                def.shape = Spawn_Shape_Sphere;
+                ok        = Effect_ParseFloats(args + n, def.extents, 1);
+            }
+            else if (ok && strcmp(name, "hemisphere") == 0)
+            {
+                def.shape = Spawn_Shape_Hemisphere;
+                ok        = Effect_ParseFloats(args + n, def.extents, 1);
+            }
+            else if (ok && strcmp(name, "box") == 0)
+            {
+                def.shape = Spawn_Shape_Box;
+                ok        = Effect_ParseFloats(args + n, def.extents, 3);
+            }
+            else if (ok && strcmp(name, "cone") == 0)
+            {
+                def.shape = Spawn_Shape_Cone;
+                ok        = Effect_ParseFloats(args + n, &def.cone_angle_deg, 1);
+            }
+            else if (ok && strcmp(name, "disc") == 0)
+            {
+                def.shape = Spawn_Shape_Disc;
+                ok        = Effect_ParseFloats(args + n, def.extents, 1);
+            }
+            else
+            {
+                return Effect_Error(error, line_no, "unknown shape");
+            }
+        }
+        else if (strcmp(key, "velocity") == 0)
+        {
+            ok = Effect_ParseFloats(args, def.velocity, 3);
+        }
+        else if (strcmp(key, "speed") == 0)
+        {
+            ok = Effect_ParseFloats(args, &def.speed, 1);
+        }
+        else if (strcmp(key, "spread") == 0)
+        {
+            ok = sscanf(args, "%d", &def.spread_deg) == 1 && def.spread_deg >= 0;
+        }
+        else if (strcmp(key, "spin") == 0)
+        {
+            ok = sscanf(args, "%d", &def.spin_deg) == 1 && def.spin_deg >= 0;
+        }
+        else if (strcmp(key, "lifetime") == 0)
+        {
+            // Jitter must leave every particle some life, or its age is
+            // 0 / 0.
+            float values[2] = { 0.0f, 0.0f };
+            ok              = Effect_ParseFloats(args, values, 1);
+            Effect_ParseFloats(args, values, 2);
+            ok                      = ok && values[0] > 0.0f && values[1] >= 0.0f && values[1] < values[0];
+            def.lifetime_sec        = values[0];
+            def.lifetime_jitter_sec = values[1];
+        }
+        else if (strcmp(key, "size") == 0)
+        {
+            ok = Effect_ParseFloats(args, &def.size, 1);
+        }
+        else if (strcmp(key, "gravity") == 0)
+        {
+            ok = Effect_ParseFloats(args, def.gravity, 3);
+        }
+        else if (strcmp(key, "drag") == 0)
+        {
+            ok = Effect_ParseFloats(args, &def.drag, 1);
+        }
+        else if (strcmp(key, "substep") == 0)
+        {
+            // Cell size, then optionally the most sub-steps a tick.
+            int n = 0;
+            ok    = sscanf(args, "%f %n", &def.substep_cell, &n) == 1 && def.substep_cell >= 0.0f;
+            if (ok && args[n] != '\0')
+            {
+                ok = sscanf(args + n, "%d", &def.max_substeps) == 1 && def.max_substeps >= 1;
+            }
+        }
+        else
+        {
+            return Effect_Error(error, line_no, "unknown key");
+        }
+
+        if (!ok)
+        {
+            return Effect_Error(error, line_no, "bad value");
+        }
+    }
+
+    if (in_effect)
+    {
+        return Effect_Error(error, line_no, "missing 'end'");
+    }
+
+    std::sort(defs.begin(), defs.end(), [](Effect_Def const& a, Effect_Def const& b) {
+        return a.name_hash < b.name_hash;
+    });
+    for (size_t i = 1; i < defs.size(); ++i)
+    {
+        if (defs[i].name_hash == defs[i - 1].name_hash)
+        {
+            return Effect_Error(error, line_no, "duplicate effect name or hash");
+        }
+    }
+
+    Effect_Header header = { Effect_Magic,
+                             Effect_Version,
+                             static_cast<uint32>(defs.size()),
+                             sizeof(Effect_Def) };
+
+    out.resize(sizeof(header) + defs.size() * sizeof(Effect_Def));
+    memcpy(out.data(), &header, sizeof(header));
+    if (!defs.empty())
+    {
+        memcpy(out.data() + sizeof(header), defs.data(), defs.size() * sizeof(Effect_Def));
+    }
+    return true;
+}
+
+
+// Points library at a compiled binary. data must stay alive, and be at
+// least 4 byte aligned, for as long as the library is used. A binary that
+// is corrupt, stale or out of order is refused whole, header or defs.
+bool
+Effect_Load(Effect_Library& library, void const* data, size_t size)
+{
+    library = {};
+    if (size < sizeof(Effect_Header) || (reinterpret_cast<uintptr_t>(data) & 3) != 0)
+    {
+        return false;
+    }
+
+    auto* header = static_cast<Effect_Header const*>(data);
+    if (header->magic != Effect_Magic
+        || header->version != Effect_Version
+        || header->def_size != sizeof(Effect_Def)
+        || size < sizeof(Effect_Header) + size_t(header->count) * sizeof(Effect_Def))
+    {
+        return false;
+    }
+
+    // Effect_Find bisects on the hash.
+    auto* defs = reinterpret_cast<Effect_Def const*>(header + 1);
+    for (uint32 i = 0; i < header->count; ++i)
+    {
+        if (!Effect_ValidDef(defs[i]) || (i > 0 && defs[i].name_hash <= defs[i - 1].name_hash))
+        {
+            return false;
+        }
+    }
+
+    library.header = header;
+    library.defs   = reinterpret_cast<Effect_Def const*>(header + 1);
+    library.count  = header->count;
+    return true;
+}
+
+
+Effect_Def const*
+Effect_Find(Effect_Library const& library, uint32 name_hash)
+{
+    uint32 lo = 0;
+    uint32 hi = library.count;
+    while (lo < hi)
+    {
+        uint32 mid = lo + (hi - lo) / 2;
+        if (library.defs[mid].name_hash < name_hash)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < library.count && library.defs[lo].name_hash == name_hash)
+    {
+        return &library.defs[lo];
+    }
+    return nullptr;
+}
+
+
+Effect_Def const*
+Effect_Find(Effect_Library const& library, char const* name)
+{
+    return Effect_Find(library, Effect_HashName(name));
+}
+
+
+bool
+Effect_ReadFile(char const* path, std::vector<uint8>& out)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    out.resize(size > 0 ? size_t(size) : 0);
+    bool ok = fread(out.data(), 1, out.size(), file) == out.size();
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include <vector>
+
+
+// Particle lifecycle events. Integration appends to a per-thread buffer, no
+// locks; once the pass is over the buffers are merged, in thread order, and
+// child emitters consume the whole tick's events in bulk (fireworks, impact
+// debris).
+
+enum Particle_Event_Type : uint32
+{
+    Particle_Event_Death     = 1u << 0,
+    Particle_Event_Collision = 1u << 1,
+    Particle_Event_Age       = 1u << 2, // Crossed the emitter's event_age.
+};
+
+struct Particle_Event
+{
+    Vec    pos;
+    Vec    vel;
+    uint32 emitter; // Slot in a ParticleSystem, or the emitter's event_id.
+    uint32 type;
+};
+
+struct Event_Buffer
+{
+    std::vector<Particle_Event> events;
+};
+
+struct Event_Queue
+{
+    std::vector<Event_Buffer>   per_thread;
+    std::vector<Particle_Event> merged;
+};
+
+
+void
+EventQueue_Init(Event_Queue& queue, int n_threads, size_t reserve_per_thread)
+{
+    queue.per_thread.resize(n_threads);
+    for (auto& buffer : queue.per_thread)
+    {
+        buffer.events.reserve(reserve_per_thread);
+    }
+    queue.merged.reserve(reserve_per_thread * n_threads);
+}
+
+
+void
+Event_Emit(Event_Buffer& buffer, uint32 type, uint32 emitter, Vec const& pos, Vec const& vel)
+{
+    buffer.events.push_back({ pos, vel, emitter, type });
+}
+
+
+// Once per tick, after integration. Replaces last tick's merged events.
+void
+EventQueue_Merge(Event_Queue& queue)
+{
+    queue.merged.clear();
+    for (auto& buffer : queue.per_thread)
+    {
+        queue.merged.insert(queue.merged.end(), buffer.events.begin(), buffer.events.end());
+        buffer.events.clear();
+    }
+}
+
+
+// True when a normalised age crossed threshold during this tick.
+bool
+Event_AgeCrossed(float age_before, float age_after, float threshold)
+{
+    return threshold >= 0.0f && age_before < threshold && age_after >= threshold;
+}
+
+
+// What a child emitter spawns from its parent's events.
+struct Sub_Emitter
+{
+    uint32 trigger { Particle_Event_Death }; // Mask of event types.
+    uint32 parent { ~0u };                   // Only this emitter's events, ~0u for any.
+    int    count { 8 };                      // Particles per event.
+    float  inherit_velocity { 0.0f };        // Fraction of the parent's velocity.
+};
+
+
+bool
+SubEmitter_Matches(Sub_Emitter const& sub, Particle_Event const& event)
+{
+    return (event.type & sub.trigger) && (sub.parent == ~0u || sub.parent == event.emitter);
+}
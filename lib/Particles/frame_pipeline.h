@@ -0,0 +1,391 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A frame as a set of coroutines rather than one loop. Each stage (input,
+// simulate, cull, render prep, present) is a coroutine that awaits its own
+// clock, so each runs at its own rate and none is paced by another. A stage
+// may also await another stage to run it as a step, or hop to the main
+// thread for work that has to happen there (window events, GL). Stages run
+// on a small set of worker threads; the main thread serves only the stages
+// that ask for it.
+
+enum Pipeline_Affinity : uint32
+{
+    Pipeline_Any,  // Any worker.
+    Pipeline_Main, // The thread inside Pipeline_RunMain.
+    Pipeline_Affinity_Count
+};
+
+
+// A stage. Starts suspended; either hand it to Pipeline_Start to run on its
+// own, or co_await it from another stage to run it to completion there.
+struct Stage_Task
+{
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    // Resumes whoever awaited the stage, if anyone did.
+    struct Final_Awaiter
+    {
+        bool
+        await_ready() noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<>
+        await_suspend(Handle handle) noexcept
+        {
+            auto next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void
+        await_resume() noexcept
+        {
+        }
+    };
+
+    struct promise_type
+    {
+        std::coroutine_handle<> continuation;
+
+        Stage_Task
+        get_return_object()
+        {
+            return Stage_Task { Handle::from_promise(*this) };
+        }
+
+        std::suspend_always
+        initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        Final_Awaiter
+        final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void
+        return_void()
+        {
+        }
+
+        void
+        unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    Handle handle;
+
+    Stage_Task() = default;
+    explicit Stage_Task(Handle h) : handle(h) {}
+    Stage_Task(Stage_Task&& other) noexcept : handle(other.handle) { other.handle = {}; }
+    Stage_Task&
+    operator=(Stage_Task&& other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    Stage_Task(Stage_Task const&) = delete;
+    ~Stage_Task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void
+    await_resume() const noexcept
+    {
+    }
+};
+
+
+using Pipeline_Clock = std::chrono::steady_clock;
+
+struct Pipeline_Timer
+{
+    Pipeline_Clock::time_point when;
+    std::coroutine_handle<>    handle;
+    Pipeline_Affinity          affinity;
+};
+
+
+struct Frame_Pipeline
+{
+    std::vector<std::thread> threads;
+
+    std::mutex              mutex;
+    std::condition_variable wake;
+
+    std::vector<Pipeline_Timer>         timers; // Min heap on when.
+    std::deque<std::coroutine_handle<>> ready[Pipeline_Affinity_Count];
+
+    std::vector<Stage_Task> stages;
+    bool                    quit { false };
+};
+
+
+// One stage's rate. A stage that falls more than a period behind drops the
+// ticks it missed rather than running them back to back.
+struct Stage_Clock
+{
+    Pipeline_Clock::duration   period;
+    Pipeline_Clock::time_point next;
+    uint64                     ticks { 0 };
+};
+
+
+Stage_Clock
+StageClock_FromRate(float per_sec)
+{
+    Stage_Clock clock;
+    clock.period = std::chrono::duration_cast<Pipeline_Clock::duration>(std::chrono::duration<float>(1.0f / per_sec));
+    clock.next   = Pipeline_Clock::now();
+    return clock;
+}
+
+
+bool
+Pipeline_TimerLater(Pipeline_Timer const& a, Pipeline_Timer const& b)
+{
+    return a.when > b.when;
+}
+
+
+// Called with the lock held. Moves timers that are due onto their ready
+// queues.
+void
+Pipeline_PromoteTimers(Frame_Pipeline& pipeline, Pipeline_Clock::time_point now)
+{
+    bool promoted = false;
+    while (!pipeline.timers.empty() && pipeline.timers.front().when <= now)
+    {
+        std::pop_heap(pipeline.timers.begin(), pipeline.timers.end(), Pipeline_TimerLater);
+        auto& timer = pipeline.timers.back();
+        pipeline.ready[timer.affinity].push_back(timer.handle);
+        pipeline.timers.pop_back();
+        promoted = true;
+    }
+    if (promoted)
+    {
+        pipeline.wake.notify_all();
+    }
+}
+
+
+// Blocks until a stage with the given affinity is ready to run, and returns
+// it; returns null once the pipeline quits.
+std::coroutine_handle<>
+Pipeline_Next(Frame_Pipeline& pipeline, Pipeline_Affinity affinity)
+{
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    for (;;)
+    {
+        if (pipeline.quit)
+        {
+            return {};
+        }
+
+        Pipeline_PromoteTimers(pipeline, Pipeline_Clock::now());
+
+        auto& ready = pipeline.ready[affinity];
+        if (!ready.empty())
+        {
+            auto handle = ready.front();
+            ready.pop_front();
+            return handle;
+        }
+
+        if (pipeline.timers.empty())
+        {
+            pipeline.wake.wait(lock);
+        }
+        else
+        {
+            // By value: the heap may grow while this thread waits.
+            auto when = pipeline.timers.front().when;
+            pipeline.wake.wait_until(lock, when);
+        }
+    }
+}
+
+
+void
+Pipeline_Serve(Frame_Pipeline& pipeline, Pipeline_Affinity affinity)
+{
+    while (auto handle = Pipeline_Next(pipeline, affinity))
+    {
+        handle.resume();
+    }
+}
+
+
+void
+Pipeline_Schedule(Frame_Pipeline& pipeline, std::coroutine_handle<> handle, Pipeline_Affinity affinity)
+{
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.ready[affinity].push_back(handle);
+    pipeline.wake.notify_all();
+}
+
+
+// co_await Pipeline_Tick(pipeline, clock, affinity) suspends the stage until
+// its next tick, then resumes it on a thread of the given affinity.
+struct Pipeline_Tick
+{
+    Frame_Pipeline&   pipeline;
+    Stage_Clock&      clock;
+    Pipeline_Affinity affinity;
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle)
+    {
+        auto now = Pipeline_Clock::now();
+        if (clock.next + clock.period < now)
+        {
+            clock.next = now;
+        }
+        auto when = clock.next;
+        clock.next += clock.period;
+        clock.ticks += 1;
+
+        // Once the timer is queued another thread may resume the stage, so
+        // nothing in its frame is touched after this.
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.timers.push_back({ when, handle, affinity });
+        std::push_heap(pipeline.timers.begin(), pipeline.timers.end(), Pipeline_TimerLater);
+        pipeline.wake.notify_all();
+    }
+
+    void
+    await_resume() const noexcept
+    {
+    }
+};
+
+
+// co_await Pipeline_Switch(pipeline, affinity) carries on straight away, on
+// a thread of the given affinity.
+struct Pipeline_Switch
+{
+    Frame_Pipeline&   pipeline;
+    Pipeline_Affinity affinity;
+
+    bool
+    await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void
+    await_suspend(std::coroutine_handle<> handle)
+    {
+        Pipeline_Schedule(pipeline, handle, affinity);
+    }
+
+    void
+    await_resume() const noexcept
+    {
+    }
+};
+
+
+// n_threads workers serve Pipeline_Any stages. The calling thread is not one
+// of them; it serves Pipeline_Main stages from Pipeline_RunMain.
+void
+Pipeline_Init(Frame_Pipeline& pipeline, int n_threads)
+{
+    for (int i = 0; i < n_threads; ++i)
+    {
+        pipeline.threads.emplace_back([&pipeline] { Pipeline_Serve(pipeline, Pipeline_Any); });
+    }
+}
+
+
+// Takes ownership of a stage and starts it on a thread of the given
+// affinity.
+void
+Pipeline_Start(Frame_Pipeline& pipeline, Stage_Task stage, Pipeline_Affinity affinity)
+{
+    auto handle = stage.handle;
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.stages.push_back(std::move(stage));
+    }
+    Pipeline_Schedule(pipeline, handle, affinity);
+}
+
+
+// Serves Pipeline_Main stages on the calling thread until Pipeline_Quit.
+void
+Pipeline_RunMain(Frame_Pipeline& pipeline)
+{
+    Pipeline_Serve(pipeline, Pipeline_Main);
+}
+
+
+// Safe from any stage. Stages finish the step they are in and are not
+// resumed again.
+void
+Pipeline_Quit(Frame_Pipeline& pipeline)
+{
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.quit = true;
+    pipeline.wake.notify_all();
+}
+
+
+// Stops the workers and destroys every stage where it is suspended.
+void
+Pipeline_Free(Frame_Pipeline& pipeline)
+{
+    Pipeline_Quit(pipeline);
+    for (auto& thread : pipeline.threads)
+    {
+        thread.join();
+    }
+    pipeline.threads.clear();
+
+    pipeline.timers.clear();
+    for (auto& ready : pipeline.ready)
+    {
+        ready.clear();
+    }
+    pipeline.stages.clear();
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <vector>
+
+
+// Stable references to particles. A particle's index changes whenever the
+// array backfills a hole or reorders, so gameplay code that wants to follow
+// one particle (a light, a sound, an attachment) holds a handle instead: a
+// slot in the emitter's table, which tracks the particle's current index,
+// plus the slot's generation. Releasing a slot bumps its generation, so a
+// handle to a dead particle stops resolving, even after the slot is reused.
+
+constexpr uint32 Handle_None = ~0u;
+
+struct Particle_Handle
+{
+    uint32 slot { Handle_None };
+    uint32 generation { 0 };
+};
+
+
+struct Handle_Table
+{
+    // Per slot.
+    std::vector<uint32> index;
+    std::vector<uint32> generation;
+
+    std::vector<uint32> free_slots;
+};
+
+
+// Takes a slot for the particle at index. Slots are reused before the table
+// grows, so it never holds more than the emitter's peak particle count.
+uint32
+Handle_Acquire(Handle_Table& table, uint32 index)
+{
+    uint32 slot;
+    if (table.free_slots.empty())
+    {
+        slot = static_cast<uint32>(table.index.size());
+        table.index.push_back(index);
+        table.generation.push_back(0);
+        return slot;
+    }
+    slot = table.free_slots.back();
+    table.free_slots.pop_back();
+    table.index[slot] = index;
+    return slot;
+}
+
+
+// Every handle to the slot goes stale.
+void
+Handle_Release(Handle_Table& table, uint32 slot)
+{
+    if (slot != Handle_None)
+    {
+        table.index[slot] = Handle_None;
+        table.generation[slot] += 1;
+        table.free_slots.push_back(slot);
+    }
+}
+
+
+// The particle holding slot is now at index.
+void
+Handle_Move(Handle_Table& table, uint32 slot, uint32 index)
+{
+    if (slot != Handle_None)
+    {
+        table.index[slot] = index;
+    }
+}
+
+
+Particle_Handle
+Handle_Of(Handle_Table const& table, uint32 slot)
+{
+    if (slot == Handle_None)
+    {
+        return {};
+    }
+    return { slot, table.generation[slot] };
+}
+
+
+// Index of the handle's particle, or Handle_None once it has died.
+uint32
+Handle_Resolve(Handle_Table const& table, Particle_Handle handle)
+{
+    if (handle.slot >= table.index.size() || table.generation[handle.slot] != handle.generation)
+    {
+        return Handle_None;
+    }
+    return table.index[handle.slot];
+}
@@ -0,0 +1,297 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/effect.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+// Hot reload of effect source files. A watcher thread recompiles the file
+// whenever it is saved and hands the result to the simulation thread through
+// a single atomic pointer. Between ticks the simulation takes whatever is
+// waiting and patches emitter parameters in place; live particles and pools
+// are left alone.
+//
+//     HotReload reload;
+//     HotReload_Start(reload, "effects/sparks.pfx");
+//     ...
+//     if (auto* library = HotReload_Take(reload))
+//     {
+//         Effect_Patch(emitter, *library);
+//     }
+//     Emitter_Integrate(emitter, dt);
+
+struct HotReload_Blob
+{
+    std::vector<uint8> binary;
+    Effect_Library     library;
+};
+
+struct HotReload
+{
+    std::string path;
+
+    // Written by the watcher, taken by the simulation. A non-null value the
+    // watcher replaces was never seen by the simulation, so the watcher may
+    // free it.
+    std::atomic<HotReload_Blob*> pending { nullptr };
+
+    // Owned by the simulation thread. Kept alive because Effect_Library is a
+    // view into it.
+    std::unique_ptr<HotReload_Blob> current;
+
+    std::atomic<bool> running { false };
+    std::thread       watcher;
+
+    // Told about files that fail to read or compile once watching, on the
+    // watcher thread. Errors are dropped when null.
+    void (*on_error)(void* user, char const* message) { nullptr };
+    void* on_error_user { nullptr };
+};
+
+
+// Reads and compiles the source. Returns nullptr, keeping the last good
+// effects live, if the file has errors, and says why in error.
+HotReload_Blob*
+HotReload_Compile(std::string const& path, std::string* error = nullptr)
+{
+    std::vector<uint8> source;
+    if (!Effect_ReadFile(path.c_str(), source))
+    {
+        if (error)
+        {
+            *error = path + ": can't read";
+        }
+        return nullptr;
+    }
+    source.push_back('\0');
+
+    auto*       blob = new HotReload_Blob;
+    std::string message;
+    if (!Effect_Compile(reinterpret_cast<char const*>(source.data()), blob->binary, &message)
+        || !Effect_Load(blob->library, blob->binary.data(), blob->binary.size()))
+    {
+        if (error)
+        {
+            *error = path + ": " + (message.empty() ? "bad compiled effects" : message);
+        }
+        delete blob;
+        return nullptr;
+    }
+    return blob;
+}
+
+
+void
+HotReload_Publish(HotReload& reload, HotReload_Blob* blob)
+{
+    if (!blob)
+    {
+        return;
+    }
+    delete reload.pending.exchange(blob, std::memory_order_acq_rel);
+}
+
+
+void
+HotReload_Error(HotReload& reload, std::string const& message)
+{
+    if (reload.on_error)
+    {
+        reload.on_error(reload.on_error_user, message.c_str());
+    }
+}
+
+
+// Watcher thread.
+void
+HotReload_Recompile(HotReload& reload)
+{
+    std::string error;
+    auto*       blob = HotReload_Compile(reload.path, &error);
+    if (!blob)
+    {
+        HotReload_Error(reload, error);
+        return;
+    }
+    HotReload_Publish(reload, blob);
+}
+
+
+#if defined(__linux__)
+
+void
+HotReload_Watch(HotReload& reload)
+{
+    // Watch the directory rather than the file. Editors often save by
+    // writing a temporary and renaming it over the original, which would
+    // orphan a watch on the file itself.
+    auto slash = reload.path.find_last_of('/');
+    auto dir   = (slash == std::string::npos) ? std::string(".") : reload.path.substr(0, slash);
+    auto name  = (slash == std::string::npos) ? reload.path : reload.path.substr(slash + 1);
+
+    int fd = inotify_init1(IN_NONBLOCK);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        HotReload_Error(reload, dir + ": can't watch");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    while (reload.running.load(std::memory_order_relaxed))
+    {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0)
+        {
+            continue;
+        }
+
+        bool changed = false;
+        auto n       = read(fd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < n;)
+        {
+            auto* event = reinterpret_cast<inotify_event*>(buffer + i);
+            if (event->len && name == event->name)
+            {
+                changed = true;
+            }
+            i += sizeof(inotify_event) + event->len;
+        }
+
+        if (changed)
+        {
+            HotReload_Recompile(reload);
+        }
+    }
+    close(fd);
+}
+
+#else
+
+void
+HotReload_Watch(HotReload& reload)
+{
+    // No inotify, fall back to polling the modification time.
+    struct stat info;
+    auto        last = (stat(reload.path.c_str(), &info) == 0) ? info.st_mtime : 0;
+    while (reload.running.load(std::memory_order_relaxed))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        if (stat(reload.path.c_str(), &info) == 0 && info.st_mtime != last)
+        {
+            last = info.st_mtime;
+            HotReload_Recompile(reload);
+        }
+    }
+}
+
+#endif
+
+
+// Compiles the file once up front so the effects are available on the first
+// tick, then starts watching. Fails, saying why in error, if the file can't
+// be compiled; later failures go to on_error.
+bool
+HotReload_Start(HotReload& reload, char const* path, std::string* error = nullptr)
+{
+    reload.path = path;
+
+    auto* blob = HotReload_Compile(reload.path, error);
+    if (!blob)
+    {
+        return false;
+    }
+    HotReload_Publish(reload, blob);
+
+    reload.running = true;
+    reload.watcher = std::thread([&reload] { HotReload_Watch(reload); });
+    return true;
+}
+
+
+void
+HotReload_Stop(HotReload& reload)
+{
+    reload.running = false;
+    if (reload.watcher.joinable())
+    {
+        reload.watcher.join();
+    }
+    delete reload.pending.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+
+// Simulation thread, between ticks. Returns the new effects if the file
+// changed since the last call, otherwise nullptr. The library stays valid
+// until the next call that returns non-null.
+Effect_Library const*
+HotReload_Take(HotReload& reload)
+{
+    auto* blob = reload.pending.exchange(nullptr, std::memory_order_acq_rel);
+    if (!blob)
+    {
+        return nullptr;
+    }
+    reload.current.reset(blob);
+    return &blob->library;
+}
+
+
+// Patches an emitter's parameters from the reloaded effect it was built
+// from. An effect whose feature set changed needs different storage and
+// can't be patched in place; those return false and keep running unchanged.
+template <uint32 Features, size_t Capacity>
+bool
+Effect_Patch(Emitter_Of<Features, Capacity>& emitter, Effect_Library const& library)
+{
+    auto* def = Effect_Find(library, emitter.effect_hash);
+    if (!def || def->features != Features)
+    {
+        return false;
+    }
+    Effect_Apply(emitter, *def);
+    return true;
+}
+
+
+// As above, for every emitter in the system built from an effect. Returns
+// false if any of them couldn't be patched.
+template <uint32 Features>
+bool
+Effect_Patch(ParticleSystem_Of<Features>& system, Effect_Library const& library)
+{
+    bool patched = true;
+    for (auto& emitter : system.emitters)
+    {
+        if (!emitter.alive || !emitter.effect_hash)
+        {
+            continue;
+        }
+        auto* def = Effect_Find(library, emitter.effect_hash);
+        if (!def || def->features != Features)
+        {
+            patched = false;
+            continue;
+        }
+        emitter.rate   = def->rate;
+        emitter.params = Effect_Params(*def, emitter.params);
+    }
+    return patched;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/bounds.h"
+#include <vector>
+
+
+// Particles in Z-order. Removal backfills holes from the end, so after a
+// while an emitter's particles sit in memory in no particular order in
+// space, and every spatial pass (collision, neighbours, depth sort) hops
+// around the array. Sorting by the Morton code of each position, inside the
+// emitter's bounds, puts particles that are near each other near each other
+// in memory.
+//
+// The sort is spread over ticks. Each tick sorts a few windows of the array
+// in place, and successive windows overlap by half, so particles drift
+// towards their place a window at a time; a few sweeps get the array
+// sorted, and after that each tick only repairs what motion disturbed.
+
+struct Morton_Reorder
+{
+    uint32 budget { 0 };   // Particles to sort a tick. Zero leaves the order alone.
+    uint32 window { 256 }; // Particles sorted together.
+    size_t cursor { 0 };   // Start of the next window.
+    uint32 sorted { 0 };   // Particles sorted by the last tick.
+
+    // Scratch, kept between ticks so steady state sorts don't allocate.
+    std::vector<uint32> codes;
+    std::vector<uint32> order;
+    std::vector<uint32> slot_of;
+    std::vector<uint32> item_at;
+};
+
+
+// Spreads the low 10 bits of v out to every third bit.
+uint32
+Morton_Spread(uint32 v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+
+// 30 bit code from three 10 bit cell coordinates, x in the lowest bit.
+uint32
+Morton_Encode(uint32 x, uint32 y, uint32 z)
+{
+    return Morton_Spread(x) | (Morton_Spread(y) << 1) | (Morton_Spread(z) << 2);
+}
+
+
+// Codes for n positions, on a 1024^3 grid over box. Positions outside the
+// box are clamped to its edge.
+void
+Morton_Codes(Bounds_Box const& box, float const* x, float const* y, float const* z, uint32* codes, size_t n)
+{
+    float sx = 1023.0f / ((box.max.x > box.min.x) ? box.max.x - box.min.x : 1.0f);
+    float sy = 1023.0f / ((box.max.y > box.min.y) ? box.max.y - box.min.y : 1.0f);
+    float sz = 1023.0f / ((box.max.z > box.min.z) ? box.max.z - box.min.z : 1.0f);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        float fx = (x[i] - box.min.x) * sx;
+        float fy = (y[i] - box.min.y) * sy;
+        float fz = (z[i] - box.min.z) * sz;
+        fx       = (fx < 0.0f) ? 0.0f : ((fx > 1023.0f) ? 1023.0f : fx);
+        fy       = (fy < 0.0f) ? 0.0f : ((fy > 1023.0f) ? 1023.0f : fy);
+        fz       = (fz < 0.0f) ? 0.0f : ((fz > 1023.0f) ? 1023.0f : fz);
+        codes[i] = Morton_Encode(static_cast<uint32>(fx), static_cast<uint32>(fy), static_cast<uint32>(fz));
+    }
+}
+
+
+// Sorts order[0, n) by codes, ties by index. Insertion sort: after the first
+// few sweeps a window is nearly sorted already.
+void
+Morton_SortOrder(uint32 const* codes, uint32* order, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        order[i] = static_cast<uint32>(i);
+    }
+    for (size_t i = 1; i < n; ++i)
+    {
+        uint32 item = order[i];
+        size_t j    = i;
+        while (j > 0 && codes[order[j - 1]] > codes[item])
+        {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = item;
+    }
+}
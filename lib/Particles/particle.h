@@ -2,35 +2,261 @@
 #include "Base/containers/backfill_vector.hpp"
 #include "Base/typedefs.h"
 #include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/atlas.h"
+#include "Particles/bounds.h"
+#include "Particles/budget.h"
+#include "Particles/curves.h"
+#include "Particles/events.h"
+#include "Particles/handle.h"
+#include "Particles/morton.h"
+#include "Particles/random.h"
+#include "Particles/spawn_shapes.h"
+#include "Particles/trail.h"
 #include <SDL2/SDL.h>
+#include <math.h>
 #include <stdlib.h>
+#include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// Where there is one, there are many.
-struct Particle
+
+// Channels a particle can carry on top of its position, velocity and
+// lifetime. Effects only pay for (store and integrate) what they enable.
+enum Particle_Feature : uint32
+{
+    Particle_Feature_Acceleration = 1u << 0,
+    Particle_Feature_Rotation     = 1u << 1,
+    Particle_Feature_Size         = 1u << 2,
+    Particle_Feature_Color        = 1u << 3,
+    Particle_Feature_Trail        = 1u << 4,
+    Particle_Feature_Handle       = 1u << 5,
+};
+
+constexpr uint32 Particle_Features_Default = Particle_Feature_Acceleration
+                                             | Particle_Feature_Rotation
+                                             | Particle_Feature_Size;
+constexpr uint32 Particle_Features_Spark = Particle_Feature_Color;
+
+
+constexpr bool
+Particle_Has(uint32 features, uint32 feature)
+{
+    return (features & feature) == feature;
+}
+
+
+struct Particle_Color
+{
+    uint8 r, g, b, a;
+};
+
+
+// NOTE(DW): Each channel is an empty base when disabled, so the empty base
+// optimisation strips it from the particle entirely.
+template <bool Enabled>
+struct Particle_AccelerationChannel
+{
+};
+
+template <>
+struct Particle_AccelerationChannel<true>
+{
+    Vec acc;
+};
+
+template <bool Enabled>
+struct Particle_RotationChannel
+{
+};
+
+template <>
+struct Particle_RotationChannel<true>
 {
-    Vec     acc;
-    Vec     vel;
-    Vec     pos;
     Vec     theta;
     Vec     omega;
     Vec     alpha;
     Matrix4 rot_mat;
-    float   lifetime_sec;
-    float   duration_sec;
-    float   size;
+};
+
+template <bool Enabled>
+struct Particle_SizeChannel
+{
+};
+
+template <>
+struct Particle_SizeChannel<true>
+{
+    float size;
+};
+
+template <bool Enabled>
+struct Particle_ColorChannel
+{
+};
+
+template <>
+struct Particle_ColorChannel<true>
+{
+    Particle_Color color;
+};
+
+
+template <bool Enabled>
+struct Particle_TrailChannel
+{
+};
+
+// The history itself lives in the emitter's Trail_Pool.
+template <>
+struct Particle_TrailChannel<true>
+{
+    uint32 trail_slot;
+};
+
+
+template <bool Enabled>
+struct Particle_HandleChannel
+{
+};
+
+// The particle's slot in the emitter's Handle_Table.
+template <>
+struct Particle_HandleChannel<true>
+{
+    uint32 handle_slot;
+};
+
+
+// Where there is one, there are many.
+template <uint32 Features>
+struct Particle_Of
+    : Particle_AccelerationChannel<Particle_Has(Features, Particle_Feature_Acceleration)>
+    , Particle_RotationChannel<Particle_Has(Features, Particle_Feature_Rotation)>
+    , Particle_SizeChannel<Particle_Has(Features, Particle_Feature_Size)>
+    , Particle_ColorChannel<Particle_Has(Features, Particle_Feature_Color)>
+    , Particle_TrailChannel<Particle_Has(Features, Particle_Feature_Trail)>
+    , Particle_HandleChannel<Particle_Has(Features, Particle_Feature_Handle)>
+{
+    static constexpr uint32 features = Features;
+
+    Vec   vel;
+    Vec   pos;
+    float lifetime_sec;
+    float duration_sec;
+};
+
+using Particle = Particle_Of<Particle_Features_Default>;
+
+
+// How an emitter spawns and moves its particles. The defaults reproduce the
+// original hardcoded fountain.
+struct Emitter_Params
+{
+    Spawn_Desc spawn;
+
+    // Spawn velocity, rotated about e13 by a random angle in
+    // [-spread, spread), plus speed along the shape's direction.
+    Vec   velocity { 5.f, 10.f, 0.f };
+    int32 spread_deg { 180 };
+    float speed { 0.0f };
+
+    // Each axis of omega is random in [-spin, spin).
+    int32 spin_deg { 180 };
+
+    float lifetime_sec { 5.0f };
+    float lifetime_jitter_sec { 0.0f };
+    float size { 20.0f };
+
+    // Affectors.
+    Vec   gravity { 0.f, -9.81f, 0.f };
+    float drag { 0.0f }; // Fraction of velocity lost per second.
+
+    // Particles that would move more than a cell in one tick are integrated
+    // in sub-steps, up to max_substeps, so they don't tunnel through what
+    // they should hit. Zero steps everything once.
+    float substep_cell { 0.0f };
+    int32 max_substeps { 8 };
+};
+
+Emitter_Params const Emitter_Params_Default {};
+
+
+// How an emitter's particles are drawn. Most effects are small enough that a
+// camera facing quad reads the same as a cube at a ninth of the vertices.
+enum Render_Mode : uint32
+{
+    Render_Mode_Cube,
+    Render_Mode_Billboard,
 };
 
 
-struct Emitter
+template <uint32 Features, size_t Capacity = 40>
+struct Emitter_Of
 {
-    backfill_vector<Particle, 40> particles;
+    using Particle_Type = Particle_Of<Features>;
+
+    static constexpr uint32 features = Features;
+
+    backfill_vector<Particle_Type, Capacity> particles;
 
     // TODO(DW): A count down timer would be nice.
     float rate { 0.5f };
     float timer { 0.5f };
+    bool  paused { false };
+
+    // Optional budget shared with other emitters. The quota applies either
+    // way, along with Capacity.
+    Particle_Budget* budget { nullptr };
+    Budget_Quota     quota;
+
+    // All randomness comes from here, see Emitter_Seed.
+    Random rng;
+
+    Emitter_Params params;
+    uint32         effect_hash { 0 }; // Effect the params came from, if any.
+
+    // Optional over-lifetime curves, shared between emitters of one effect.
+    Emitter_Curves const* curves { nullptr };
+
+    // History for Particle_Feature_Trail. Particles spawned while this is
+    // null or exhausted have no trail. The pool may be shared; trail_sec is
+    // this emitter's time since it last recorded.
+    Trail_Pool* trails { nullptr };
+    float       trail_sec { 0.0f };
+
+    // Lifecycle events are appended here when set. event_age is the
+    // normalised age that raises Particle_Event_Age, negative for never.
+    Event_Buffer* events { nullptr };
+    uint32        event_id { 0 };
+    float         event_age { -1.0f };
+
+    Render_Mode     render_mode { Render_Mode_Cube };
+    Flipbook const* flipbook { nullptr }; // Billboard sprite, untextured when null.
+
+    // Kept by Emitter_Integrate and spawning. Code that moves particles by
+    // hand should call Emitter_MeasureBounds after.
+    Emitter_Bounds bounds;
+
+    // Spatial reordering of particles, off unless given a budget.
+    Morton_Reorder reorder;
+
+    // Where each Particle_Feature_Handle particle is, see Emitter_Find.
+    Handle_Table handles;
+
+    // Scratch for compaction, kept between ticks so it doesn't allocate.
+    std::vector<size_t> dead;
+
+    // Scratch for the batched backends: each particle's age before the tick,
+    // for age events, and bounds a worker.
+    std::vector<float>          ages;
+    std::vector<Bounds_Partial> worker_bounds;
 };
 
+using Emitter       = Emitter_Of<Particle_Features_Default>;
+using Spark_Emitter = Emitter_Of<Particle_Features_Spark>;
+
 enum class Property_Tag
 {
     Float,
@@ -64,8 +290,9 @@ struct Property
 };
 
 
+template <uint32 Features, size_t Capacity>
 std::vector<Property>
-Emitter_Properties(Emitter& emitter)
+Emitter_Properties(Emitter_Of<Features, Capacity>& emitter)
 {
     std::vector<Property> properties;
 
@@ -96,28 +323,114 @@ Emitter_Properties(Emitter& emitter)
 }
 
 
+template <uint32 Features>
 void
-Particle_Init(Particle& particle)
+Particle_Init(Particle_Of<Features>& particle)
 {
     particle.pos = Vec { 0.0f, 0.0f, 0.f };
     // particle.vel = Vec { 5.f, 10.f, 0.f };
     particle.vel = Vec { 0.f, 0.f, 0.f };
-    particle.acc = Vec { 0.f, 0.f, 0.f };
 
-    // NOTE(DW): Remember there's a double integration. So you need to add
-    // some multiple of 60.0f (the FPS), to achieve the desired rad/sec.
-    particle.theta = Vec { 0.0f, 0.0f, 0.f };
-    particle.omega = Vec { 0.0f, 0.0f, 0.f };
-    particle.alpha = Vec { 0.0f, 0.0f, 0.0f };
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        particle.acc = Vec { 0.f, 0.f, 0.f };
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        // NOTE(DW): Remember there's a double integration. So you need to add
+        // some multiple of 60.0f (the FPS), to achieve the desired rad/sec.
+        particle.theta = Vec { 0.0f, 0.0f, 0.f };
+        particle.omega = Vec { 0.0f, 0.0f, 0.f };
+        particle.alpha = Vec { 0.0f, 0.0f, 0.0f };
+    }
 
     particle.lifetime_sec = 5.0f;
     particle.duration_sec = 5.0f;
-    particle.size         = 20.0f;
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        particle.size = 20.0f;
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Color))
+    {
+        particle.color = Particle_Color { 255, 0, 0, 255 };
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Trail))
+    {
+        particle.trail_slot = Trail_None;
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Handle))
+    {
+        particle.handle_slot = Handle_None;
+    }
 }
 
 
+// Gravity, drag and position over time_sec. Ageing and rotation are left to
+// the caller.
+template <uint32 Features>
 void
-Particle_Integrate(Particle& particle, float time_sec)
+Particle_IntegrateMotion(Particle_Of<Features>& particle, float time_sec, Emitter_Params const& params)
+{
+    auto t  = time_sec;
+    auto kg = 1.0f;
+    // auto m  = 1.0f / kg;
+    auto g = params.gravity;
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        particle.acc += ((g * kg) * t);
+        particle.vel += particle.acc * t;
+    }
+    else
+    {
+        // NOTE(DW): Without an acceleration channel gravity acts directly on
+        // the velocity.
+        particle.vel += ((g * kg) * t);
+    }
+    if (params.drag > 0.0f)
+    {
+        float keep   = 1.0f - params.drag * t;
+        particle.vel = particle.vel * ((keep < 0.0f) ? 0.0f : keep);
+    }
+    particle.pos += particle.vel * t;
+}
+
+
+// Once a tick, however many sub-steps the motion took.
+template <uint32 Features>
+void
+Particle_IntegrateRotation(Particle_Of<Features>& particle)
+{
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        particle.theta.x += particle.omega.x / 60.0f;
+        particle.theta.y += particle.omega.y / 60.0f;
+        particle.theta.z += particle.omega.z / 60.0f;
+
+        // float theta_e12 = particle.omega.x;
+        // float theta_e13 = particle.omega.y;
+        // float theta_e23 = particle.omega.z;
+        float theta_e12 = particle.theta.x;
+        float theta_e13 = particle.theta.y;
+        float theta_e23 = particle.theta.z;
+
+        auto R = RotorFromEuler(theta_e13, theta_e23, theta_e12);
+
+        particle.rot_mat = ToMatrix4(R);
+    }
+}
+
+
+template <uint32 Features>
+void
+Particle_Integrate(Particle_Of<Features>& particle,
+                   float                  time_sec,
+                   Emitter_Params const&  params = Emitter_Params_Default)
 {
     particle.lifetime_sec -= time_sec;
     if (particle.lifetime_sec < 0)
@@ -125,81 +438,803 @@ Particle_Integrate(Particle& particle, float time_sec)
         return;
     }
 
-    auto t  = time_sec;
-    auto kg = 1.0f;
-    // auto m  = 1.0f / kg;
-    auto g = Vec { 0.f, -9.81f, 0.f };
+    Particle_IntegrateMotion(particle, time_sec, params);
+    Particle_IntegrateRotation(particle);
+}
 
-    particle.acc += ((g * kg) * t);
-    particle.vel += particle.acc * t;
-    particle.pos += particle.vel * t;
 
-    particle.theta.x += particle.omega.x / 60.0f;
-    particle.theta.y += particle.omega.y / 60.0f;
-    particle.theta.z += particle.omega.z / 60.0f;
+// As Particle_Integrate, with the motion taken in steps equal parts.
+template <uint32 Features>
+void
+Particle_IntegrateSubsteps(Particle_Of<Features>& particle,
+                           float                  time_sec,
+                           int                    steps,
+                           Emitter_Params const&  params)
+{
+    particle.lifetime_sec -= time_sec;
+    if (particle.lifetime_sec < 0)
+    {
+        return;
+    }
+
+    float dt = time_sec / steps;
+    for (int step = 0; step < steps; ++step)
+    {
+        Particle_IntegrateMotion(particle, dt, params);
+    }
+    Particle_IntegrateRotation(particle);
+}
 
-    // float theta_e12 = particle.omega.x;
-    // float theta_e13 = particle.omega.y;
-    // float theta_e23 = particle.omega.z;
-    float theta_e12 = particle.theta.x;
-    float theta_e13 = particle.theta.y;
-    float theta_e23 = particle.theta.z;
 
-    auto R = RotorFromEuler(theta_e13, theta_e23, theta_e12);
+// Sub-steps needed for a particle at speed to move at most a cell per step.
+// Gravity's pull over the tick is added to the speed, so a particle falling
+// from rest is covered too. One when sub-stepping is off.
+int
+Particle_SubstepCount(float speed, float time_sec, Emitter_Params const& params)
+{
+    if (params.substep_cell <= 0.0f)
+    {
+        return 1;
+    }
 
-    particle.rot_mat = ToMatrix4(R);
+    auto& g     = params.gravity;
+    float pull  = sqrtf(g.x * g.x + g.y * g.y + g.z * g.z) * time_sec;
+    float cells = (speed + pull) * time_sec / params.substep_cell;
+    int   steps = static_cast<int>(ceilf(cells));
+    int   limit = (params.max_substeps > 1) ? params.max_substeps : 1;
+    return (steps < 1) ? 1 : ((steps > limit) ? limit : steps);
 }
 
 
-void
-Emitter_Init(Emitter& emitter)
+// Largest of n squared speeds, four at a time where SSE is available.
+float
+Particle_MaxSpeedSquared(float const* speed2, size_t n)
 {
+    float  m = 0.0f;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    auto m4 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+    {
+        m4 = _mm_max_ps(m4, _mm_loadu_ps(speed2 + i));
+    }
+    m4 = _mm_max_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(1, 0, 3, 2)));
+    m4 = _mm_max_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(2, 3, 0, 1)));
+    m  = _mm_cvtss_f32(m4);
+#endif
+
+    for (; i < n; ++i)
+    {
+        m = (speed2[i] > m) ? speed2[i] : m;
+    }
+    return m;
 }
 
 
+// Counts down the spawn timer and returns how many particles are due. A
+// large time_sec (a throttled or catching up emitter) can owe several.
+int
+Emitter_SpawnCount(float& timer, float rate, bool paused, float time_sec)
+{
+    if (paused || rate <= 0.0f)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    timer -= time_sec;
+    while (timer < 0.0f)
+    {
+        timer += rate;
+        count += 1;
+    }
+    return count;
+}
+
+
+// Initialises a freshly allocated particle from the emitter's parameters,
+// at a position and direction already sampled from the spawn shape.
+template <uint32 Features>
 void
-Emitter_Integrate(Emitter& emitter, float time_sec)
+Particle_SpawnAt(Particle_Of<Features>& particle,
+                 Random&                rng,
+                 Emitter_Params const&  params,
+                 Vec                    pos,
+                 Vec                    dir)
 {
-    emitter.timer -= time_sec;
-    if (emitter.timer < 0.0f)
+    Particle_Init(particle);
+
+    particle.pos = pos;
+
+    // A zero range means no jitter, and draws nothing from rng.
+    auto jitter = [&rng](int32 range) {
+        return (range > 0) ? Random_Int(rng, 2 * range) - range : 0;
+    };
+
+    auto deg = jitter(params.spread_deg);
+    auto rad = deg * M_PI / 180.0f;
+    auto R   = RotorFromEuler(rad, 0, 0);
+
+    auto u = params.velocity;
+    u      = Vec_Rotate(R, u);
+    if (params.speed != 0.0f)
     {
-        emitter.timer = emitter.rate;
-        emitter.particles.allocate();
-        auto& particle = emitter.particles.back();
-        Particle_Init(particle);
+        u += dir * params.speed;
+    }
+    particle.vel = u;
 
-        auto deg = rand() % 360 - 180;
-        auto rad = deg * M_PI / 180.0f;
-        auto R   = RotorFromEuler(rad, 0, 0);
+    particle.lifetime_sec = params.lifetime_sec;
+    if (params.lifetime_jitter_sec > 0.0f)
+    {
+        particle.lifetime_sec += params.lifetime_jitter_sec * (2.0f * Random_Float(rng) - 1.0f);
+    }
+    particle.duration_sec = particle.lifetime_sec;
 
-        auto u       = Vec { 5.f, 10.f, 0.f };
-        u            = Vec_Rotate(R, u);
-        particle.vel = u;
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        particle.size = params.size;
+    }
 
-        auto  d1       = rand() % 360 - 180;
-        auto  d2       = rand() % 360 - 180;
-        auto  d3       = rand() % 360 - 180;
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        auto  d1       = jitter(params.spin_deg);
+        auto  d2       = jitter(params.spin_deg);
+        auto  d3       = jitter(params.spin_deg);
         float r1       = d1 * M_PI / 180.0f;
         float r2       = d2 * M_PI / 180.0f;
         float r3       = d3 * M_PI / 180.0f;
         particle.omega = Vec { r1, r2, r3 };
     }
+}
+
+
+template <uint32 Features>
+void
+Particle_Spawn(Particle_Of<Features>& particle,
+               Random&                rng,
+               Emitter_Params const&  params = Emitter_Params_Default)
+{
+    Vec pos, dir;
+    Spawn_Sample(params.spawn, rng, 1, &pos, &dir);
+    Particle_SpawnAt(particle, rng, params, pos, dir);
+}
 
-    for (auto& particle : emitter.particles)
+
+// Samples the baked curves for every live particle, a batch of 64 at a time.
+// Ages are gathered into a flat array first so each channel is a straight,
+// vectorisable LUT pass.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_ApplyCurves(Emitter_Of<Features, Capacity>& emitter,
+                    Emitter_Curves const&          curves,
+                    float                          time_sec)
+{
+    constexpr size_t Batch = 64;
+
+    float ages[Batch];
+    float values[Batch];
+
+    auto& particles = emitter.particles;
+    for (size_t begin = 0; begin < particles.size(); begin += Batch)
     {
-        Particle_Integrate(particle, time_sec);
+        size_t count = (particles.size() - begin < Batch) ? particles.size() - begin : Batch;
+        auto*  batch = &particles[begin];
+        for (size_t i = 0; i < count; ++i)
+        {
+            ages[i] = 1.0f - batch[i].lifetime_sec / batch[i].duration_sec;
+        }
+
+        if constexpr (Particle_Has(Features, Particle_Feature_Size))
+        {
+            if (curves.channels & Curve_Channel_Size)
+            {
+                Curve_SampleBatch(curves.size, ages, values, count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    batch[i].size = values[i];
+                }
+            }
+        }
+
+        if constexpr (Particle_Has(Features, Particle_Feature_Color))
+        {
+            if (curves.channels & Curve_Channel_Color)
+            {
+                Curve_LUT const* luts[4] = { &curves.r, &curves.g, &curves.b, &curves.a };
+                for (int c = 0; c < 4; ++c)
+                {
+                    Curve_SampleBatch(*luts[c], ages, values, count);
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        (&batch[i].color.r)[c] = Curve_ToByte(values[i]);
+                    }
+                }
+            }
+        }
+
+        if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+        {
+            if (curves.channels & Curve_Channel_AngularDamping)
+            {
+                Curve_SampleBatch(curves.angular_damping, ages, values, count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    float keep = 1.0f - values[i] * time_sec;
+                    keep       = (keep < 0.0f) ? 0.0f : keep;
+
+                    batch[i].omega = batch[i].omega * keep;
+                }
+            }
+        }
     }
+}
 
-    std::vector<size_t> to_remove;
-    for (size_t i = 0; i < emitter.particles.size(); ++i)
+
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Init(Emitter_Of<Features, Capacity>& emitter)
+{
+}
+
+
+// Takes in a particle that is new, or has moved, since the last measure.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_GrowBounds(Emitter_Of<Features, Capacity>& emitter, Particle_Of<Features> const& particle)
+{
+    auto& bounds = emitter.bounds;
+    auto& vel    = particle.vel;
+    float speed  = sqrtf(vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
+    Bounds_Add(bounds.box, particle.pos);
+    bounds.max_speed = (speed > bounds.max_speed) ? speed : bounds.max_speed;
+}
+
+
+// Gives the new particle at index i a handle slot, when particles have them.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_AcquireHandle(Emitter_Of<Features, Capacity>& emitter, size_t i)
+{
+    if constexpr (Particle_Has(Features, Particle_Feature_Handle))
+    {
+        emitter.particles[i].handle_slot = Handle_Acquire(emitter.handles, static_cast<uint32>(i));
+    }
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+Emitter_ReleaseHandle(Emitter_Of<Features, Capacity>& emitter, Particle_Of<Features>& particle)
+{
+    if constexpr (Particle_Has(Features, Particle_Feature_Handle))
+    {
+        Handle_Release(emitter.handles, particle.handle_slot);
+        particle.handle_slot = Handle_None;
+    }
+}
+
+
+// A handle to the particle at index i, good until the particle dies.
+template <uint32 Features, size_t Capacity>
+Particle_Handle
+Emitter_Handle(Emitter_Of<Features, Capacity> const& emitter, size_t i)
+{
+    static_assert(Particle_Has(Features, Particle_Feature_Handle), "emitter has no handles");
+    return Handle_Of(emitter.handles, emitter.particles[i].handle_slot);
+}
+
+
+// The handle's particle, wherever it has moved to, or null once it has died
+// or been recycled.
+template <uint32 Features, size_t Capacity>
+Particle_Of<Features>*
+Emitter_Find(Emitter_Of<Features, Capacity>& emitter, Particle_Handle handle)
+{
+    static_assert(Particle_Has(Features, Particle_Feature_Handle), "emitter has no handles");
+    uint32 index = Handle_Resolve(emitter.handles, handle);
+    return (index == Handle_None) ? nullptr : &emitter.particles[index];
+}
+
+
+// Moves particles spawned away from the emitter's origin and adds to their
+// velocity, for sub-emitters spawning at their parent's events.
+struct Spawn_Offset
+{
+    Vec pos;
+    Vec vel;
+};
+
+
+template <typename Particle_Type>
+void
+Particle_ApplyOffset(Particle_Type& particle, Spawn_Offset const* offset)
+{
+    if (offset)
+    {
+        particle.pos += offset->pos;
+        particle.vel += offset->vel;
+    }
+}
+
+
+// Respawns the oldest particle in place, for Budget_Policy_RecycleOldest.
+// It counts as a new particle, so handles to the old one go stale.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_RecycleOldest(Emitter_Of<Features, Capacity>& emitter, Spawn_Offset const* offset = nullptr)
+{
+    auto&  particles = emitter.particles;
+    size_t oldest    = 0;
+    float  most      = -1.0f;
+    for (size_t i = 0; i < particles.size(); ++i)
+    {
+        float elapsed = particles[i].duration_sec - particles[i].lifetime_sec;
+        if (elapsed > most)
+        {
+            oldest = i;
+            most   = elapsed;
+        }
+    }
+
+    auto& particle = particles[oldest];
+    if constexpr (Particle_Has(Features, Particle_Feature_Trail))
+    {
+        if (emitter.trails)
+        {
+            Trail_Release(*emitter.trails, particle.trail_slot);
+        }
+    }
+    Emitter_ReleaseHandle(emitter, particle);
+
+    Particle_Spawn(particle, emitter.rng, emitter.params);
+    Particle_ApplyOffset(particle, offset);
+    Emitter_GrowBounds(emitter, particle);
+    Emitter_AcquireHandle(emitter, oldest);
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Trail))
+    {
+        if (emitter.trails)
+        {
+            particle.trail_slot = Trail_Acquire(*emitter.trails);
+            Trail_Push(*emitter.trails, particle.trail_slot, particle.pos);
+        }
+    }
+}
+
+
+// Spawns n particles, sampling the spawn shape for the whole batch up
+// front. Only what the quota, budget and capacity allow is allocated; the
+// rest are dropped or recycle old particles, as the quota's policy says.
+// Every spawn path goes through here so the budget's count stays exact.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_SpawnBatch(Emitter_Of<Features, Capacity>& emitter, int n, Spawn_Offset const* offset = nullptr)
+{
+    constexpr int Batch = 64;
+
+    if (n <= 0)
+    {
+        return;
+    }
+
+    auto quota  = emitter.quota;
+    quota.quota = (quota.quota < Capacity) ? quota.quota : static_cast<uint32>(Capacity);
+
+    auto live    = static_cast<uint32>(emitter.particles.size());
+    auto wanted  = static_cast<uint32>(n);
+    auto fresh   = Budget_Admit(emitter.budget, quota, live, wanted);
+    auto recycle = (quota.policy == Budget_Policy_RecycleOldest) ? wanted - fresh : 0u;
+    recycle      = (recycle < live) ? recycle : live;
+
+    Vec pos[Batch];
+    Vec dir[Batch];
+    n = static_cast<int>(fresh);
+    while (n > 0)
+    {
+        int count = (n < Batch) ? n : Batch;
+        Spawn_Sample(emitter.params.spawn, emitter.rng, count, pos, dir);
+        for (int i = 0; i < count; ++i)
+        {
+            emitter.particles.allocate();
+
+            auto& particle = emitter.particles.back();
+            Particle_SpawnAt(particle, emitter.rng, emitter.params, pos[i], dir[i]);
+            Particle_ApplyOffset(particle, offset);
+            Emitter_GrowBounds(emitter, particle);
+            Emitter_AcquireHandle(emitter, emitter.particles.size() - 1);
+
+            if constexpr (Particle_Has(Features, Particle_Feature_Trail))
+            {
+                if (emitter.trails)
+                {
+                    particle.trail_slot = Trail_Acquire(*emitter.trails);
+                    Trail_Push(*emitter.trails, particle.trail_slot, particle.pos);
+                }
+            }
+        }
+        n -= count;
+    }
+
+    for (uint32 i = 0; i < recycle; ++i)
+    {
+        Emitter_RecycleOldest(emitter, offset);
+    }
+    if (emitter.budget)
+    {
+        emitter.budget->recycled += recycle;
+    }
+}
+
+
+// Deterministic mode. The same seed and the same sequence of time steps
+// give bit identical particles.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Seed(Emitter_Of<Features, Capacity>& emitter, uint64 seed)
+{
+    Random_Seed(emitter.rng, seed);
+}
+
+
+// Particles go in batches of 64, and each batch takes the step count its
+// fastest particle needs, so every particle in a batch runs the same loop and
+// only batches with something fast in them pay for sub-steps.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_IntegrateSubsteps(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    constexpr size_t Batch = 64;
+
+    float speed2[Batch];
+    float before[Batch];
+
+    auto& particles  = emitter.particles;
+    bool  age_events = emitter.events && emitter.event_age >= 0.0f;
+    for (size_t begin = 0; begin < particles.size(); begin += Batch)
+    {
+        size_t count = (particles.size() - begin < Batch) ? particles.size() - begin : Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& particle = particles[begin + i];
+            auto& vel      = particle.vel;
+            speed2[i]      = vel.x * vel.x + vel.y * vel.y + vel.z * vel.z;
+            before[i]      = 1.0f - particle.lifetime_sec / particle.duration_sec;
+        }
+
+        float speed = sqrtf(Particle_MaxSpeedSquared(speed2, count));
+        int   steps = Particle_SubstepCount(speed, time_sec, emitter.params);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Particle_IntegrateSubsteps(particles[begin + i], time_sec, steps, emitter.params);
+        }
+
+        if (age_events)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto& particle = particles[begin + i];
+                float after    = 1.0f - particle.lifetime_sec / particle.duration_sec;
+                if (Event_AgeCrossed(before[i], after, emitter.event_age))
+                {
+                    Event_Emit(*emitter.events, Particle_Event_Age, emitter.event_id, particle.pos, particle.vel);
+                }
+            }
+        }
+    }
+}
+
+
+// The stages of Emitter_Integrate, in order. Each is the readable reference
+// for its stage; see backend.h for faster versions that must match them.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Spawn(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    auto n_spawn = Emitter_SpawnCount(emitter.timer, emitter.rate, emitter.paused, time_sec);
+    Emitter_SpawnBatch(emitter, n_spawn);
+}
+
+
+// Ages and moves every particle, raising age events.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_IntegrateParticles(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    if (emitter.params.substep_cell > 0.0f)
+    {
+        Emitter_IntegrateSubsteps(emitter, time_sec);
+    }
+    else if (emitter.events && emitter.event_age >= 0.0f)
+    {
+        for (auto& particle : emitter.particles)
+        {
+            float before = 1.0f - particle.lifetime_sec / particle.duration_sec;
+            Particle_Integrate(particle, time_sec, emitter.params);
+            float after = 1.0f - particle.lifetime_sec / particle.duration_sec;
+
+            if (Event_AgeCrossed(before, after, emitter.event_age))
+            {
+                Event_Emit(*emitter.events, Particle_Event_Age, emitter.event_id, particle.pos, particle.vel);
+            }
+        }
+    }
+    else
+    {
+        for (auto& particle : emitter.particles)
+        {
+            Particle_Integrate(particle, time_sec, emitter.params);
+        }
+    }
+}
+
+
+// Over-lifetime curves, and trail history for particles that have one.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Affect(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    if (emitter.curves)
+    {
+        Emitter_ApplyCurves(emitter, *emitter.curves, time_sec);
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Trail))
+    {
+        if (emitter.trails && Trail_Tick(*emitter.trails, emitter.trail_sec, time_sec))
+        {
+            for (auto& particle : emitter.particles)
+            {
+                Trail_Push(*emitter.trails, particle.trail_slot, particle.pos);
+            }
+        }
+    }
+}
+
+
+// Removes the particles at the given indices, in ascending order, raising
+// death events and freeing their trails and handles.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_RemoveDead(Emitter_Of<Features, Capacity>& emitter, std::vector<size_t>& to_remove)
+{
+    for (auto i : to_remove)
     {
         auto& particle = emitter.particles[i];
-        if (particle.lifetime_sec < 0)
+        if (emitter.events)
+        {
+            Event_Emit(*emitter.events, Particle_Event_Death, emitter.event_id, particle.pos, particle.vel);
+        }
+
+        if constexpr (Particle_Has(Features, Particle_Feature_Trail))
         {
-            to_remove.push_back(i);
+            if (emitter.trails)
+            {
+                Trail_Release(*emitter.trails, particle.trail_slot);
+            }
         }
+        Emitter_ReleaseHandle(emitter, particle);
     }
+    Budget_Release(emitter.budget, static_cast<uint32>(to_remove.size()));
     emitter.particles.remove(to_remove);
+
+    // Holes below the new end were backfilled by live particles.
+    if constexpr (Particle_Has(Features, Particle_Feature_Handle))
+    {
+        for (auto i : to_remove)
+        {
+            if (i < emitter.particles.size())
+            {
+                Handle_Move(emitter.handles, emitter.particles[i].handle_slot, static_cast<uint32>(i));
+            }
+        }
+    }
+}
+
+
+// Removes expired particles.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Compact(Emitter_Of<Features, Capacity>& emitter)
+{
+    auto& dead = emitter.dead;
+    dead.clear();
+    for (size_t i = 0; i < emitter.particles.size(); ++i)
+    {
+        if (emitter.particles[i].lifetime_sec < 0)
+        {
+            dead.push_back(i);
+        }
+    }
+    Emitter_RemoveDead(emitter, dead);
+}
+
+
+// Measures the box around the live particles from scratch, along with the
+// fastest speed and acceleration in it.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_MeasureBounds(Emitter_Of<Features, Capacity>& emitter)
+{
+    constexpr size_t Batch = 64;
+
+    float x[Batch], y[Batch], z[Batch];
+    float speed2[Batch], acc2[Batch];
+
+    Emitter_Bounds bounds;
+    float          max_speed2 = 0.0f;
+    float          max_acc2   = 0.0f;
+
+    auto& particles = emitter.particles;
+    for (size_t begin = 0; begin < particles.size(); begin += Batch)
+    {
+        size_t count = (particles.size() - begin < Batch) ? particles.size() - begin : Batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& particle = particles[begin + i];
+            auto& vel      = particle.vel;
+            x[i]           = particle.pos.x;
+            y[i]           = particle.pos.y;
+            z[i]           = particle.pos.z;
+            speed2[i]      = vel.x * vel.x + vel.y * vel.y + vel.z * vel.z;
+            if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+            {
+                auto& acc = particle.acc;
+                acc2[i]   = acc.x * acc.x + acc.y * acc.y + acc.z * acc.z;
+            }
+        }
+
+        Bounds_Reduce(bounds.box, x, y, z, count);
+        float s2   = Particle_MaxSpeedSquared(speed2, count);
+        max_speed2 = (s2 > max_speed2) ? s2 : max_speed2;
+        if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+        {
+            float a2 = Particle_MaxSpeedSquared(acc2, count);
+            max_acc2 = (a2 > max_acc2) ? a2 : max_acc2;
+        }
+    }
+
+    bounds.measured  = bounds.box;
+    bounds.max_speed = sqrtf(max_speed2);
+    bounds.max_acc   = sqrtf(max_acc2);
+    emitter.bounds   = bounds;
+}
+
+
+// For an emitter that hasn't been ticked for time_sec since it was last
+// measured: grows the measured box by as far as any particle in it, or
+// spawned since, could have moved.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_InflateBounds(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    auto& bounds = emitter.bounds;
+    auto& params = emitter.params;
+
+    auto  box   = bounds.measured;
+    float speed = bounds.max_speed;
+    if (!emitter.paused && emitter.rate > 0.0f)
+    {
+        auto& v  = params.velocity;
+        float sv = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z) + fabsf(params.speed);
+        speed    = (sv > speed) ? sv : speed;
+        Bounds_Union(box, Bounds_OfSpawn(params.spawn));
+    }
+
+    constexpr bool Acc = Particle_Has(Features, Particle_Feature_Acceleration);
+    bounds.box         = Bounds_Inflate(box, Bounds_Reach(speed, bounds.max_acc, params.gravity, Acc, time_sec));
+}
+
+
+// Exchanges two particles' places in the array. Reordering moves particles
+// through here only.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_SwapParticles(Emitter_Of<Features, Capacity>& emitter, size_t a, size_t b)
+{
+    auto& particles = emitter.particles;
+    auto  particle  = particles[a];
+    particles[a]    = particles[b];
+    particles[b]    = particle;
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Handle))
+    {
+        Handle_Move(emitter.handles, particles[a].handle_slot, static_cast<uint32>(a));
+        Handle_Move(emitter.handles, particles[b].handle_slot, static_cast<uint32>(b));
+    }
+}
+
+
+// Sorts windows of the particle array by Morton code until the reorder
+// budget is spent, carrying on next tick from where this one stopped. A tick
+// never sorts more than the array holds, so a small emitter is sorted once,
+// not budget / n times over. Codes are over the measured bounds, so call
+// after Emitter_MeasureBounds.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Reorder(Emitter_Of<Features, Capacity>& emitter)
+{
+    constexpr size_t Batch = 64;
+
+    auto& reorder   = emitter.reorder;
+    auto& particles = emitter.particles;
+    auto  n         = particles.size();
+    reorder.sorted  = 0;
+    if (reorder.budget == 0 || n < 2 || Bounds_IsEmpty(emitter.bounds.measured))
+    {
+        return;
+    }
+
+    size_t window = (reorder.window < 2) ? 2 : reorder.window;
+    window        = (window < n) ? window : n;
+    reorder.codes.resize(window);
+    reorder.order.resize(window);
+    reorder.slot_of.resize(window);
+    reorder.item_at.resize(window);
+
+    float x[Batch], y[Batch], z[Batch];
+
+    size_t limit = (reorder.budget < n) ? reorder.budget : n;
+    size_t done  = 0;
+    while (done < limit)
+    {
+        // The last window of a sweep is pulled back to end with the array.
+        size_t begin = (reorder.cursor + window < n) ? reorder.cursor : n - window;
+
+        for (size_t first = 0; first < window; first += Batch)
+        {
+            size_t count = (window - first < Batch) ? window - first : Batch;
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto& pos = particles[begin + first + i].pos;
+                x[i]      = pos.x;
+                y[i]      = pos.y;
+                z[i]      = pos.z;
+            }
+            Morton_Codes(emitter.bounds.measured, x, y, z, reorder.codes.data() + first, count);
+        }
+        Morton_SortOrder(reorder.codes.data(), reorder.order.data(), window);
+
+        // Puts item order[k] in slot k with swaps, tracking where the
+        // displaced items went.
+        for (uint32 i = 0; i < window; ++i)
+        {
+            reorder.slot_of[i] = i;
+            reorder.item_at[i] = i;
+        }
+        for (uint32 k = 0; k < window; ++k)
+        {
+            uint32 item = reorder.order[k];
+            uint32 slot = reorder.slot_of[item];
+            if (slot == k)
+            {
+                continue;
+            }
+            uint32 other = reorder.item_at[k];
+            Emitter_SwapParticles(emitter, begin + k, begin + slot);
+            reorder.item_at[k]     = item;
+            reorder.item_at[slot]  = other;
+            reorder.slot_of[item]  = k;
+            reorder.slot_of[other] = slot;
+        }
+
+        done += window;
+        reorder.cursor = (begin + window < n) ? begin + window / 2 : 0;
+    }
+    reorder.sorted = static_cast<uint32>(done);
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+Emitter_Integrate(Emitter_Of<Features, Capacity>& emitter, float time_sec)
+{
+    Emitter_Spawn(emitter, time_sec);
+    Emitter_IntegrateParticles(emitter, time_sec);
+    Emitter_Affect(emitter, time_sec);
+    Emitter_Compact(emitter);
+    Emitter_MeasureBounds(emitter);
+    Emitter_Reorder(emitter);
 }
 
 
@@ -0,0 +1,497 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/budget.h"
+#include "Particles/particle.h"
+#include "Particles/simulation_lod.h"
+#include "Particles/thread_pool.h"
+#include <assert.h>
+#include <math.h>
+#include <vector>
+
+
+// Scenes have thousands of tiny emitters. Rather than each owning a small
+// array and being integrated one after another, a particle system pools every
+// emitter's particles together, tagged by owner, and integrates them in one
+// pass. Cost scales with the total particle count, not the emitter count.
+
+struct Emitter_ID
+{
+    uint32 index;
+    uint32 generation;
+};
+
+constexpr Emitter_ID Emitter_ID_None = { ~0u, 0 };
+
+
+struct System_Emitter
+{
+    uint32 generation { 0 };
+    bool   alive { false };
+
+    float rate { 0.5f };
+    float timer { 0.5f };
+    bool  paused { false };
+
+    Emitter_LOD lod;
+    float       radius { 10.0f }; // Rough extent, for LOD classification.
+    float       step_sec { 0.0f }; // Simulated time due this tick.
+
+    Budget_Quota quota;
+
+    // Particles are simulated in world space, spawned at the emitter's
+    // transform.
+    Vec pos { 0.0f, 0.0f, 0.0f };
+    Vec rotation { 0.0f, 0.0f, 0.0f }; // Euler angles (e13, e23, e12).
+
+    Emitter_Params        params;
+    uint32                effect_hash { 0 };
+    Emitter_Curves const* curves { nullptr };
+
+    // Seeded from the system seed and the emitter's slot, so spawns don't
+    // depend on the order emitters are processed in.
+    Random rng;
+
+    // Normalised age that raises Particle_Event_Age, negative for never.
+    float event_age { -1.0f };
+
+    Render_Mode     render_mode { Render_Mode_Cube };
+    Flipbook const* flipbook { nullptr };
+
+    uint32 live_count { 0 };
+};
+
+
+template <uint32 Features>
+struct ParticleSystem_Of
+{
+    using Particle_Type = Particle_Of<Features>;
+
+    static constexpr uint32 features = Features;
+
+    // Parallel arrays, one entry per live particle.
+    std::vector<Particle_Type> particles;
+    std::vector<uint32>        owners;
+
+    std::vector<System_Emitter> emitters;
+    std::vector<uint32>         free_slots;
+
+    // Set before creating emitters for a reproducible run.
+    uint64 seed { 0 };
+
+    // Unlimited unless set with ParticleSystem_SetBudget.
+    Particle_Budget budget;
+
+    // Per emitter slot, particles to cull and respawn this tick for
+    // Budget_Policy_RecycleOldest.
+    std::vector<uint32> recycle;
+    std::vector<uint32> culled;
+    uint32              recycle_total { 0 };
+
+    // Lifecycle events, merged once per tick. Needs a buffer per worker.
+    Event_Queue* events { nullptr };
+
+    // Destroyed this tick. Their slots are recycled once the compaction pass
+    // has removed their particles.
+    std::vector<uint32> pending_free;
+};
+
+using ParticleSystem = ParticleSystem_Of<Particle_Features_Default>;
+
+
+template <uint32 Features>
+void
+ParticleSystem_Reserve(ParticleSystem_Of<Features>& system,
+                       size_t                       n_particles,
+                       size_t                       n_emitters)
+{
+    system.particles.reserve(n_particles);
+    system.owners.reserve(n_particles);
+    system.emitters.reserve(n_emitters);
+}
+
+
+// A hard ceiling on the memory the system's particles take. The particle
+// arrays are reserved to it here and never grow past it.
+template <uint32 Features>
+void
+ParticleSystem_SetBudget(ParticleSystem_Of<Features>& system, size_t max_bytes)
+{
+    auto bytes_per_particle = sizeof(typename ParticleSystem_Of<Features>::Particle_Type) + sizeof(uint32);
+    auto used               = system.budget.used;
+
+    system.budget      = Budget_FromBytes(max_bytes, bytes_per_particle);
+    system.budget.used = used;
+    system.particles.reserve(system.budget.max_particles);
+    system.owners.reserve(system.budget.max_particles);
+}
+
+
+template <uint32 Features>
+Emitter_ID
+ParticleSystem_CreateEmitter(ParticleSystem_Of<Features>& system)
+{
+    uint32 index;
+    if (!system.free_slots.empty())
+    {
+        index = system.free_slots.back();
+        system.free_slots.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32>(system.emitters.size());
+        system.emitters.push_back({});
+        system.recycle.push_back(0);
+        system.culled.push_back(0);
+    }
+
+    auto& emitter      = system.emitters[index];
+    auto  generation   = emitter.generation;
+    emitter            = System_Emitter {};
+    emitter.generation = generation;
+    emitter.alive      = true;
+
+    Random_Seed(emitter.rng, system.seed ^ (uint64(generation) << 32), index);
+
+    return { index, generation };
+}
+
+
+template <uint32 Features>
+System_Emitter*
+ParticleSystem_Find(ParticleSystem_Of<Features>& system, Emitter_ID id)
+{
+    if (id.index >= system.emitters.size())
+    {
+        return nullptr;
+    }
+    auto& emitter = system.emitters[id.index];
+    if (!emitter.alive || emitter.generation != id.generation)
+    {
+        return nullptr;
+    }
+    return &emitter;
+}
+
+
+// The emitter's particles die with it on the next integrate.
+template <uint32 Features>
+void
+ParticleSystem_DestroyEmitter(ParticleSystem_Of<Features>& system, Emitter_ID id)
+{
+    auto* emitter = ParticleSystem_Find(system, id);
+    if (!emitter)
+    {
+        return;
+    }
+    emitter->alive = false;
+    emitter->generation += 1;
+    system.pending_free.push_back(id.index);
+}
+
+
+template <uint32 Features>
+void
+ParticleSystem_SetTransform(ParticleSystem_Of<Features>& system,
+                            Emitter_ID                   id,
+                            Vec                          pos,
+                            Vec                          rotation)
+{
+    if (auto* emitter = ParticleSystem_Find(system, id))
+    {
+        emitter->pos      = pos;
+        emitter->rotation = rotation;
+    }
+}
+
+
+// Reclassifies every emitter against the camera. Cheap enough to run each
+// frame, but need not be.
+template <uint32 Features>
+void
+ParticleSystem_UpdateLOD(ParticleSystem_Of<Features>& system,
+                         LOD_Settings const&          settings,
+                         LOD_Camera const&            camera)
+{
+    for (auto& emitter : system.emitters)
+    {
+        if (emitter.alive)
+        {
+            LOD_Classify(emitter.lod, settings, camera, emitter.pos, emitter.radius);
+        }
+    }
+}
+
+
+// Appends n particles for one emitter, sampling its spawn shape for the
+// whole batch up front. No budget checks, see ParticleSystem_Spawn.
+template <uint32 Features>
+void
+ParticleSystem_Append(ParticleSystem_Of<Features>& system, uint32 index, int n)
+{
+    constexpr int Batch = 64;
+
+    auto& emitter = system.emitters[index];
+    auto  R       = RotorFromEuler(emitter.rotation.x, emitter.rotation.y, emitter.rotation.z);
+
+    Vec pos[Batch];
+    Vec dir[Batch];
+    while (n > 0)
+    {
+        int count = (n < Batch) ? n : Batch;
+        Spawn_Sample(emitter.params.spawn, emitter.rng, count, pos, dir);
+        for (int i = 0; i < count; ++i)
+        {
+            system.particles.emplace_back();
+            system.owners.push_back(index);
+            emitter.live_count += 1;
+
+            auto& particle = system.particles.back();
+            Particle_SpawnAt(particle, emitter.rng, emitter.params, pos[i], dir[i]);
+
+            particle.vel = Vec_Rotate(R, particle.vel);
+            particle.pos = Vec_Rotate(R, particle.pos);
+            particle.pos += emitter.pos;
+        }
+        n -= count;
+    }
+}
+
+
+// Spawns up to n particles for one emitter, as its quota and the budget
+// allow. Spawns turned away are dropped, or under RecycleOldest replace the
+// emitter's oldest particles at the end of the next integrate.
+template <uint32 Features>
+void
+ParticleSystem_Spawn(ParticleSystem_Of<Features>& system, uint32 index, int n)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+
+    auto& emitter = system.emitters[index];
+    auto  wanted  = static_cast<uint32>(n);
+    auto  fresh   = Budget_Admit(&system.budget, emitter.quota, emitter.live_count, wanted);
+    if (emitter.quota.policy == Budget_Policy_RecycleOldest && fresh < wanted)
+    {
+        auto& pending = system.recycle[index];
+        auto  room    = (emitter.live_count > pending) ? emitter.live_count - pending : 0u;
+        auto  k       = (wanted - fresh < room) ? wanted - fresh : room;
+
+        pending += k;
+        system.recycle_total += k;
+        system.budget.recycled += k;
+    }
+
+    ParticleSystem_Append(system, index, static_cast<int>(fresh));
+}
+
+
+template <uint32 Features>
+void
+ParticleSystem_ApplyCurves(Particle_Of<Features>& particle,
+                           Emitter_Curves const&  curves,
+                           float                  time_sec)
+{
+    float age = 1.0f - particle.lifetime_sec / particle.duration_sec;
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        if (curves.channels & Curve_Channel_Size)
+        {
+            particle.size = Curve_Sample(curves.size, age);
+        }
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Color))
+    {
+        if (curves.channels & Curve_Channel_Color)
+        {
+            particle.color.r = Curve_ToByte(Curve_Sample(curves.r, age));
+            particle.color.g = Curve_ToByte(Curve_Sample(curves.g, age));
+            particle.color.b = Curve_ToByte(Curve_Sample(curves.b, age));
+            particle.color.a = Curve_ToByte(Curve_Sample(curves.a, age));
+        }
+    }
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        if (curves.channels & Curve_Channel_AngularDamping)
+        {
+            float keep = 1.0f - Curve_Sample(curves.angular_damping, age) * time_sec;
+            keep       = (keep < 0.0f) ? 0.0f : keep;
+
+            particle.omega = particle.omega * keep;
+        }
+    }
+}
+
+
+// Integrates particles [begin, end). Safe to run on disjoint ranges in
+// parallel: each particle only reads its emitter and events go to the
+// worker's own buffer.
+template <uint32 Features>
+void
+ParticleSystem_IntegrateRange(ParticleSystem_Of<Features>& system,
+                              size_t                       begin,
+                              size_t                       end,
+                              Event_Buffer*                events)
+{
+    auto& particles = system.particles;
+    auto& owners    = system.owners;
+    for (size_t i = begin; i < end; ++i)
+    {
+        auto& emitter  = system.emitters[owners[i]];
+        auto  step_sec = emitter.step_sec;
+        if (step_sec <= 0.0f)
+        {
+            continue;
+        }
+
+        auto& particle = particles[i];
+        float before   = particle.lifetime_sec;
+        int   steps    = 1;
+        if (emitter.params.substep_cell > 0.0f)
+        {
+            // Emitters share the pool, so the count is the particle's own
+            // rather than a batch's.
+            auto& vel = particle.vel;
+            steps     = Particle_SubstepCount(sqrtf(vel.x * vel.x + vel.y * vel.y + vel.z * vel.z), step_sec, emitter.params);
+        }
+        Particle_IntegrateSubsteps(particle, step_sec, steps, emitter.params);
+
+        if (emitter.curves)
+        {
+            ParticleSystem_ApplyCurves(particle, *emitter.curves, step_sec);
+        }
+
+        if (events && emitter.alive)
+        {
+            // Culled for recycling isn't a death.
+            if (particle.lifetime_sec < 0 && before >= 0)
+            {
+                Event_Emit(*events, Particle_Event_Death, owners[i], particle.pos, particle.vel);
+            }
+            else if (Event_AgeCrossed(1.0f - before / particle.duration_sec,
+                                      1.0f - particle.lifetime_sec / particle.duration_sec,
+                                      emitter.event_age))
+            {
+                Event_Emit(*events, Particle_Event_Age, owners[i], particle.pos, particle.vel);
+            }
+        }
+    }
+}
+
+
+// pool, when given, splits the particle pass across its workers. Results
+// are identical whatever the thread count.
+template <uint32 Features>
+void
+ParticleSystem_Integrate(ParticleSystem_Of<Features>& system,
+                         float                        time_sec,
+                         Thread_Pool*                 pool = nullptr)
+{
+    // Spawning is per emitter but only touches a few bytes of control data
+    // each. Throttled emitters bank their time and take it as one large
+    // step when they are due.
+    auto n_emitters = static_cast<uint32>(system.emitters.size());
+    for (uint32 e = 0; e < n_emitters; ++e)
+    {
+        auto& emitter = system.emitters[e];
+        if (!emitter.alive)
+        {
+            continue;
+        }
+
+        emitter.step_sec = LOD_Advance(emitter.lod, time_sec, emitter.paused, emitter.live_count);
+        if (emitter.step_sec <= 0.0f)
+        {
+            continue;
+        }
+
+        auto n_spawn = Emitter_SpawnCount(emitter.timer, emitter.rate, emitter.paused, emitter.step_sec);
+        ParticleSystem_Spawn(system, e, n_spawn);
+    }
+
+    // Particles are appended in spawn order and compaction is stable, so an
+    // emitter's oldest particles come first. Culling them here and
+    // respawning after compaction keeps the count, and the memory, at the
+    // ceiling throughout.
+    if (system.recycle_total > 0)
+    {
+        for (size_t i = 0; i < system.particles.size(); ++i)
+        {
+            auto owner = system.owners[i];
+            if (system.culled[owner] < system.recycle[owner])
+            {
+                system.particles[i].lifetime_sec = -1.0f;
+                system.culled[owner] += 1;
+            }
+        }
+    }
+
+    // One batched pass over every emitter's particles.
+    auto& particles = system.particles;
+    auto& owners    = system.owners;
+    auto* events    = system.events;
+    if (pool)
+    {
+        assert(!events || events->per_thread.size() >= size_t(ThreadPool_Size(*pool)));
+        ThreadPool_For(*pool, particles.size(), [&](int worker, size_t begin, size_t end) {
+            ParticleSystem_IntegrateRange(system, begin, end, events ? &events->per_thread[worker] : nullptr);
+        });
+    }
+    else
+    {
+        ParticleSystem_IntegrateRange(system, 0, particles.size(), events ? &events->per_thread[0] : nullptr);
+    }
+
+    if (events)
+    {
+        EventQueue_Merge(*events);
+    }
+
+    // Stable compaction. Drops expired particles and those whose emitter was
+    // destroyed, keeping the survivors in order.
+    size_t w = 0;
+    for (size_t i = 0; i < particles.size(); ++i)
+    {
+        auto& emitter = system.emitters[owners[i]];
+        if (particles[i].lifetime_sec < 0 || !emitter.alive)
+        {
+            emitter.live_count -= 1;
+            continue;
+        }
+        if (w != i)
+        {
+            particles[w] = particles[i];
+            owners[w]    = owners[i];
+        }
+        ++w;
+    }
+    Budget_Release(&system.budget, static_cast<uint32>(particles.size() - w));
+    particles.resize(w);
+    owners.resize(w);
+
+    if (system.recycle_total > 0)
+    {
+        for (uint32 e = 0; e < n_emitters; ++e)
+        {
+            auto n = system.culled[e];
+            if (n > 0 && system.emitters[e].alive)
+            {
+                system.budget.used += n;
+                ParticleSystem_Append(system, e, static_cast<int>(n));
+            }
+            system.recycle[e] = 0;
+            system.culled[e]  = 0;
+        }
+        system.recycle_total = 0;
+    }
+
+    for (auto index : system.pending_free)
+    {
+        system.free_slots.push_back(index);
+    }
+    system.pending_free.clear();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <stddef.h>
+
+
+// PCG32. Every emitter owns a stream, so the numbers a particle sees depend
+// only on its emitter's seed and spawn order, never on which thread ran it
+// or what else called rand() in between.
+struct Random
+{
+    uint64 state { 0x853c49e6748fea9bull };
+    uint64 inc { 0xda3e39cb94b95bdbull };
+};
+
+
+uint32
+Random_Next(Random& rng)
+{
+    uint64 old = rng.state;
+    rng.state  = old * 6364136223846793005ull + rng.inc;
+
+    auto xorshifted = static_cast<uint32>(((old >> 18u) ^ old) >> 27u);
+    auto rot        = static_cast<uint32>(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+
+void
+Random_Seed(Random& rng, uint64 seed, uint64 stream = 0)
+{
+    rng.state = 0u;
+    rng.inc   = (stream << 1u) | 1u;
+    Random_Next(rng);
+    rng.state += seed;
+    Random_Next(rng);
+}
+
+
+// Uniform integer in [0, n).
+int32
+Random_Int(Random& rng, int32 n)
+{
+    return static_cast<int32>(Random_Next(rng) % static_cast<uint32>(n));
+}
+
+
+// Uniform float in [0, 1).
+float
+Random_Float(Random& rng)
+{
+    return (Random_Next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+
+// n uniform floats in [0, 1). Samplers draw their randoms in bulk and
+// transform them in a separate loop.
+void
+Random_Fill(Random& rng, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out[i] = Random_Float(rng);
+    }
+}
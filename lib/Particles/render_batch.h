@@ -0,0 +1,39 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include <vector>
+
+
+// CPU side geometry for a whole frame of particle effects. Builders append
+// to one batch so everything of a kind goes to the GPU in a single draw.
+// The vectors are reserved up front and Render_Clear keeps their capacity,
+// so steady state frames don't allocate.
+
+struct Particle_Vertex
+{
+    float          x, y, z;
+    float          u, v;
+    Particle_Color color;
+};
+
+struct Render_Batch
+{
+    std::vector<Particle_Vertex> vertices;
+    std::vector<uint32>          indices;
+};
+
+
+void
+Render_Reserve(Render_Batch& batch, size_t n_vertices, size_t n_indices)
+{
+    batch.vertices.reserve(n_vertices);
+    batch.indices.reserve(n_indices);
+}
+
+
+void
+Render_Clear(Render_Batch& batch)
+{
+    batch.vertices.clear();
+    batch.indices.clear();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include "Particles/render_batch.h"
+#include "Particles/trail.h"
+#include <math.h>
+
+
+// Camera facing ribbons along particle trails. Each trail becomes a strip of
+// two vertices per sample, widest at the particle and tapering to nothing at
+// the oldest sample, with u running 0 to 1 along it.
+
+void
+Ribbon_Reserve(Render_Batch& batch, Trail_Pool const& pool)
+{
+    size_t segments = (pool.samples > 0) ? pool.samples - 1 : 0;
+    Render_Reserve(batch,
+                   batch.vertices.size() + size_t(pool.slots) * pool.samples * 2,
+                   batch.indices.size() + size_t(pool.slots) * segments * 6);
+}
+
+
+void
+Ribbon_AppendTrail(Render_Batch&     batch,
+                   Trail_Pool const& pool,
+                   uint32            slot,
+                   Vec               eye,
+                   float             half_width,
+                   Particle_Color    color)
+{
+    uint32 count = pool.count[slot];
+    if (count < 2)
+    {
+        return;
+    }
+
+    auto base = static_cast<uint32>(batch.vertices.size());
+    for (uint32 k = 0; k < count; ++k)
+    {
+        Vec p    = Trail_Sample(pool, slot, k);
+        Vec prev = Trail_Sample(pool, slot, (k > 0) ? k - 1 : k);
+        Vec next = Trail_Sample(pool, slot, (k + 1 < count) ? k + 1 : k);
+
+        Vec t = { prev.x - next.x, prev.y - next.y, prev.z - next.z };
+        Vec e = { eye.x - p.x, eye.y - p.y, eye.z - p.z };
+
+        // Perpendicular to both the trail and the view ray, so the strip
+        // always shows its face to the camera.
+        Vec   side = { t.y * e.z - t.z * e.y, t.z * e.x - t.x * e.z, t.x * e.y - t.y * e.x };
+        float len  = sqrtf(side.x * side.x + side.y * side.y + side.z * side.z);
+        float u    = k / float(count - 1);
+        float w    = (len > 0.0f) ? half_width * (1.0f - u) / len : 0.0f;
+        side       = side * w;
+
+        Particle_Color c = color;
+        c.a              = static_cast<uint8>(color.a * (1.0f - u));
+
+        batch.vertices.push_back({ p.x + side.x, p.y + side.y, p.z + side.z, u, 0.0f, c });
+        batch.vertices.push_back({ p.x - side.x, p.y - side.y, p.z - side.z, u, 1.0f, c });
+    }
+
+    for (uint32 k = 0; k + 1 < count; ++k)
+    {
+        uint32 a = base + 2 * k;
+        uint32 b = a + 2;
+        batch.indices.push_back(a);
+        batch.indices.push_back(a + 1);
+        batch.indices.push_back(b);
+        batch.indices.push_back(b);
+        batch.indices.push_back(a + 1);
+        batch.indices.push_back(b + 1);
+    }
+}
+
+
+// Appends ribbons for every trailing particle of an emitter. Particles with
+// a colour channel use it, the rest use color.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_BuildRibbons(Render_Batch&                         batch,
+                     Emitter_Of<Features, Capacity> const& emitter,
+                     Vec                                   eye,
+                     float                                 width,
+                     Particle_Color                        color)
+{
+    static_assert(Particle_Has(Features, Particle_Feature_Trail), "emitter has no trails");
+    if (!emitter.trails)
+    {
+        return;
+    }
+
+    for (auto const& particle : emitter.particles)
+    {
+        if (particle.trail_slot == Trail_None)
+        {
+            continue;
+        }
+
+        auto c = color;
+        if constexpr (Particle_Has(Features, Particle_Feature_Color))
+        {
+            c = particle.color;
+        }
+        Ribbon_AppendTrail(batch, *emitter.trails, particle.trail_slot, eye, 0.5f * width, c);
+    }
+}
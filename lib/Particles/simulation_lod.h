@@ -0,0 +1,172 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include <math.h>
+
+
+// Simulation level of detail. Distant and off-screen emitters are ticked
+// less often with a larger dt, and idle emitters are not ticked at all.
+// Skipped time is banked, so an emitter that comes back into view is
+// fast-forwarded with a few large steps and looks as though it never
+// stopped.
+
+struct LOD_Camera
+{
+    Vec   pos;
+    Vec   forward; // Unit length.
+    float cos_half_fov;
+};
+
+struct LOD_Settings
+{
+    float near_dist { 20.0f };
+    float far_dist { 60.0f };
+
+    // Tick every nth frame.
+    int near_divisor { 1 };
+    int mid_divisor { 2 };
+    int far_divisor { 4 };
+    int hidden_divisor { 8 };
+
+    // Largest dt used when catching up banked time.
+    float max_step_sec { 0.25f };
+    int   max_steps { 8 };
+};
+
+struct Emitter_LOD
+{
+    int   divisor { 1 };
+    int   counter { 0 };
+    float pending_sec { 0.0f };
+    bool  visible { true };
+    bool  sleeping { false };
+};
+
+
+LOD_Camera
+LOD_CameraFromLookAt(Vec position, Vec target, float fovy_deg, float aspect)
+{
+    Vec   f   = { target.x - position.x, target.y - position.y, target.z - position.z };
+    float len = sqrtf(f.x * f.x + f.y * f.y + f.z * f.z);
+    if (len > 0.0f)
+    {
+        f = f * (1.0f / len);
+    }
+
+    // Widest half angle of the frustum, from the diagonal.
+    float half_v = 0.5f * fovy_deg * M_PI / 180.0f;
+    float tan_v  = tanf(half_v);
+    float tan_d  = tan_v * sqrtf(1.0f + aspect * aspect);
+
+    return { position, f, cosf(atanf(tan_d)) };
+}
+
+
+// Whether any of a sphere is inside the camera's cone.
+bool
+LOD_Visible(LOD_Camera const& camera, Vec center, float radius)
+{
+    Vec   d    = { center.x - camera.pos.x, center.y - camera.pos.y, center.z - camera.pos.z };
+    float dist = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    if (dist <= radius)
+    {
+        return true;
+    }
+
+    // Angle test, widened by the angle the sphere subtends.
+    float along   = (d.x * camera.forward.x + d.y * camera.forward.y + d.z * camera.forward.z) / dist;
+    float sin_r   = radius / dist;
+    float cos_r   = sqrtf(1.0f - sin_r * sin_r);
+    float sin_fov = sqrtf(1.0f - camera.cos_half_fov * camera.cos_half_fov);
+    float cos_max = camera.cos_half_fov * cos_r - sin_fov * sin_r;
+    return along >= cos_max;
+}
+
+
+// Picks the tick divisor for an emitter bounded by a sphere.
+void
+LOD_Classify(Emitter_LOD&        lod,
+             LOD_Settings const& settings,
+             LOD_Camera const&   camera,
+             Vec                 center,
+             float               radius)
+{
+    Vec   d    = { center.x - camera.pos.x, center.y - camera.pos.y, center.z - camera.pos.z };
+    float dist = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+
+    bool visible = LOD_Visible(camera, center, radius);
+    lod.visible  = visible;
+    if (!visible)
+    {
+        lod.divisor = settings.hidden_divisor;
+    }
+    else if (dist - radius < settings.near_dist)
+    {
+        lod.divisor = settings.near_divisor;
+    }
+    else if (dist - radius < settings.far_dist)
+    {
+        lod.divisor = settings.mid_divisor;
+    }
+    else
+    {
+        lod.divisor = settings.far_divisor;
+    }
+}
+
+
+// Banks time_sec and returns how much simulated time is due this tick, or
+// zero if the emitter should be skipped. An emitter that is paused with no
+// live particles is put to sleep and banks nothing, there is nothing left
+// to catch up on.
+float
+LOD_Advance(Emitter_LOD& lod, float time_sec, bool paused, size_t live_particles)
+{
+    lod.sleeping = paused && live_particles == 0;
+    if (lod.sleeping)
+    {
+        lod.counter     = 0;
+        lod.pending_sec = 0.0f;
+        return 0.0f;
+    }
+
+    lod.pending_sec += time_sec;
+    lod.counter += 1;
+    if (lod.counter < lod.divisor)
+    {
+        return 0.0f;
+    }
+
+    float due       = lod.pending_sec;
+    lod.counter     = 0;
+    lod.pending_sec = 0.0f;
+    return due;
+}
+
+
+template <uint32 Features, size_t Capacity>
+void
+Emitter_TickLOD(Emitter_Of<Features, Capacity>& emitter,
+                Emitter_LOD&                    lod,
+                LOD_Settings const&             settings,
+                float                           time_sec)
+{
+    float due = LOD_Advance(lod, time_sec, emitter.paused, emitter.particles.size());
+    if (due <= 0.0f)
+    {
+        Emitter_InflateBounds(emitter, lod.pending_sec);
+        return;
+    }
+
+    // Large-step catch up. Anything beyond max_steps of max_step_sec is
+    // spread over max_steps, particles that would have died in the gap
+    // still die.
+    int steps = static_cast<int>(ceilf(due / settings.max_step_sec));
+    steps     = (steps < 1) ? 1 : ((steps > settings.max_steps) ? settings.max_steps : steps);
+
+    float step_sec = due / steps;
+    for (int i = 0; i < steps; ++i)
+    {
+        Emitter_Integrate(emitter, step_sec);
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include "Particles/trail.h"
+#include <atomic>
+
+
+// Hand off between a simulation thread and a render thread. The simulation
+// fills the back slot while the renderer reads the front one, and a publish
+// swaps the back slot with the middle one through a single atomic index.
+// Neither side ever waits for the other, so a frame costs the slower of the
+// two rather than their sum. The renderer always has the latest complete
+// tick; ticks it was too slow to see are skipped.
+
+constexpr uint32 TripleBuffer_Fresh = 4; // Middle slot not yet seen by the reader.
+
+template <typename T>
+struct Triple_Buffer
+{
+    T slots[3];
+
+    std::atomic<uint32> middle { 1 };
+    uint32              back { 0 };  // Writer's.
+    uint32              front { 2 }; // Reader's.
+};
+
+
+template <typename T>
+T&
+TripleBuffer_Back(Triple_Buffer<T>& buffer)
+{
+    return buffer.slots[buffer.back];
+}
+
+
+// Writer only. The back slot becomes the latest; the writer carries on with
+// whichever slot it swapped out.
+template <typename T>
+void
+TripleBuffer_Publish(Triple_Buffer<T>& buffer)
+{
+    auto old    = buffer.middle.exchange(buffer.back | TripleBuffer_Fresh, std::memory_order_acq_rel);
+    buffer.back = old & 3;
+}
+
+
+// Reader only. Takes the latest slot if there is a new one; otherwise the
+// front slot is left as it was. Returns whether it changed.
+template <typename T>
+bool
+TripleBuffer_Acquire(Triple_Buffer<T>& buffer)
+{
+    if (!(buffer.middle.load(std::memory_order_relaxed) & TripleBuffer_Fresh))
+    {
+        return false;
+    }
+    auto old     = buffer.middle.exchange(buffer.front, std::memory_order_acq_rel);
+    buffer.front = old & 3;
+    return true;
+}
+
+
+template <typename T>
+T&
+TripleBuffer_Front(Triple_Buffer<T>& buffer)
+{
+    return buffer.slots[buffer.front];
+}
+
+
+// One emitter's state as the renderer sees it. The trail history is copied
+// along with the particles, so ribbons never read the live pool.
+template <uint32 Features, size_t Capacity>
+struct Emitter_Snapshot
+{
+    Emitter_Of<Features, Capacity> emitter;
+    Trail_Pool                     trails;
+    uint64                         tick { 0 };
+};
+
+
+// Copies into a slot that has been used before reuse its storage, so steady
+// state captures don't allocate.
+template <uint32 Features, size_t Capacity>
+void
+Snapshot_Capture(Emitter_Snapshot<Features, Capacity>& snapshot,
+                 Emitter_Of<Features, Capacity> const& emitter,
+                 uint64                                tick)
+{
+    snapshot.emitter = emitter;
+    snapshot.tick    = tick;
+    if (emitter.trails)
+    {
+        snapshot.trails         = *emitter.trails;
+        snapshot.emitter.trails = &snapshot.trails;
+    }
+
+    // Nothing render side may write back into the simulation.
+    snapshot.emitter.events = nullptr;
+    snapshot.emitter.budget = nullptr;
+}
+
+
+template <uint32 Features>
+struct System_Snapshot
+{
+    ParticleSystem_Of<Features> system;
+    uint64                      tick { 0 };
+};
+
+
+template <uint32 Features>
+void
+Snapshot_Capture(System_Snapshot<Features>& snapshot, ParticleSystem_Of<Features> const& system, uint64 tick)
+{
+    snapshot.system.particles = system.particles;
+    snapshot.system.owners    = system.owners;
+    snapshot.system.emitters  = system.emitters;
+    snapshot.tick             = tick;
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include "Particles/random.h"
+#include <math.h>
+#include <vector>
+
+
+// Where particles are born and which way they face. Every shape samples a
+// whole batch at once: random numbers are drawn into flat arrays first, then
+// turned into positions and directions by straight loops the compiler can
+// vectorise.
+
+enum Spawn_Shape : uint32
+{
+    Spawn_Shape_Point,
+    Spawn_Shape_Sphere,     // Volume. extents.x is the radius.
+    Spawn_Shape_Box,        // Volume. extents are half sizes.
+    Spawn_Shape_Hemisphere, // Volume, +y half. extents.x is the radius.
+    Spawn_Shape_Cone,       // From the apex, within cone_angle_deg of +y.
+    Spawn_Shape_Disc,       // In the xz plane. extents.x is the radius.
+    Spawn_Shape_Mesh,       // Triangle surface, area weighted.
+};
+
+
+// A triangle mesh prepared for O(1) area weighted sampling with Vose's alias
+// method.
+struct Spawn_Mesh
+{
+    std::vector<Vec>    vertices;
+    std::vector<uint32> indices; // Three per triangle.
+    std::vector<Vec>    normals; // One per triangle.
+
+    std::vector<float>  prob;
+    std::vector<uint32> alias;
+};
+
+
+void
+SpawnMesh_Build(Spawn_Mesh&   mesh,
+                Vec const*    vertices,
+                size_t        n_vertices,
+                uint32 const* indices,
+                size_t        n_indices)
+{
+    mesh.vertices.assign(vertices, vertices + n_vertices);
+    mesh.indices.assign(indices, indices + n_indices);
+
+    auto n = n_indices / 3;
+    mesh.normals.resize(n);
+    mesh.prob.resize(n);
+    mesh.alias.resize(n);
+
+    std::vector<float> area(n);
+    float              total = 0.0f;
+    for (size_t t = 0; t < n; ++t)
+    {
+        auto& a = vertices[indices[3 * t + 0]];
+        auto& b = vertices[indices[3 * t + 1]];
+        auto& c = vertices[indices[3 * t + 2]];
+
+        Vec   ab  = { b.x - a.x, b.y - a.y, b.z - a.z };
+        Vec   ac  = { c.x - a.x, c.y - a.y, c.z - a.z };
+        Vec   x   = { ab.y * ac.z - ab.z * ac.y, ab.z * ac.x - ab.x * ac.z, ab.x * ac.y - ab.y * ac.x };
+        float len = sqrtf(x.x * x.x + x.y * x.y + x.z * x.z);
+
+        area[t]         = 0.5f * len;
+        mesh.normals[t] = (len > 0.0f) ? x * (1.0f / len) : Vec { 0.0f, 1.0f, 0.0f };
+        total += area[t];
+    }
+
+    // Vose: split the scaled probabilities into those under and over one and
+    // pair each small column with a large one.
+    std::vector<uint32> small;
+    std::vector<uint32> large;
+    for (size_t t = 0; t < n; ++t)
+    {
+        mesh.prob[t] = (total > 0.0f) ? area[t] * n / total : 1.0f;
+        (mesh.prob[t] < 1.0f ? small : large).push_back(static_cast<uint32>(t));
+    }
+    while (!small.empty() && !large.empty())
+    {
+        auto s = small.back();
+        auto l = large.back();
+        small.pop_back();
+        large.pop_back();
+
+        mesh.alias[s] = l;
+        mesh.prob[l]  = (mesh.prob[l] + mesh.prob[s]) - 1.0f;
+        (mesh.prob[l] < 1.0f ? small : large).push_back(l);
+    }
+    for (auto t : large)
+    {
+        mesh.prob[t] = 1.0f;
+    }
+    for (auto t : small)
+    {
+        mesh.prob[t] = 1.0f;
+    }
+}
+
+
+struct Spawn_Desc
+{
+    Spawn_Shape       shape { Spawn_Shape_Point };
+    Vec               extents { 0.0f, 0.0f, 0.0f };
+    float             cone_angle_deg { 30.0f };
+    Spawn_Mesh const* mesh { nullptr };
+};
+
+
+// Unit direction, uniform over the sphere, from two uniforms.
+Vec
+Spawn_UnitFromUniforms(float u, float v)
+{
+    float z   = 2.0f * u - 1.0f;
+    float r   = sqrtf(1.0f - z * z);
+    float phi = 2.0f * float(M_PI) * v;
+    return Vec { r * cosf(phi), r * sinf(phi), z };
+}
+
+
+// Fills pos and dir for n new particles. dir is the shape's natural
+// emission direction: outward for volumes, +y for discs and cones, the
+// surface normal for meshes, and zero where there isn't one.
+void
+Spawn_Sample(Spawn_Desc const& desc, Random& rng, size_t n, Vec* pos, Vec* dir)
+{
+    constexpr size_t Batch = 64;
+
+    float u[3][Batch];
+    float w[Batch];
+
+    for (size_t begin = 0; begin < n; begin += Batch)
+    {
+        size_t count = (n - begin < Batch) ? n - begin : Batch;
+        Vec*   p     = pos + begin;
+        Vec*   d     = dir + begin;
+
+        switch (desc.shape)
+        {
+        case Spawn_Shape_Point:
+        default:
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                p[i] = Vec { 0.0f, 0.0f, 0.0f };
+                d[i] = Vec { 0.0f, 0.0f, 0.0f };
+            }
+            break;
+        }
+        case Spawn_Shape_Sphere:
+        case Spawn_Shape_Hemisphere:
+        {
+            Random_Fill(rng, u[0], count);
+            Random_Fill(rng, u[1], count);
+            Random_Fill(rng, w, count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                Vec unit = Spawn_UnitFromUniforms(u[0][i], u[1][i]);
+                if (desc.shape == Spawn_Shape_Hemisphere)
+                {
+                    // Swap so the pole is +y, then fold into the top half.
+                    unit = Vec { unit.x, fabsf(unit.z), unit.y };
+                }
+                // cbrt keeps the density uniform over the volume.
+                p[i] = unit * (cbrtf(w[i]) * desc.extents.x);
+                d[i] = unit;
+            }
+            break;
+        }
+        case Spawn_Shape_Box:
+        {
+            Random_Fill(rng, u[0], count);
+            Random_Fill(rng, u[1], count);
+            Random_Fill(rng, u[2], count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                p[i] = Vec { (2.0f * u[0][i] - 1.0f) * desc.extents.x,
+                             (2.0f * u[1][i] - 1.0f) * desc.extents.y,
+                             (2.0f * u[2][i] - 1.0f) * desc.extents.z };
+                d[i] = Vec { 0.0f, 0.0f, 0.0f };
+            }
+            break;
+        }
+        case Spawn_Shape_Cone:
+        {
+            float cos_max = cosf(desc.cone_angle_deg * float(M_PI) / 180.0f);
+            Random_Fill(rng, u[0], count);
+            Random_Fill(rng, u[1], count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                // Uniform over the spherical cap.
+                float c   = 1.0f - u[0][i] * (1.0f - cos_max);
+                float s   = sqrtf(1.0f - c * c);
+                float phi = 2.0f * float(M_PI) * u[1][i];
+                p[i]      = Vec { 0.0f, 0.0f, 0.0f };
+                d[i]      = Vec { s * cosf(phi), c, s * sinf(phi) };
+            }
+            break;
+        }
+        case Spawn_Shape_Disc:
+        {
+            Random_Fill(rng, u[0], count);
+            Random_Fill(rng, u[1], count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                float r   = sqrtf(u[0][i]) * desc.extents.x;
+                float phi = 2.0f * float(M_PI) * u[1][i];
+                p[i]      = Vec { r * cosf(phi), 0.0f, r * sinf(phi) };
+                d[i]      = Vec { 0.0f, 1.0f, 0.0f };
+            }
+            break;
+        }
+        case Spawn_Shape_Mesh:
+        {
+            auto* mesh = desc.mesh;
+            if (!mesh || mesh->prob.empty())
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    p[i] = Vec { 0.0f, 0.0f, 0.0f };
+                    d[i] = Vec { 0.0f, 0.0f, 0.0f };
+                }
+                break;
+            }
+
+            auto n_tris = static_cast<uint32>(mesh->prob.size());
+            Random_Fill(rng, w, count);
+            Random_Fill(rng, u[0], count);
+            Random_Fill(rng, u[1], count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                // One uniform picks the column and decides between it and
+                // its alias.
+                float  x   = w[i] * n_tris;
+                auto   col = static_cast<uint32>(x);
+                col        = (col < n_tris) ? col : n_tris - 1;
+                uint32 tri = (x - col < mesh->prob[col]) ? col : mesh->alias[col];
+
+                auto& a = mesh->vertices[mesh->indices[3 * tri + 0]];
+                auto& b = mesh->vertices[mesh->indices[3 * tri + 1]];
+                auto& c = mesh->vertices[mesh->indices[3 * tri + 2]];
+
+                // Uniform barycentrics.
+                float r1 = sqrtf(u[0][i]);
+                float ka = 1.0f - r1;
+                float kb = r1 * (1.0f - u[1][i]);
+                float kc = r1 * u[1][i];
+
+                p[i] = Vec { ka * a.x + kb * b.x + kc * c.x,
+                             ka * a.y + kb * b.y + kc * c.y,
+                             ka * a.z + kb * b.z + kc * c.z };
+                d[i] = mesh->normals[tri];
+            }
+            break;
+        }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include <string.h>
+
+
+// FNV-1a over the simulated state. Used to prove a change to the
+// simulation didn't change its results: floats are hashed by bit pattern,
+// so any difference at all, even -0 vs +0, shows up.
+
+constexpr uint64 Hash_Seed = 0xcbf29ce484222325ull;
+
+
+uint64
+Hash_Bytes(uint64 hash, void const* data, size_t size)
+{
+    auto* bytes = static_cast<uint8 const*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+
+uint64
+Hash_Float(uint64 hash, float value)
+{
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return Hash_Bytes(hash, &bits, sizeof(bits));
+}
+
+
+uint64
+Hash_Vec(uint64 hash, Vec const& v)
+{
+    hash = Hash_Float(hash, v.x);
+    hash = Hash_Float(hash, v.y);
+    hash = Hash_Float(hash, v.z);
+    return hash;
+}
+
+
+// Field by field, so padding never leaks into the hash.
+template <uint32 Features>
+uint64
+Particle_Hash(uint64 hash, Particle_Of<Features> const& particle)
+{
+    hash = Hash_Vec(hash, particle.pos);
+    hash = Hash_Vec(hash, particle.vel);
+    hash = Hash_Float(hash, particle.lifetime_sec);
+    hash = Hash_Float(hash, particle.duration_sec);
+
+    if constexpr (Particle_Has(Features, Particle_Feature_Acceleration))
+    {
+        hash = Hash_Vec(hash, particle.acc);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Rotation))
+    {
+        hash = Hash_Vec(hash, particle.theta);
+        hash = Hash_Vec(hash, particle.omega);
+        hash = Hash_Vec(hash, particle.alpha);
+        for (int i = 0; i < 16; ++i)
+        {
+            hash = Hash_Float(hash, particle.rot_mat[i]);
+        }
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Size))
+    {
+        hash = Hash_Float(hash, particle.size);
+    }
+    if constexpr (Particle_Has(Features, Particle_Feature_Color))
+    {
+        hash = Hash_Bytes(hash, &particle.color, sizeof(particle.color));
+    }
+    return hash;
+}
+
+
+template <uint32 Features, size_t Capacity>
+uint64
+Emitter_Hash(Emitter_Of<Features, Capacity> const& emitter)
+{
+    uint64 hash = Hash_Seed;
+    hash        = Hash_Float(hash, emitter.timer);
+    for (auto const& particle : emitter.particles)
+    {
+        hash = Particle_Hash(hash, particle);
+    }
+    return hash;
+}
+
+
+template <uint32 Features>
+uint64
+ParticleSystem_Hash(ParticleSystem_Of<Features> const& system)
+{
+    uint64 hash = Hash_Seed;
+    for (auto const& emitter : system.emitters)
+    {
+        hash = Hash_Float(hash, emitter.timer);
+    }
+    for (size_t i = 0; i < system.particles.size(); ++i)
+    {
+        hash = Hash_Bytes(hash, &system.owners[i], sizeof(uint32));
+        hash = Particle_Hash(hash, system.particles[i]);
+    }
+    return hash;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "Particles/events.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include <vector>
+
+
+// Child emitters spawning from their parent's events. Each matching event
+// spawns count particles at the event's position, sampled from the child's
+// own spawn shape and parameters. Run once per tick on the merged events,
+// after the parent has integrated.
+
+// Spawns through Emitter_SpawnBatch, so the child's quota, budget and
+// policy apply as they do to its own spawns.
+template <uint32 Features, size_t Capacity>
+void
+Emitter_SpawnFromEvents(Emitter_Of<Features, Capacity>&    child,
+                        Sub_Emitter const&                 sub,
+                        std::vector<Particle_Event> const& events)
+{
+    for (auto const& event : events)
+    {
+        if (!SubEmitter_Matches(sub, event))
+        {
+            continue;
+        }
+
+        Spawn_Offset offset { event.pos, event.vel * sub.inherit_velocity };
+        Emitter_SpawnBatch(child, sub.count, &offset);
+    }
+}
+
+
+template <uint32 Features>
+void
+ParticleSystem_SpawnFromEvents(ParticleSystem_Of<Features>&       system,
+                               Emitter_ID                         child,
+                               Sub_Emitter const&                 sub,
+                               std::vector<Particle_Event> const& events)
+{
+    auto* emitter = ParticleSystem_Find(system, child);
+    if (!emitter)
+    {
+        return;
+    }
+
+    // Spawn at each event by moving the child there. Spawning adds particles,
+    // never emitters, so the pointer stays good.
+    auto home = emitter->pos;
+    for (auto const& event : events)
+    {
+        if (!SubEmitter_Matches(sub, event))
+        {
+            continue;
+        }
+
+        auto first = system.particles.size();
+        emitter->pos = event.pos;
+        ParticleSystem_Spawn(system, child.index, sub.count);
+
+        for (auto i = first; i < system.particles.size(); ++i)
+        {
+            system.particles[i].vel += event.vel * sub.inherit_velocity;
+        }
+    }
+    emitter->pos = home;
+}
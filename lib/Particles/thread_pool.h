@@ -0,0 +1,143 @@
+#pragma once
+#include "Base/typedefs.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A fixed set of worker threads for splitting a pass over particles. The
+// calling thread works too, as worker 0. Workers sleep between jobs; the
+// only locking is the hand off at the start and end of a job, never inside
+// the pass itself. Jobs are passed by pointer rather than wrapped in a
+// std::function, so running one doesn't allocate.
+
+struct Thread_Pool
+{
+    std::vector<std::thread> threads;
+
+    std::mutex              mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+
+    // The running job, job(context, worker).
+    void (*job)(void const*, int) { nullptr };
+    void const* context { nullptr };
+
+    uint64 generation { 0 };
+    int    pending { 0 };
+    bool   quit { false };
+};
+
+
+int
+ThreadPool_Size(Thread_Pool const& pool)
+{
+    return static_cast<int>(pool.threads.size()) + 1;
+}
+
+
+void
+ThreadPool_Worker(Thread_Pool& pool, int worker)
+{
+    uint64 seen = 0;
+    for (;;)
+    {
+        void (*job)(void const*, int);
+        void const* context;
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.start.wait(lock, [&] { return pool.quit || pool.generation != seen; });
+            if (pool.quit)
+            {
+                return;
+            }
+            seen    = pool.generation;
+            job     = pool.job;
+            context = pool.context;
+        }
+
+        job(context, worker);
+
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (--pool.pending == 0)
+        {
+            pool.done.notify_one();
+        }
+    }
+}
+
+
+// n_threads counts the caller, so 1 starts no workers.
+void
+ThreadPool_Init(Thread_Pool& pool, int n_threads)
+{
+    for (int i = 1; i < n_threads; ++i)
+    {
+        pool.threads.emplace_back([&pool, i] { ThreadPool_Worker(pool, i); });
+    }
+}
+
+
+void
+ThreadPool_Free(Thread_Pool& pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.quit = true;
+    }
+    pool.start.notify_all();
+    for (auto& thread : pool.threads)
+    {
+        thread.join();
+    }
+    pool.threads.clear();
+}
+
+
+// Runs job(worker) once on every worker, including the caller, and waits
+// for them all.
+template <typename Job>
+void
+ThreadPool_Run(Thread_Pool& pool, Job const& job)
+{
+    if (pool.threads.empty())
+    {
+        job(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.job     = [](void const* context, int worker) { (*static_cast<Job const*>(context))(worker); };
+        pool.context = &job;
+        pool.pending = static_cast<int>(pool.threads.size());
+        pool.generation += 1;
+    }
+    pool.start.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&] { return pool.pending == 0; });
+}
+
+
+// Splits [0, n) into one contiguous range per worker. Ranges are in worker
+// order, so anything written per worker and concatenated in worker order
+// comes out in index order whatever the thread count.
+template <typename Body>
+void
+ThreadPool_For(Thread_Pool& pool, size_t n, Body const& body)
+{
+    auto workers = static_cast<size_t>(ThreadPool_Size(pool));
+    ThreadPool_Run(pool, [&](int worker) {
+        size_t begin = n * worker / workers;
+        size_t end   = n * (worker + 1) / workers;
+        if (begin < end)
+        {
+            body(worker, begin, end);
+        }
+    });
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include "Base/typedefs.h"
+#include "GeometricAlgebra/geometric_algebra.h"
+#include <vector>
+
+
+// Position history for trail effects. Each trailing particle owns a slot,
+// and each slot is a fixed length ring buffer. Every slot lives in one pool,
+// stored as separate x, y and z arrays, so recording a tick and building
+// ribbons are flat passes over contiguous floats. Slots are recycled, so
+// nothing is allocated after Trail_Init. Pools can be shared between
+// emitters; each emitter keeps its own recording clock.
+
+constexpr uint32 Trail_None = ~0u;
+
+struct Trail_Pool
+{
+    uint32 slots { 0 };
+    uint32 samples { 0 };
+
+    // slots * samples, slot major.
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    // Per slot. head is the newest sample.
+    std::vector<uint16> head;
+    std::vector<uint16> count;
+
+    std::vector<uint32> free_slots;
+
+    // Record a sample every interval_sec rather than every tick, so a trail's
+    // length in time doesn't depend on the tick rate.
+    float interval_sec { 1.0f / 30.0f };
+};
+
+
+// A slot's ring is indexed by uint16, which bounds samples. A pool with no
+// samples has no slots either, so every Trail_Acquire fails.
+void
+Trail_Init(Trail_Pool& pool, uint32 slots, uint32 samples)
+{
+    samples = (samples < 0xffff) ? samples : 0xffff;
+    slots   = (samples > 0) ? slots : 0;
+
+    pool.slots   = slots;
+    pool.samples = samples;
+    pool.x.assign(size_t(slots) * samples, 0.0f);
+    pool.y.assign(size_t(slots) * samples, 0.0f);
+    pool.z.assign(size_t(slots) * samples, 0.0f);
+    pool.head.assign(slots, 0);
+    pool.count.assign(slots, 0);
+
+    pool.free_slots.resize(slots);
+    for (uint32 i = 0; i < slots; ++i)
+    {
+        // Hand out low slots first.
+        pool.free_slots[i] = slots - 1 - i;
+    }
+}
+
+
+// Returns Trail_None when the pool is exhausted; the particle just doesn't
+// get a trail.
+uint32
+Trail_Acquire(Trail_Pool& pool)
+{
+    if (pool.free_slots.empty())
+    {
+        return Trail_None;
+    }
+    auto slot = pool.free_slots.back();
+    pool.free_slots.pop_back();
+    pool.head[slot]  = 0;
+    pool.count[slot] = 0;
+    return slot;
+}
+
+
+void
+Trail_Release(Trail_Pool& pool, uint32 slot)
+{
+    if (slot != Trail_None)
+    {
+        pool.free_slots.push_back(slot);
+    }
+}
+
+
+void
+Trail_Push(Trail_Pool& pool, uint32 slot, Vec const& pos)
+{
+    if (slot == Trail_None)
+    {
+        return;
+    }
+    auto head = static_cast<uint16>((pool.head[slot] + 1) % pool.samples);
+    auto i    = size_t(slot) * pool.samples + head;
+
+    pool.x[i]        = pos.x;
+    pool.y[i]        = pos.y;
+    pool.z[i]        = pos.z;
+    pool.head[slot]  = head;
+    pool.count[slot] = (pool.count[slot] < pool.samples) ? pool.count[slot] + 1 : pool.count[slot];
+}
+
+
+// The kth newest sample of a slot, k < count.
+Vec
+Trail_Sample(Trail_Pool const& pool, uint32 slot, uint32 k)
+{
+    auto j = (pool.head[slot] + pool.samples - k) % pool.samples;
+    auto i = size_t(slot) * pool.samples + j;
+    return Vec { pool.x[i], pool.y[i], pool.z[i] };
+}
+
+
+// Advances an emitter's recording clock, accum_sec, at the pool's interval.
+// Returns true when this tick should record.
+bool
+Trail_Tick(Trail_Pool const& pool, float& accum_sec, float time_sec)
+{
+    accum_sec += time_sec;
+    if (accum_sec < pool.interval_sec)
+    {
+        return false;
+    }
+    accum_sec -= pool.interval_sec;
+    if (accum_sec > pool.interval_sec)
+    {
+        accum_sec = 0.0f;
+    }
+    return true;
+}
@@ -0,0 +1,854 @@
+#include "Base/typedefs.h"
+#include "Particles/backend.h"
+#include "Particles/billboard.h"
+#include "Particles/collision.h"
+#include "Particles/curves.h"
+#include "Particles/particle.h"
+#include "Particles/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+// Stress scenario. Thousands of emitters, around two million particles,
+// with curves, drag, sub-stepping and collision on, run headless for a
+// fixed number of ticks. Every stage is timed across all emitters each
+// tick, and the report gives p50/p95/p99 per stage, throughput, peak RSS
+// and allocation counts as JSON. Given a baseline report, anything slower,
+// bigger or allocating more than the tolerances allow fails the run.
+//
+//     stress_particles [--emitters n] [--ticks n] [--warmup n] [--threads n]
+//                      [--backend scalar|simd|threaded] [--seed n]
+//                      [--out file] [--record file] [--baseline file]
+//                      [--time-tol f] [--tail-tol f] [--time-floor-ms f]
+//                      [--rss-tol f] [--alloc-tol f]
+//
+// Stages run through the backend, simd unless given, as Backend_Integrate
+// runs them. Scalar and simd spread the emitters across the pool. Threaded
+// runs the emitters one after another and splits each across the pool.
+// The report's scenario.backend is the index into Backend_Names.
+//
+// Timings only compare between runs on the same machine and settings, so
+// record a baseline on the machine that checks against it.
+//
+// Steady state ticks shouldn't allocate. The few that still do come from
+// scratch vectors (compaction, ages, reordering) reaching their high-water mark
+// during the first measured ticks; a longer warmup takes the count to
+// about zero. The check holds ticks to the baseline's count.
+//
+// The repo has no build files. The library needs Base/ (typedefs.h and
+// containers/backfill_vector.hpp) and GeometricAlgebra/ on the include
+// path; they live outside this repo. Then, from the repo root:
+//
+//     g++ -std=c++20 -O2 -pthread -I<path to Base and GeometricAlgebra>
+//         -Ilib test/stress_particles.cpp -o stress_particles
+//     ./stress_particles --baseline test/baseline/stress_particles.json
+
+constexpr uint32 Stress_Features = Particle_Feature_Acceleration | Particle_Feature_Size | Particle_Feature_Color;
+constexpr size_t Stress_Capacity = 1024;
+
+using Stress_Emitter = Emitter_Of<Stress_Features, Stress_Capacity>;
+
+static float const Tick_Sec = 1.0f / 60.0f;
+
+
+// Every allocation in the process, so steady state ticks can be held to
+// allocating nothing (or no more than they used to).
+static std::atomic<uint64> alloc_count { 0 };
+static std::atomic<uint64> alloc_bytes { 0 };
+
+void*
+operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC can't see that the matching operator new above came from malloc.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void
+operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+
+enum Stress_Stage : uint32
+{
+    Stress_Spawn,
+    Stress_Integrate,
+    Stress_Affect,
+    Stress_Compact,
+    Stress_Bounds,
+    Stress_Reorder,
+    Stress_Collide,
+    Stress_Billboards,
+    Stress_Tick, // The whole tick, stages back to back.
+    Stress_Stage_Count
+};
+
+static char const* const Stress_Stage_Names[Stress_Stage_Count] = {
+    "spawn", "integrate", "affect", "compact", "bounds", "reorder", "collide", "billboards", "tick",
+};
+
+
+struct Stress_Options
+{
+    int    emitters { 2048 };
+    int    ticks { 300 };
+    int    warmup { 150 }; // Long enough for the emitters to fill up.
+    int    threads { 0 };  // Zero for one per hardware thread.
+    uint64 seed { 1 };
+
+    Backend_Kind backend { Backend_SIMD };
+
+    char const* out { nullptr };
+    char const* record { nullptr };
+    char const* baseline { nullptr };
+
+    float time_tol { 0.10f };      // Relative slack on medians and throughput.
+    float tail_tol { 0.25f };      // On p95 and p99, which are noisier.
+    float time_floor_ms { 0.05f }; // Differences under this are noise.
+    float rss_tol { 0.10f };
+    float alloc_tol { 0.0f };
+};
+
+
+struct Stress_Scene
+{
+    Particle_Backend            backend;
+    std::vector<Stress_Emitter> emitters;
+    Emitter_Curves              curves;
+
+    Height_Field       ground;
+    Collision_World    world;
+    Collision_Material material;
+
+    Billboard_Camera                          camera;
+    std::vector<std::vector<Particle_Vertex>> vertices; // Per worker.
+};
+
+
+struct Stress_Report
+{
+    Stress_Options options;
+    int            threads { 0 };
+
+    std::vector<float> samples[Stress_Stage_Count]; // Milliseconds, per measured tick.
+
+    uint64 particles_final { 0 };
+    uint64 particles_peak { 0 };
+    uint64 particle_ticks { 0 }; // Live particles summed over measured ticks.
+    double integrate_ms { 0.0 };
+
+    uint64 rss_peak_kb { 0 };
+    uint64 allocs_setup { 0 };
+    uint64 allocs_ticks { 0 };
+    uint64 alloc_bytes_ticks { 0 };
+};
+
+
+static uint64
+Stress_PeakRSS()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize / 1024;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<uint64>(usage.ru_maxrss) / 1024; // Bytes on macOS.
+#else
+    return static_cast<uint64>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+
+// A bumpy floor under the emitters, with a ring of cones and a few
+// capsules to bounce off.
+static void
+Stress_BuildWorld(Stress_Scene& scene)
+{
+    HeightField_Init(scene.ground, Vec { -32.0f, -2.0f, -32.0f }, 1.0f, 64, 64);
+    for (int r = 0; r <= 64; ++r)
+    {
+        for (int c = 0; c <= 64; ++c)
+        {
+            HeightField_At(scene.ground, c, r) = 0.75f * sinf(0.4f * c) * cosf(0.3f * r);
+        }
+    }
+    HeightField_BuildMips(scene.ground);
+    scene.world.ground = &scene.ground;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        float a = 2.0f * float(M_PI) * i / 8.0f;
+        scene.world.cylinders.push_back({ Vec { 6.0f * cosf(a), -2.0f, 6.0f * sinf(a) }, 1.5f, 0.0f, 4.0f });
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        float a = 2.0f * float(M_PI) * (i + 0.5f) / 4.0f;
+        Vec   p = { 3.0f * cosf(a), 3.0f, 3.0f * sinf(a) };
+        scene.world.capsules.push_back({ p, Vec { p.x, p.y + 2.0f, p.z }, 0.75f });
+    }
+}
+
+
+// Emitters differ in shape, velocity and drag, from their own seed, so the
+// scene is the same on every run.
+static void
+Stress_BuildScene(Stress_Scene& scene, Stress_Options const& options, int threads)
+{
+    Curve_Key size[]  = { { 0.0f, 0.2f }, { 0.3f, 1.0f }, { 1.0f, 0.0f } };
+    Curve_Key alpha[] = { { 0.0f, 1.0f }, { 0.7f, 0.8f }, { 1.0f, 0.0f } };
+    Curve_Key fade[]  = { { 0.0f, 1.0f }, { 1.0f, 0.2f } };
+    scene.curves.channels = Curve_Channel_Size | Curve_Channel_Color;
+    Curve_Bake(scene.curves.size, size, 3);
+    Curve_BakeConstant(scene.curves.r, 1.0f);
+    Curve_Bake(scene.curves.g, fade, 2);
+    Curve_Bake(scene.curves.b, fade, 2);
+    Curve_Bake(scene.curves.a, alpha, 3);
+
+    Stress_BuildWorld(scene);
+
+    Spawn_Shape shapes[4] = { Spawn_Shape_Sphere, Spawn_Shape_Box, Spawn_Shape_Disc, Spawn_Shape_Hemisphere };
+
+    scene.emitters.resize(options.emitters);
+    for (int i = 0; i < options.emitters; ++i)
+    {
+        auto& emitter = scene.emitters[i];
+        Emitter_Seed(emitter, options.seed * 7919 + i);
+
+        auto u = [&] { return Random_Float(emitter.rng); };
+
+        auto& params         = emitter.params;
+        params.spawn.shape   = shapes[i % 4];
+        params.spawn.extents = Vec { 0.5f + u(), 0.5f + u(), 0.5f + u() };
+        params.velocity      = Vec { 4.0f * (u() - 0.5f), 6.0f + 6.0f * u(), 4.0f * (u() - 0.5f) };
+        params.spread_deg    = 20 + (i % 7) * 10;
+        params.speed         = 2.0f * u();
+        params.lifetime_sec  = 2.0f;
+
+        params.lifetime_jitter_sec = 0.5f;
+        params.drag                = 0.1f + 0.4f * u();
+        params.substep_cell        = 0.25f;
+
+        // About 500 spawns a second against a two second life keeps each
+        // emitter close to its capacity.
+        emitter.rate           = 1.0f / 500.0f;
+        emitter.curves         = &scene.curves;
+        emitter.render_mode    = Render_Mode_Billboard;
+        emitter.reorder.budget = 256;
+    }
+
+    scene.camera = Billboard_CameraFromLookAt(Vec { 0.0f, 10.0f, 40.0f }, Vec { 0.0f, 2.0f, 0.0f }, Vec { 0.0f, 1.0f, 0.0f });
+    scene.vertices.resize(threads);
+    for (auto& out : scene.vertices)
+    {
+        out.resize(Stress_Capacity * 4);
+    }
+}
+
+
+// Runs a stage over every emitter, spread across the pool, and returns its
+// wall time in milliseconds. The threaded backend has the pool to itself,
+// so its emitters go one at a time.
+template <typename Stage>
+static float
+Stress_Time(Thread_Pool& pool, Stress_Scene& scene, Stage const& stage)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (scene.backend.kind == Backend_Threaded)
+    {
+        for (auto& emitter : scene.emitters)
+        {
+            stage(0, emitter);
+        }
+    }
+    else
+    {
+        ThreadPool_For(pool, scene.emitters.size(), [&](int worker, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                stage(worker, scene.emitters[i]);
+            }
+        });
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+
+// One tick: the stages of Backend_Integrate in its order, then collision
+// and billboards, as the demo runs them. Returns each stage's time. Only
+// the scalar backend measures bounds as a stage of its own.
+static void
+Stress_Step(Thread_Pool& pool, Stress_Scene& scene, float* ms)
+{
+    auto& backend = scene.backend;
+    auto  start   = std::chrono::steady_clock::now();
+
+    ms[Stress_Spawn] = Stress_Time(pool, scene, [](int, Stress_Emitter& emitter) {
+        Emitter_Spawn(emitter, Tick_Sec);
+    });
+    ms[Stress_Integrate] = Stress_Time(pool, scene, [&](int, Stress_Emitter& emitter) {
+        Backend_IntegrateParticles(backend, emitter, Tick_Sec);
+    });
+    ms[Stress_Affect] = Stress_Time(pool, scene, [](int, Stress_Emitter& emitter) {
+        Emitter_Affect(emitter, Tick_Sec);
+    });
+    ms[Stress_Compact] = Stress_Time(pool, scene, [&](int, Stress_Emitter& emitter) {
+        Backend_Compact(backend, emitter);
+    });
+    ms[Stress_Bounds] = Stress_Time(pool, scene, [&](int, Stress_Emitter& emitter) {
+        if (Backend_Resolve(backend) == Backend_Scalar)
+        {
+            Emitter_MeasureBounds(emitter);
+        }
+    });
+    ms[Stress_Reorder] = Stress_Time(pool, scene, [](int, Stress_Emitter& emitter) {
+        Emitter_Reorder(emitter);
+    });
+    ms[Stress_Collide] = Stress_Time(pool, scene, [&](int, Stress_Emitter& emitter) {
+        Emitter_Collide(emitter, scene.world, scene.material);
+    });
+    ms[Stress_Billboards] = Stress_Time(pool, scene, [&](int worker, Stress_Emitter& emitter) {
+        auto& out = scene.vertices[worker];
+        Backend_WriteBillboards(backend, out.data(), Stress_Capacity, emitter, scene.camera, 0.05f, Particle_Color { 255, 255, 255, 255 });
+    });
+
+    auto stop       = std::chrono::steady_clock::now();
+    ms[Stress_Tick] = std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+
+static uint64
+Stress_LiveParticles(Stress_Scene const& scene)
+{
+    uint64 live = 0;
+    for (auto& emitter : scene.emitters)
+    {
+        live += emitter.particles.size();
+    }
+    return live;
+}
+
+
+static void
+Stress_Run(Stress_Options const& options, Stress_Report& report)
+{
+    int threads = options.threads;
+    if (threads <= 0)
+    {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        threads = (threads > 0) ? threads : 1;
+    }
+    report.options = options;
+    report.threads = threads;
+
+    Thread_Pool pool;
+    ThreadPool_Init(pool, threads);
+
+    Stress_Scene scene;
+    scene.backend = { options.backend, &pool };
+    Stress_BuildScene(scene, options, threads);
+
+    float ms[Stress_Stage_Count];
+    for (int tick = 0; tick < options.warmup; ++tick)
+    {
+        Stress_Step(pool, scene, ms);
+    }
+
+    for (auto& samples : report.samples)
+    {
+        samples.reserve(options.ticks);
+    }
+    report.allocs_setup = alloc_count.load();
+
+    uint64 bytes_before = alloc_bytes.load();
+    for (int tick = 0; tick < options.ticks; ++tick)
+    {
+        Stress_Step(pool, scene, ms);
+        for (uint32 s = 0; s < Stress_Stage_Count; ++s)
+        {
+            report.samples[s].push_back(ms[s]);
+        }
+
+        uint64 live           = Stress_LiveParticles(scene);
+        report.particles_peak = (live > report.particles_peak) ? live : report.particles_peak;
+        report.particle_ticks += live;
+        report.integrate_ms += ms[Stress_Integrate];
+    }
+    report.allocs_ticks      = alloc_count.load() - report.allocs_setup;
+    report.alloc_bytes_ticks = alloc_bytes.load() - bytes_before;
+
+    report.particles_final = Stress_LiveParticles(scene);
+    report.rss_peak_kb     = Stress_PeakRSS();
+
+    ThreadPool_Free(pool);
+}
+
+
+// Nearest rank.
+static float
+Stress_Percentile(std::vector<float> samples, float p)
+{
+    if (samples.empty())
+    {
+        return 0.0f;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(ceilf(p / 100.0f * samples.size()));
+    rank        = (rank < 1) ? 1 : rank;
+    return samples[rank - 1];
+}
+
+
+static double
+Stress_Throughput(Stress_Report const& report)
+{
+    return (report.integrate_ms > 0.0) ? report.particle_ticks / (report.integrate_ms / 1000.0) : 0.0;
+}
+
+
+static void
+Stress_Append(std::string& out, char const* format, ...)
+{
+    char    line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out += line;
+}
+
+
+static std::string
+Stress_ToJSON(Stress_Report const& report)
+{
+    auto&       options = report.options;
+    std::string json;
+    Stress_Append(json, "{\n");
+    Stress_Append(json, "  \"scenario\": {\n");
+    Stress_Append(json, "    \"emitters\": %d,\n", options.emitters);
+    Stress_Append(json, "    \"capacity\": %zu,\n", Stress_Capacity);
+    Stress_Append(json, "    \"ticks\": %d,\n", options.ticks);
+    Stress_Append(json, "    \"warmup\": %d,\n", options.warmup);
+    Stress_Append(json, "    \"threads\": %d,\n", report.threads);
+    Stress_Append(json, "    \"backend\": %u,\n", static_cast<uint32>(options.backend));
+    Stress_Append(json, "    \"seed\": %llu\n", static_cast<unsigned long long>(options.seed));
+    Stress_Append(json, "  },\n");
+    Stress_Append(json, "  \"particles\": {\n");
+    Stress_Append(json, "    \"final\": %llu,\n", static_cast<unsigned long long>(report.particles_final));
+    Stress_Append(json, "    \"peak\": %llu\n", static_cast<unsigned long long>(report.particles_peak));
+    Stress_Append(json, "  },\n");
+    Stress_Append(json, "  \"stages\": {\n");
+    for (uint32 s = 0; s < Stress_Stage_Count; ++s)
+    {
+        auto& samples = report.samples[s];
+        Stress_Append(json,
+                      "    \"%s\": { \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f }%s\n",
+                      Stress_Stage_Names[s],
+                      Stress_Percentile(samples, 50.0f),
+                      Stress_Percentile(samples, 95.0f),
+                      Stress_Percentile(samples, 99.0f),
+                      (s + 1 < Stress_Stage_Count) ? "," : "");
+    }
+    Stress_Append(json, "  },\n");
+    Stress_Append(json, "  \"throughput\": { \"particles_per_sec\": %.0f },\n", Stress_Throughput(report));
+    Stress_Append(json, "  \"memory\": { \"peak_rss_kb\": %llu },\n", static_cast<unsigned long long>(report.rss_peak_kb));
+    Stress_Append(json, "  \"allocations\": {\n");
+    Stress_Append(json, "    \"setup\": %llu,\n", static_cast<unsigned long long>(report.allocs_setup));
+    Stress_Append(json, "    \"ticks\": %llu,\n", static_cast<unsigned long long>(report.allocs_ticks));
+    Stress_Append(json, "    \"ticks_bytes\": %llu\n", static_cast<unsigned long long>(report.alloc_bytes_ticks));
+    Stress_Append(json, "  }\n");
+    Stress_Append(json, "}\n");
+    return json;
+}
+
+
+// The numbers in a report, by dotted path ("stages.tick.p99_ms"). Only
+// reads what Stress_ToJSON writes: objects, string keys and numbers.
+struct Stress_Value
+{
+    std::string path;
+    double      value;
+};
+
+static bool
+Stress_ParseObject(char const*& at, std::string const& prefix, std::vector<Stress_Value>& values)
+{
+    auto skip = [&] {
+        while (*at == ' ' || *at == '\n' || *at == '\r' || *at == '\t')
+        {
+            ++at;
+        }
+    };
+
+    skip();
+    if (*at++ != '{')
+    {
+        return false;
+    }
+    for (;;)
+    {
+        skip();
+        if (*at == '}')
+        {
+            ++at;
+            return true;
+        }
+        if (*at++ != '"')
+        {
+            return false;
+        }
+        char const* key = at;
+        while (*at && *at != '"')
+        {
+            ++at;
+        }
+        if (!*at)
+        {
+            return false;
+        }
+        std::string path = prefix + std::string(key, at);
+        ++at;
+
+        skip();
+        if (*at++ != ':')
+        {
+            return false;
+        }
+        skip();
+        if (*at == '{')
+        {
+            if (!Stress_ParseObject(at, path + ".", values))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            char*  end;
+            double value = strtod(at, &end);
+            if (end == at)
+            {
+                return false;
+            }
+            values.push_back({ path, value });
+            at = end;
+        }
+
+        skip();
+        if (*at == ',')
+        {
+            ++at;
+        }
+    }
+}
+
+
+static bool
+Stress_ParseJSON(std::string const& text, std::vector<Stress_Value>& values)
+{
+    char const* at = text.c_str();
+    return Stress_ParseObject(at, "", values);
+}
+
+
+static bool
+Stress_ReadFile(char const* path, std::string& text)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    char   buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        text.append(buffer, n);
+    }
+    fclose(file);
+    return true;
+}
+
+
+static bool
+Stress_WriteFile(char const* path, std::string const& text)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "stress: can't write %s\n", path);
+        return false;
+    }
+    fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    return true;
+}
+
+
+static double const*
+Stress_Find(std::vector<Stress_Value> const& values, std::string const& path)
+{
+    for (auto& v : values)
+    {
+        if (v.path == path)
+        {
+            return &v.value;
+        }
+    }
+    return nullptr;
+}
+
+
+// Compares the current report against a baseline. Every metric that got
+// worse by more than its tolerance is printed, and the run fails.
+static bool
+Stress_Compare(Stress_Options const& options, std::vector<Stress_Value> const& baseline, std::vector<Stress_Value> const& current)
+{
+    int regressions = 0;
+
+    // Higher is worse, unless lower_is_worse.
+    auto check = [&](std::string const& path, float tol, float floor, bool lower_is_worse) {
+        auto* base = Stress_Find(baseline, path);
+        auto* now  = Stress_Find(current, path);
+        if (!base || !now)
+        {
+            fprintf(stderr, "stress: %s missing from %s\n", path.c_str(), base ? "report" : "baseline");
+            regressions += 1;
+            return;
+        }
+
+        double limit = lower_is_worse ? *base * (1.0 - tol) : *base * (1.0 + tol);
+        bool   worse = lower_is_worse ? *now < limit : *now > limit;
+        if (worse && fabs(*now - *base) > floor)
+        {
+            double change = (*base != 0.0) ? 100.0 * (*now - *base) / *base : 100.0;
+            fprintf(stderr,
+                    "REGRESSION %s: %.4f -> %.4f (%+.1f%%, tolerance %.1f%%)\n",
+                    path.c_str(),
+                    *base,
+                    *now,
+                    change,
+                    100.0 * tol);
+            regressions += 1;
+        }
+    };
+
+    // Timings from a different scene mean nothing.
+    char const* scenario[] = { "emitters", "capacity", "ticks", "warmup", "threads", "backend", "seed" };
+    for (auto* key : scenario)
+    {
+        auto  path = std::string("scenario.") + key;
+        auto* base = Stress_Find(baseline, path);
+        auto* now  = Stress_Find(current, path);
+        if (!base || !now || *base != *now)
+        {
+            fprintf(stderr, "stress: %s differs from the baseline, re-record it\n", path.c_str());
+            return false;
+        }
+    }
+
+    for (uint32 s = 0; s < Stress_Stage_Count; ++s)
+    {
+        auto stage = std::string("stages.") + Stress_Stage_Names[s];
+        check(stage + ".p50_ms", options.time_tol, options.time_floor_ms, false);
+        check(stage + ".p95_ms", options.tail_tol, options.time_floor_ms, false);
+        check(stage + ".p99_ms", options.tail_tol, options.time_floor_ms, false);
+    }
+    check("throughput.particles_per_sec", options.time_tol, 0.0f, true);
+    check("memory.peak_rss_kb", options.rss_tol, 0.0f, false);
+    check("allocations.ticks", options.alloc_tol, 0.0f, false);
+
+    if (regressions > 0)
+    {
+        fprintf(stderr, "stress: %d regression(s) against the baseline\n", regressions);
+    }
+    return regressions == 0;
+}
+
+
+static bool
+Stress_ParseOptions(int argc, char** argv, Stress_Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        char const* arg   = argv[i];
+        char const* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            fprintf(stderr, "stress: %s needs a value\n", arg);
+            return false;
+        }
+
+        if (strcmp(arg, "--emitters") == 0)
+        {
+            options.emitters = atoi(value);
+        }
+        else if (strcmp(arg, "--ticks") == 0)
+        {
+            options.ticks = atoi(value);
+        }
+        else if (strcmp(arg, "--warmup") == 0)
+        {
+            options.warmup = atoi(value);
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+            options.threads = atoi(value);
+        }
+        else if (strcmp(arg, "--backend") == 0)
+        {
+            if (!Backend_Parse(value, options.backend))
+            {
+                fprintf(stderr, "stress: unknown backend %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--seed") == 0)
+        {
+            options.seed = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--out") == 0)
+        {
+            options.out = value;
+        }
+        else if (strcmp(arg, "--record") == 0)
+        {
+            options.record = value;
+        }
+        else if (strcmp(arg, "--baseline") == 0)
+        {
+            options.baseline = value;
+        }
+        else if (strcmp(arg, "--time-tol") == 0)
+        {
+            options.time_tol = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--tail-tol") == 0)
+        {
+            options.tail_tol = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--time-floor-ms") == 0)
+        {
+            options.time_floor_ms = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--rss-tol") == 0)
+        {
+            options.rss_tol = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--alloc-tol") == 0)
+        {
+            options.alloc_tol = strtof(value, nullptr);
+        }
+        else
+        {
+            fprintf(stderr, "stress: unknown option %s\n", arg);
+            return false;
+        }
+        ++i;
+    }
+
+    if (options.emitters <= 0 || options.ticks <= 0 || options.warmup < 0)
+    {
+        fprintf(stderr, "stress: emitters and ticks must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+
+int
+main(int argc, char** argv)
+{
+    Stress_Options options;
+    if (!Stress_ParseOptions(argc, argv, options))
+    {
+        return 2;
+    }
+
+    Stress_Report report;
+    Stress_Run(options, report);
+
+    auto json = Stress_ToJSON(report);
+    if (options.out)
+    {
+        if (!Stress_WriteFile(options.out, json))
+        {
+            return 2;
+        }
+    }
+    else
+    {
+        fputs(json.c_str(), stdout);
+    }
+
+    if (options.record)
+    {
+        if (!Stress_WriteFile(options.record, json))
+        {
+            return 2;
+        }
+        fprintf(stderr, "recorded %s\n", options.record);
+    }
+
+    if (options.baseline)
+    {
+        // The current side is parsed back from its own text, so both are
+        // compared at the precision the baseline was stored at.
+        std::string               text;
+        std::vector<Stress_Value> baseline, current;
+        if (!Stress_ReadFile(options.baseline, text) || !Stress_ParseJSON(text, baseline))
+        {
+            fprintf(stderr, "stress: can't read baseline %s, run with --record\n", options.baseline);
+            return 2;
+        }
+        Stress_ParseJSON(json, current);
+
+        if (!Stress_Compare(options, baseline, current))
+        {
+            return 1;
+        }
+        fprintf(stderr, "stress: within tolerance of %s\n", options.baseline);
+    }
+    return 0;
+}
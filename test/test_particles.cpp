@@ -0,0 +1,2035 @@
+#include "Base/typedefs.h"
+#include "Particles/backend.h"
+#include "Particles/billboard.h"
+#include "Particles/bounds_tree.h"
+#include "Particles/collision.h"
+#include "Particles/compact.h"
+#include "Particles/depth_sort.h"
+#include "Particles/effect.h"
+#include "Particles/frame_pipeline.h"
+#include "Particles/hot_reload.h"
+#include "Particles/particle.h"
+#include "Particles/particle_system.h"
+#include "Particles/ribbon.h"
+#include "Particles/simulation_lod.h"
+#include "Particles/snapshot.h"
+#include "Particles/state_hash.h"
+#include "Particles/sub_emitter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+// Golden trace tests. Each scenario hashes the simulation state every tick
+// and compares against a trace recorded from a known good build. Run with
+// --record to (re)write the traces after an intentional behaviour change.
+//
+//     test_particles [--record] [golden_dir]
+//
+// The traces in test/golden were recorded at -O0 through -O3 with GCC on
+// x86-64, where they agree. A build whose maths differs will diverge and
+// needs its own traces. A scenario without a trace fails.
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures += 1;                                                  \
+        }                                                                   \
+    } while (0)
+
+
+static float const Tick_Sec = 1.0f / 60.0f;
+static int const   N_Ticks  = 600;
+
+
+static std::vector<uint64>
+Trace_Emitter(uint64 seed)
+{
+    std::vector<uint64> trace;
+
+    Emitter emitter;
+    Emitter_Seed(emitter, seed);
+
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+        trace.push_back(Emitter_Hash(emitter));
+    }
+    return trace;
+}
+
+
+static std::vector<uint64>
+Trace_System(uint64 seed)
+{
+    std::vector<uint64> trace;
+
+    ParticleSystem system;
+    system.seed = seed;
+
+    std::vector<Emitter_ID> ids;
+    for (int i = 0; i < 64; ++i)
+    {
+        auto id = ParticleSystem_CreateEmitter(system);
+        ParticleSystem_SetTransform(system,
+                                    id,
+                                    Vec { float(i % 8) * 4.0f, 0.0f, float(i / 8) * 4.0f },
+                                    Vec { 0.0f, 0.0f, 0.0f });
+        system.emitters[id.index].rate = 0.1f + 0.01f * i;
+        ids.push_back(id);
+    }
+
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        // Exercise slot recycling.
+        if (tick == N_Ticks / 2)
+        {
+            for (int i = 0; i < 64; i += 3)
+            {
+                ParticleSystem_DestroyEmitter(system, ids[i]);
+            }
+            for (int i = 0; i < 8; ++i)
+            {
+                ParticleSystem_CreateEmitter(system);
+            }
+        }
+
+        ParticleSystem_Integrate(system, Tick_Sec);
+        trace.push_back(ParticleSystem_Hash(system));
+    }
+    return trace;
+}
+
+
+static bool
+Trace_Write(std::string const& path, std::vector<uint64> const& trace)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        return false;
+    }
+    for (auto hash : trace)
+    {
+        fprintf(file, "%016" PRIx64 "\n", hash);
+    }
+    fclose(file);
+    return true;
+}
+
+
+static bool
+Trace_Read(std::string const& path, std::vector<uint64>& trace)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        return false;
+    }
+    uint64 hash;
+    while (fscanf(file, "%" SCNx64, &hash) == 1)
+    {
+        trace.push_back(hash);
+    }
+    fclose(file);
+    return true;
+}
+
+
+static void
+Trace_Check(std::string const&         dir,
+            char const*                name,
+            std::vector<uint64> const& trace,
+            bool                       record)
+{
+    auto path = dir + "/" + name + ".trace";
+    if (record)
+    {
+        CHECK(Trace_Write(path, trace));
+        printf("recorded %s\n", path.c_str());
+        return;
+    }
+
+    std::vector<uint64> golden;
+    if (!Trace_Read(path, golden))
+    {
+        printf("%s: no golden trace (record with --record)\n", path.c_str());
+        failures += 1;
+        return;
+    }
+
+    CHECK(golden.size() == trace.size());
+    for (size_t tick = 0; tick < golden.size() && tick < trace.size(); ++tick)
+    {
+        if (golden[tick] != trace[tick])
+        {
+            printf("%s: diverged at tick %zu\n", name, tick);
+            failures += 1;
+            return;
+        }
+    }
+}
+
+
+// Curves are sampled at each particle's normalised age, across batch
+// boundaries, and land in the size and colour channels.
+static void
+Test_Curves()
+{
+    Curve_Key grow[] = { { 0.0f, 1.0f }, { 1.0f, 3.0f } };
+    Curve_Key fade[] = { { 0.0f, 1.0f }, { 1.0f, 0.0f } };
+
+    Emitter_Curves curves;
+    curves.channels = Curve_Channel_Size | Curve_Channel_Color;
+    Curve_Bake(curves.size, grow, 2);
+    Curve_BakeConstant(curves.r, 0.5f);
+    Curve_BakeConstant(curves.g, 0.0f);
+    Curve_BakeConstant(curves.b, 1.0f);
+    Curve_Bake(curves.a, fade, 2);
+
+    CHECK(Curve_Sample(curves.size, 0.0f) == 1.0f);
+    CHECK(Curve_Sample(curves.size, 1.0f) == 3.0f);
+    CHECK(fabsf(Curve_Sample(curves.size, 0.5f) - 2.0f) < 1e-3f);
+    CHECK(Curve_Sample(curves.size, -1.0f) == 1.0f && Curve_Sample(curves.size, 2.0f) == 3.0f);
+
+    // More than one batch, ages evenly spread over [0, 1].
+    Emitter_Of<Particle_Feature_Size | Particle_Feature_Color, 128> emitter;
+    int const n = 100;
+    for (int i = 0; i < n; ++i)
+    {
+        emitter.particles.allocate();
+        auto& particle = emitter.particles.back();
+        Particle_Init(particle);
+        particle.duration_sec = 2.0f;
+        particle.lifetime_sec = 2.0f * (1.0f - i / float(n - 1));
+    }
+    Emitter_ApplyCurves(emitter, curves, Tick_Sec);
+
+    for (int i = 0; i < n; ++i)
+    {
+        auto& particle = emitter.particles[i];
+        float age      = i / float(n - 1);
+        CHECK(fabsf(particle.size - Curve_Evaluate(grow, 2, age)) < 2e-3f);
+        CHECK(particle.color.r == 128 && particle.color.g == 0 && particle.color.b == 255);
+        CHECK(abs(int(particle.color.a) - int(Curve_ToByte(Curve_Evaluate(fade, 2, age)))) <= 1);
+    }
+    CHECK(emitter.particles[0].size == 1.0f && emitter.particles[0].color.a == 255);
+    CHECK(emitter.particles[n - 1].size == 3.0f && emitter.particles[n - 1].color.a == 0);
+}
+
+
+// Emitters are classified by distance and visibility, skipped time is
+// banked, and a returning emitter catches up in at most max_steps steps.
+static void
+Test_LOD()
+{
+    LOD_Settings settings;
+    auto         camera = LOD_CameraFromLookAt(Vec { 0.0f, 0.0f, 0.0f }, Vec { 0.0f, 0.0f, 1.0f }, 60.0f, 1.0f);
+
+    Emitter_LOD lod;
+    LOD_Classify(lod, settings, camera, Vec { 0.0f, 0.0f, 10.0f }, 1.0f);
+    CHECK(lod.visible && lod.divisor == settings.near_divisor);
+    LOD_Classify(lod, settings, camera, Vec { 0.0f, 0.0f, 40.0f }, 1.0f);
+    CHECK(lod.visible && lod.divisor == settings.mid_divisor);
+    LOD_Classify(lod, settings, camera, Vec { 0.0f, 0.0f, 100.0f }, 1.0f);
+    CHECK(lod.visible && lod.divisor == settings.far_divisor);
+    LOD_Classify(lod, settings, camera, Vec { 0.0f, 0.0f, -10.0f }, 1.0f);
+    CHECK(!lod.visible && lod.divisor == settings.hidden_divisor);
+
+    // Behind the camera, but big enough to reach into view.
+    LOD_Classify(lod, settings, camera, Vec { 0.0f, 0.0f, -10.0f }, 12.0f);
+    CHECK(lod.visible);
+
+    // Every fourth tick runs, with the time of all four.
+    lod         = {};
+    lod.divisor = 4;
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            CHECK(LOD_Advance(lod, Tick_Sec, false, 1) == 0.0f);
+        }
+        CHECK(fabsf(LOD_Advance(lod, Tick_Sec, false, 1) - 4.0f * Tick_Sec) < 1e-6f);
+        CHECK(lod.pending_sec == 0.0f);
+    }
+
+    // Paused with nothing alive sleeps and banks nothing.
+    CHECK(LOD_Advance(lod, Tick_Sec, true, 0) == 0.0f);
+    CHECK(lod.sleeping && lod.pending_sec == 0.0f);
+
+    // A long absence is caught up in max_steps steps. The long lived
+    // particle ages by the whole gap; the short lived one dies in it.
+    Emitter emitter;
+    emitter.paused = true;
+    for (float life : { 20.0f, 5.0f })
+    {
+        emitter.particles.allocate();
+        auto& particle = emitter.particles.back();
+        Particle_Init(particle);
+        particle.lifetime_sec = life;
+        particle.duration_sec = life;
+    }
+
+    lod         = {};
+    lod.divisor = 100;
+    for (int i = 0; i < 100; ++i)
+    {
+        Emitter_TickLOD(emitter, lod, settings, 0.1f);
+        CHECK(emitter.particles.size() == ((i < 99) ? 2u : 1u));
+    }
+    CHECK(emitter.particles.size() == 1);
+    CHECK(fabsf(emitter.particles[0].lifetime_sec - 10.0f) < 1e-3f);
+    CHECK(lod.pending_sec == 0.0f);
+}
+
+
+// Back to front along the view direction, through both the insertion
+// repair and the radix fallback, with the order kept a permutation as
+// particles come and go.
+static void
+Test_DepthSort()
+{
+    Vec eye     = { 0.0f, 0.0f, 0.0f };
+    Vec forward = { 0.0f, 0.0f, 1.0f };
+
+    auto back_to_front = [](Depth_Sort const& sort, std::vector<Particle> const& particles) {
+        bool ok = sort.order.size() == particles.size();
+        std::vector<bool> seen(particles.size(), false);
+        for (size_t i = 0; ok && i < sort.order.size(); ++i)
+        {
+            ok = sort.order[i] < particles.size() && !seen[sort.order[i]];
+            if (ok)
+            {
+                seen[sort.order[i]] = true;
+            }
+            // Depths closer than the 16 bit key can tell apart may go
+            // either way.
+            if (ok && i > 0)
+            {
+                ok = particles[sort.order[i - 1]].pos.z >= particles[sort.order[i]].pos.z - 0.002f;
+            }
+        }
+        return ok;
+    };
+
+    Random rng;
+    Random_Seed(rng, 3);
+    std::vector<Particle> particles(500);
+    for (auto& particle : particles)
+    {
+        Particle_Init(particle);
+        particle.pos = Vec { 0.0f, 0.0f, 1.0f + 90.0f * Random_Float(rng) };
+    }
+
+    // From scratch, far too unsorted for the repair: the radix sort runs.
+    Depth_Sort sort;
+    DepthSort_Update(sort, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(back_to_front(sort, particles));
+
+    // Small motion is repaired in place.
+    for (auto& particle : particles)
+    {
+        particle.pos.z += 0.01f * Random_Float(rng);
+    }
+    DepthSort_Update(sort, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(back_to_front(sort, particles));
+
+    // Particles removed and added.
+    particles.resize(300);
+    DepthSort_Update(sort, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(back_to_front(sort, particles));
+    particles.resize(400);
+    for (size_t i = 300; i < particles.size(); ++i)
+    {
+        Particle_Init(particles[i]);
+        particles[i].pos = Vec { 0.0f, 0.0f, 1.0f + 90.0f * Random_Float(rng) };
+    }
+    DepthSort_Update(sort, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(back_to_front(sort, particles));
+
+    // Reversed order with no moves allowed must fall back to radix.
+    Depth_Sort reversed;
+    reversed.max_moves_per_particle = 0;
+    for (uint32 i = 0; i < particles.size(); ++i)
+    {
+        reversed.order.push_back(i);
+    }
+    std::sort(reversed.order.begin(), reversed.order.end(), [&](uint32 a, uint32 b) {
+        return particles[a].pos.z < particles[b].pos.z;
+    });
+    DepthSort_ExtractKeys(reversed, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(!DepthSort_Insertion(reversed, 0));
+    DepthSort_Update(reversed, particles, eye, forward, 1.0f, 100.0f);
+    CHECK(back_to_front(reversed, particles));
+
+    // The radix sort is stable: equal keys keep their incoming order.
+    Depth_Sort ties;
+    ties.keys  = { 7, 3, 7, 3, 0x1234, 7 };
+    ties.order = { 0, 1, 2, 3, 4, 5 };
+    DepthSort_Radix(ties);
+    CHECK((ties.keys == std::vector<uint16> { 3, 3, 7, 7, 7, 0x1234 }));
+    CHECK((ties.order == std::vector<uint32> { 1, 3, 0, 2, 5, 4 }));
+}
+
+
+// The alias table picks triangles in proportion to their area, and a mesh
+// with nothing to pick from spawns at the origin instead of crashing.
+static void
+Test_SpawnMesh()
+{
+    // Areas 0.5, 1.5 and 0, far enough apart in x to tell them apart.
+    Vec const    vertices[] = { { 0.0f, 0.0f, 0.0f },  { 1.0f, 0.0f, 0.0f },  { 0.0f, 0.0f, 1.0f },
+                                { 10.0f, 0.0f, 0.0f }, { 13.0f, 0.0f, 0.0f }, { 10.0f, 0.0f, 1.0f },
+                                { 20.0f, 0.0f, 0.0f }, { 21.0f, 0.0f, 0.0f }, { 22.0f, 0.0f, 0.0f } };
+    uint32 const indices[]  = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    Spawn_Mesh mesh;
+    SpawnMesh_Build(mesh, vertices, 9, indices, 9);
+
+    Spawn_Desc desc;
+    desc.shape = Spawn_Shape_Mesh;
+    desc.mesh  = &mesh;
+
+    size_t const     n = 40000;
+    std::vector<Vec> pos(n);
+    std::vector<Vec> dir(n);
+    Random           rng;
+    Random_Seed(rng, 3);
+    Spawn_Sample(desc, rng, n, pos.data(), dir.data());
+
+    size_t hits[3] = {};
+    for (auto& p : pos)
+    {
+        hits[(p.x < 5.0f) ? 0 : (p.x < 15.0f) ? 1 : 2] += 1;
+    }
+    CHECK(fabsf(float(hits[0]) / n - 0.25f) < 0.01f);
+    CHECK(fabsf(float(hits[1]) / n - 0.75f) < 0.01f);
+    CHECK(hits[2] == 0);
+
+    // No triangles, and triangles with no area between them.
+    Spawn_Mesh empty;
+    SpawnMesh_Build(empty, vertices, 9, indices, 0);
+    Spawn_Mesh flat;
+    SpawnMesh_Build(flat, vertices + 6, 3, indices, 3);
+
+    for (auto* degenerate : { &empty, &flat })
+    {
+        Emitter emitter;
+        Emitter_Seed(emitter, 4);
+        emitter.rate              = 0.01f;
+        emitter.params.spawn      = desc;
+        emitter.params.spawn.mesh = degenerate;
+        for (int tick = 0; tick < 60; ++tick)
+        {
+            Emitter_Integrate(emitter, Tick_Sec);
+        }
+        CHECK(emitter.particles.size() > 0);
+        for (auto& particle : emitter.particles)
+        {
+            CHECK(isfinite(particle.pos.x) && isfinite(particle.pos.y) && isfinite(particle.pos.z));
+        }
+    }
+}
+
+
+// A trail keeps its newest samples. Emitters sharing a pool each record at
+// the pool's interval, exactly as they would alone, and ribbons run from
+// full width at the particle to nothing at the oldest sample.
+static void
+Test_Trails()
+{
+    Trail_Pool ring;
+    Trail_Init(ring, 2, 4);
+    auto slot = Trail_Acquire(ring);
+    for (int i = 0; i < 6; ++i)
+    {
+        Trail_Push(ring, slot, Vec { float(i), 0.0f, 0.0f });
+    }
+    CHECK(ring.count[slot] == 4);
+    CHECK(Trail_Sample(ring, slot, 0).x == 5.0f && Trail_Sample(ring, slot, 3).x == 2.0f);
+
+    Trail_Pool none;
+    Trail_Init(none, 8, 0);
+    CHECK(Trail_Acquire(none) == Trail_None);
+
+    using Trail_Emitter = Emitter_Of<Particle_Feature_Trail>;
+
+    Trail_Pool    alone_pool;
+    Trail_Pool    shared_pool;
+    Trail_Emitter alone;
+    Trail_Emitter a;
+    Trail_Emitter b;
+    Trail_Init(alone_pool, 40, 32);
+    Trail_Init(shared_pool, 80, 32);
+    alone.trails = &alone_pool;
+    a.trails     = &shared_pool;
+    b.trails     = &shared_pool;
+    for (auto* emitter : { &alone, &a, &b })
+    {
+        Emitter_Seed(*emitter, 6);
+        emitter->rate = 0.1f;
+    }
+    for (int tick = 0; tick < 60; ++tick)
+    {
+        Emitter_Integrate(alone, Tick_Sec);
+        Emitter_Integrate(a, Tick_Sec);
+        Emitter_Integrate(b, Tick_Sec);
+    }
+
+    CHECK(alone.particles.size() > 1);
+    CHECK(a.particles.size() == alone.particles.size() && b.particles.size() == alone.particles.size());
+    size_t n_vertices = 0;
+    size_t n_indices  = 0;
+    for (size_t i = 0; i < alone.particles.size() && i < a.particles.size() && i < b.particles.size(); ++i)
+    {
+        auto count = alone_pool.count[alone.particles[i].trail_slot];
+        CHECK(shared_pool.count[a.particles[i].trail_slot] == count);
+        CHECK(shared_pool.count[b.particles[i].trail_slot] == count);
+        n_vertices += (count >= 2) ? 2 * count : 0;
+        n_indices += (count >= 2) ? 6 * (count - 1) : 0;
+    }
+    CHECK(alone_pool.count[alone.particles[0].trail_slot] > 2);
+
+    Render_Batch batch;
+    Ribbon_Reserve(batch, none);
+    Emitter_BuildRibbons(batch, alone, Vec { 0.0f, 0.0f, -50.0f }, 2.0f, Particle_Color { 255, 255, 255, 255 });
+    CHECK(batch.vertices.size() == n_vertices && batch.indices.size() == n_indices);
+    for (auto index : batch.indices)
+    {
+        CHECK(index < batch.vertices.size());
+    }
+
+    // The oldest particle's strip comes first.
+    auto  count  = alone_pool.count[alone.particles[0].trail_slot];
+    auto& head   = batch.vertices[0];
+    auto& head_1 = batch.vertices[1];
+    auto& tail   = batch.vertices[2 * count - 1];
+    float dx     = head.x - head_1.x;
+    float dy     = head.y - head_1.y;
+    float dz     = head.z - head_1.z;
+    CHECK(fabsf(sqrtf(dx * dx + dy * dy + dz * dz) - 2.0f) < 1e-4f);
+    CHECK(head.u == 0.0f && head.color.a == 255);
+    CHECK(tail.u == 1.0f && tail.color.a == 0);
+}
+
+
+// Quads face the camera, corners and atlas rects line up, indices follow on
+// from what the batch already holds, and emitters honour max_quads, the
+// draw order and their render mode.
+static void
+Test_Billboards()
+{
+    auto camera = Billboard_CameraFromLookAt(Vec { 0.0f, 0.0f, -10.0f }, Vec { 0.0f, 0.0f, 0.0f }, Vec { 0.0f, 1.0f, 0.0f });
+    CHECK(fabsf(camera.right.x) == 1.0f && camera.right.y == 0.0f && camera.right.z == 0.0f);
+    CHECK(camera.up.x == 0.0f && camera.up.y == 1.0f && camera.up.z == 0.0f);
+
+    // More than one gather batch.
+    size_t const                n = 70;
+    std::vector<float>          x(n), y(n), z(n), half(n);
+    std::vector<Particle_Color> colors(n);
+    std::vector<Atlas_Rect>     uvs(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        x[i]      = float(i);
+        y[i]      = 2.0f;
+        z[i]      = -1.0f;
+        half[i]   = 0.5f + i;
+        colors[i] = Particle_Color { uint8(i), 0, 0, 255 };
+        uvs[i]    = Atlas_Rect { 0.1f, 0.2f, 0.3f, 0.4f };
+    }
+
+    Render_Batch batch;
+    Billboard_Expand(batch, camera, x.data(), y.data(), z.data(), half.data(), colors.data(), uvs.data(), 1);
+    Billboard_Expand(batch, camera, x.data(), y.data(), z.data(), half.data(), colors.data(), uvs.data(), n);
+    CHECK(batch.vertices.size() == 4 * (n + 1) && batch.indices.size() == 6 * (n + 1));
+
+    uint32 const pattern[] = { 0, 1, 2, 0, 2, 3 };
+    for (size_t q = 0; q < n + 1; ++q)
+    {
+        for (size_t k = 0; k < 6; ++k)
+        {
+            CHECK(batch.indices[6 * q + k] == 4 * q + pattern[k]);
+        }
+    }
+
+    float const su[] = { -1.0f, -1.0f, 1.0f, 1.0f }; // Along right.
+    float const sv[] = { 1.0f, -1.0f, -1.0f, 1.0f };  // Along up.
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto* v = &batch.vertices[4 * (i + 1)];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            float ex = x[i] + (su[k] * camera.right.x + sv[k] * camera.up.x) * half[i];
+            float ey = y[i] + (su[k] * camera.right.y + sv[k] * camera.up.y) * half[i];
+            float ez = z[i] + (su[k] * camera.right.z + sv[k] * camera.up.z) * half[i];
+            CHECK(v[k].x == ex && v[k].y == ey && v[k].z == ez);
+            CHECK(v[k].u == ((su[k] < 0.0f) ? 0.1f : 0.3f) && v[k].v == ((sv[k] > 0.0f) ? 0.2f : 0.4f));
+            CHECK(v[k].color.r == uint8(i));
+        }
+    }
+
+    Emitter emitter;
+    Emitter_Seed(emitter, 8);
+    emitter.rate = 0.05f;
+    for (int tick = 0; tick < 60; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+    }
+    auto live = emitter.particles.size();
+    CHECK(live > 2);
+
+    std::vector<Particle_Vertex> out(4 * live);
+    CHECK(Emitter_WriteBillboards(out.data(), live, emitter, camera, 1.0f, Particle_Color {}) == 0);
+
+    emitter.render_mode = Render_Mode_Billboard;
+    CHECK(Emitter_WriteBillboards(out.data(), 2, emitter, camera, 1.0f, Particle_Color {}) == 2);
+
+    std::vector<uint32> order(live);
+    for (size_t i = 0; i < live; ++i)
+    {
+        order[i] = static_cast<uint32>(live - 1 - i);
+    }
+    CHECK(Emitter_WriteBillboards(out.data(), live, emitter, camera, 2.0f, Particle_Color {}, order.data()) == live);
+    for (size_t i = 0; i < live; ++i)
+    {
+        // Opposite corners average to the centre; the diagonal is the size
+        // times scale, times sqrt 2.
+        auto& particle = emitter.particles[order[i]];
+        auto& a        = out[4 * i + 0];
+        auto& c        = out[4 * i + 2];
+        CHECK(fabsf(0.5f * (a.x + c.x) - particle.pos.x) < 1e-3f);
+        CHECK(fabsf(0.5f * (a.y + c.y) - particle.pos.y) < 1e-3f);
+        CHECK(fabsf(0.5f * (a.z + c.z) - particle.pos.z) < 1e-3f);
+        float dx = c.x - a.x;
+        float dy = c.y - a.y;
+        CHECK(fabsf(sqrtf(dx * dx + dy * dy) - 2.0f * particle.size * sqrtf(2.0f)) < 1e-3f);
+    }
+}
+
+
+// Shelves fill left to right with padding between sprites, a sprite that
+// doesn't fit is refused, and flipbook frames walk the sheet row by row.
+static void
+Test_Atlas()
+{
+    Sprite_Atlas atlas;
+    Atlas_Init(atlas, 16, 8);
+
+    auto sprite = [](int w, int h, uint8 value) { return std::vector<uint8>(size_t(w) * h * 4, value); };
+    auto a      = sprite(6, 3, 1);
+    auto b      = sprite(6, 4, 2);
+    auto c      = sprite(5, 2, 3);
+    auto d      = sprite(4, 4, 4);
+    auto wide   = sprite(17, 1, 5);
+
+    Atlas_Rect ra, rb, rc, rd;
+    CHECK(Atlas_Add(atlas, a.data(), 6, 3, ra));
+    CHECK(Atlas_Add(atlas, b.data(), 6, 4, rb));
+    CHECK(Atlas_Add(atlas, c.data(), 5, 2, rc)); // Next shelf.
+    CHECK(!Atlas_Add(atlas, d.data(), 4, 4, rd));
+    CHECK(!Atlas_Add(atlas, wide.data(), 17, 1, rd));
+    CHECK(rd.u0 == 0.0f && rd.v0 == 0.0f && rd.u1 == 1.0f && rd.v1 == 1.0f);
+
+    CHECK(ra.u0 == 0.0f && ra.v0 == 0.0f && ra.u1 == 6.0f / 16 && ra.v1 == 3.0f / 8);
+    CHECK(rb.u0 == 7.0f / 16 && rb.v0 == 0.0f && rb.u1 == 13.0f / 16 && rb.v1 == 4.0f / 8);
+    CHECK(rc.u0 == 0.0f && rc.v0 == 5.0f / 8 && rc.u1 == 5.0f / 16 && rc.v1 == 7.0f / 8);
+
+    auto texel = [&atlas](int x, int y) { return atlas.pixels[(size_t(y) * atlas.width + x) * 4]; };
+    CHECK(texel(0, 0) == 1 && texel(5, 2) == 1 && texel(0, 3) == 0);
+    CHECK(texel(6, 0) == 0); // Padding.
+    CHECK(texel(7, 0) == 2 && texel(12, 3) == 2 && texel(13, 0) == 0);
+    CHECK(texel(0, 4) == 0 && texel(0, 5) == 3 && texel(4, 6) == 3);
+
+    Flipbook flipbook;
+    flipbook.sheet  = Atlas_Rect { 0.5f, 0.0f, 1.0f, 0.5f };
+    flipbook.cols   = 4;
+    flipbook.rows   = 2;
+    flipbook.frames = 7;
+
+    // Over the particle's life.
+    CHECK(Flipbook_Frame(flipbook, 0.0f, 0.0f) == 0);
+    CHECK(Flipbook_Frame(flipbook, 0.5f, 0.0f) == 3);
+    CHECK(Flipbook_Frame(flipbook, 1.0f, 0.0f) == 6);
+    CHECK(Flipbook_Frame(flipbook, -0.1f, 0.0f) == 0);
+
+    // At a frame rate, looping or holding.
+    flipbook.fps = 10.0f;
+    CHECK(Flipbook_Frame(flipbook, 0.0f, 0.65f) == 6);
+    CHECK(Flipbook_Frame(flipbook, 0.0f, 0.75f) == 0);
+    flipbook.loop = false;
+    CHECK(Flipbook_Frame(flipbook, 0.0f, 2.0f) == 6);
+
+    auto rect = Flipbook_FrameRect(flipbook, 5);
+    CHECK(rect.u0 == 0.625f && rect.v0 == 0.25f && rect.u1 == 0.75f && rect.v1 == 0.5f);
+
+    // An empty flipbook shows the whole sheet rather than dividing by zero.
+    Flipbook empty;
+    empty.sheet  = flipbook.sheet;
+    empty.cols   = 0;
+    empty.rows   = 0;
+    empty.frames = 0;
+    empty.fps    = 10.0f;
+    CHECK(Flipbook_Frame(empty, 0.5f, 0.75f) == 0);
+    empty.fps = 0.0f;
+    CHECK(Flipbook_Frame(empty, 0.5f, 0.0f) == 0);
+    rect = Flipbook_FrameRect(empty, 0);
+    CHECK(rect.u0 == 0.5f && rect.v0 == 0.0f && rect.u1 == 1.0f && rect.v1 == 0.5f);
+
+    // Billboards pick the frame from the particle's age.
+    flipbook.fps = 0.0f;
+    Particle particle {};
+    particle.duration_sec = 2.0f;
+    particle.lifetime_sec = 1.0f;
+
+    float          x, y, z, half;
+    Particle_Color color;
+    Atlas_Rect     uv;
+    Billboard_Gather(particle, 0, 1.0f, Particle_Color {}, &flipbook, &x, &y, &z, &half, &color, &uv);
+    CHECK(uv.u0 == 0.875f && uv.v0 == 0.0f && uv.u1 == 1.0f && uv.v1 == 0.25f);
+}
+
+
+static void
+Test_SameSeedIsIdentical()
+{
+    CHECK(Trace_Emitter(1234) == Trace_Emitter(1234));
+    CHECK(Trace_System(42) == Trace_System(42));
+}
+
+
+static void
+Test_DifferentSeedDiffers()
+{
+    CHECK(Trace_Emitter(1234) != Trace_Emitter(4321));
+}
+
+
+static void
+Test_EffectRoundTrip()
+{
+    char const* source = "# Test effects.\n"
+                         "effect sparks\n"
+                         "    features color\n"
+                         "    rate     0.05\n"
+                         "    shape    sphere 0.5\n"
+                         "    velocity 0 8 0\n"
+                         "    spread   30\n"
+                         "    lifetime 1.5 0.25\n"
+                         "    drag     0.2\n"
+                         "    substep  0.5 4\n"
+                         "end\n"
+                         "effect fountain\n"
+                         "end\n";
+
+    std::vector<uint8> binary;
+    std::string        error;
+    CHECK(Effect_Compile(source, binary, &error));
+
+    Effect_Library library;
+    CHECK(Effect_Load(library, binary.data(), binary.size()));
+    CHECK(library.count == 2);
+
+    auto* sparks = Effect_Find(library, "sparks");
+    CHECK(sparks != nullptr);
+    CHECK(sparks && sparks->features == Particle_Features_Spark);
+    CHECK(sparks && sparks->shape == Spawn_Shape_Sphere);
+    CHECK(sparks && sparks->spread_deg == 30);
+    CHECK(sparks && sparks->substep_cell == 0.5f && sparks->max_substeps == 4);
+    CHECK(Effect_Find(library, "missing") == nullptr);
+
+    // The default effect must reproduce the hardcoded emitter exactly.
+    Emitter fountain;
+    Emitter_Seed(fountain, 1234);
+    Effect_Apply(fountain, *Effect_Find(library, "fountain"));
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        Emitter_Integrate(fountain, Tick_Sec);
+    }
+    CHECK(Emitter_Hash(fountain) == Trace_Emitter(1234).back());
+
+    CHECK(!Effect_Compile("effect broken\n    shape blob\nend\n", binary, &error));
+    CHECK(!Effect_Load(library, binary.data(), 3));
+    CHECK(!Effect_Compile("effect broken\n    rate nan\nend\n", binary, &error));
+}
+
+
+// A loaded binary is refused whole when any def is out of range, and a def
+// whose feature set is only known at run time is instanced in the matching
+// system.
+static void
+Test_EffectLoadAndSpawn()
+{
+    char const* source = "effect sparks\n"
+                         "    features color\n"
+                         "    rate     0.02\n"
+                         "end\n"
+                         "effect smoke\n"
+                         "    rate     0.05\n"
+                         "end\n";
+
+    std::vector<uint8> binary;
+    CHECK(Effect_Compile(source, binary));
+
+    // Aligned copies, patched one field at a time.
+    auto corrupt = [&binary](auto patch) {
+        std::vector<uint32> copy((binary.size() + 3) / 4);
+        memcpy(copy.data(), binary.data(), binary.size());
+        patch(*reinterpret_cast<Effect_Def*>(reinterpret_cast<uint8*>(copy.data()) + sizeof(Effect_Header)));
+        Effect_Library library;
+        return !Effect_Load(library, copy.data(), binary.size()) && library.count == 0;
+    };
+    CHECK(corrupt([](Effect_Def& def) { def.shape = 99; }));
+    CHECK(corrupt([](Effect_Def& def) { def.features = Particle_Feature_Rotation; }));
+    CHECK(corrupt([](Effect_Def& def) { def.rate = -1.0f; }));
+    CHECK(corrupt([](Effect_Def& def) { def.lifetime_sec = 0.0f; }));
+    CHECK(corrupt([](Effect_Def& def) { def.drag = NAN; }));
+    CHECK(corrupt([](Effect_Def& def) { def.max_substeps = 0; }));
+    CHECK(corrupt([](Effect_Def& def) { def.name_hash = ~0u; })); // Out of order.
+    CHECK(!corrupt([](Effect_Def&) {}));
+
+    // An unknown shape spawns at the origin rather than reading garbage.
+    Spawn_Desc desc;
+    desc.shape = static_cast<Spawn_Shape>(99);
+    Vec    pos[3];
+    Vec    dir[3];
+    Random rng;
+    Spawn_Sample(desc, rng, 3, pos, dir);
+    CHECK(pos[2].x == 0.0f && pos[2].y == 0.0f && dir[2].z == 0.0f);
+
+    Effect_Library library;
+    CHECK(Effect_Load(library, binary.data(), binary.size()));
+
+    Effect_Systems  systems;
+    Effect_Instance instances[2];
+    for (uint32 i = 0; i < library.count; ++i)
+    {
+        instances[i] = Effect_Spawn(systems, library.defs[i]);
+        CHECK(instances[i].id.index != Emitter_ID_None.index);
+        CHECK(instances[i].features == library.defs[i].features);
+    }
+    for (int tick = 0; tick < 60; ++tick)
+    {
+        Effect_Integrate(systems, Tick_Sec);
+    }
+    CHECK(systems.spark.particles.size() > 0 && systems.basic.particles.size() > 0);
+    CHECK(systems.colored.particles.size() == 0);
+    CHECK(systems.spark.emitters[0].effect_hash == Effect_HashName("sparks"));
+
+    for (auto& instance : instances)
+    {
+        Effect_Despawn(systems, instance);
+    }
+    Effect_Integrate(systems, Tick_Sec);
+    CHECK(systems.spark.particles.size() == 0 && systems.basic.particles.size() == 0);
+
+    Effect_Def unknown = library.defs[0];
+    unknown.features   = Particle_Feature_Rotation;
+    CHECK(Effect_Spawn(systems, unknown).id.index == Emitter_ID_None.index);
+}
+
+
+// Zero spread and spin are valid and mean no jitter; a lifetime that can
+// reach zero is not.
+static void
+Test_EffectZeroRanges()
+{
+    char const* source = "effect still\n"
+                         "    velocity 1 2 3\n"
+                         "    spread   0\n"
+                         "    spin     0\n"
+                         "    rate     0.01\n"
+                         "end\n";
+
+    std::vector<uint8> binary;
+    std::string        error;
+    Effect_Library     library;
+    CHECK(Effect_Compile(source, binary, &error));
+    CHECK(Effect_Load(library, binary.data(), binary.size()));
+
+    Emitter emitter;
+    Emitter_Seed(emitter, 9);
+    Effect_Apply(emitter, *Effect_Find(library, "still"));
+    for (int tick = 0; tick < 60; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+    }
+    CHECK(emitter.particles.size() > 0);
+    for (auto& particle : emitter.particles)
+    {
+        CHECK(particle.omega.x == 0.0f && particle.omega.y == 0.0f && particle.omega.z == 0.0f);
+        CHECK(particle.vel.x == 1.0f && particle.vel.z == 3.0f);
+    }
+
+    char const* bad[] = { "effect a\n    lifetime 0\nend\n",
+                          "effect a\n    lifetime -1\nend\n",
+                          "effect a\n    lifetime 1 1\nend\n",
+                          "effect a\n    lifetime 1 -0.5\nend\n" };
+    for (auto* text : bad)
+    {
+        CHECK(!Effect_Compile(text, binary, &error));
+    }
+    CHECK(Effect_Compile("effect a\n    lifetime 1 0.5\nend\n", binary, &error));
+}
+
+
+static HotReload_Blob*
+Test_CompileBlob(char const* source)
+{
+    auto* blob = new HotReload_Blob;
+    if (!Effect_Compile(source, blob->binary) || !Effect_Load(blob->library, blob->binary.data(), blob->binary.size()))
+    {
+        delete blob;
+        return nullptr;
+    }
+    return blob;
+}
+
+
+// Only the newest published library is taken, each at most once, and
+// patching changes parameters without touching live particles or an
+// emitter whose feature set no longer matches.
+static void
+Test_HotReload()
+{
+    HotReload reload;
+    CHECK(HotReload_Take(reload) == nullptr);
+
+    HotReload_Publish(reload, Test_CompileBlob("effect puff\n    rate 0.1\nend\n"));
+    HotReload_Publish(reload, Test_CompileBlob("effect puff\n    rate 0.2\nend\n"));
+    HotReload_Publish(reload, nullptr); // A failed compile keeps what's pending.
+
+    auto* library = HotReload_Take(reload);
+    CHECK(library != nullptr);
+    CHECK(HotReload_Take(reload) == nullptr);
+    if (!library)
+    {
+        return;
+    }
+
+    // The mesh is attached in code; the effect file can't say anything about
+    // it, so applying and patching must leave it alone.
+    Spawn_Mesh mesh;
+    Emitter    emitter;
+    Emitter_Seed(emitter, 2);
+    emitter.params.spawn.mesh = &mesh;
+    Effect_Apply(emitter, *Effect_Find(*library, "puff"));
+    CHECK(emitter.rate == 0.2f && emitter.params.spawn.mesh == &mesh);
+    for (int tick = 0; tick < 120; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+    }
+    auto live = emitter.particles.size();
+    CHECK(live > 0);
+
+    HotReload_Publish(reload, Test_CompileBlob("effect puff\n    rate 0.05\n    drag 0.5\nend\n"));
+    library = HotReload_Take(reload);
+    CHECK(library && Effect_Patch(emitter, *library));
+    CHECK(emitter.rate == 0.05f && emitter.params.drag == 0.5f);
+    CHECK(emitter.params.spawn.mesh == &mesh);
+    CHECK(emitter.particles.size() == live);
+
+    ParticleSystem system;
+    auto           id     = ParticleSystem_CreateEmitter(system);
+    auto&          pooled = system.emitters[id.index];
+    pooled.params.spawn.mesh = &mesh;
+    Effect_Apply(system, id, *Effect_Find(*library, "puff"));
+    CHECK(Effect_Patch(system, *library));
+    CHECK(pooled.params.drag == 0.5f && pooled.params.spawn.mesh == &mesh);
+
+    // Now a spark effect: different storage, so left alone.
+    HotReload_Publish(reload, Test_CompileBlob("effect puff\n    features color\n    rate 1\nend\n"));
+    library = HotReload_Take(reload);
+    CHECK(library && !Effect_Patch(emitter, *library));
+    CHECK(library && !Effect_Patch(system, *library));
+    CHECK(emitter.rate == 0.05f && pooled.rate == 0.05f);
+
+    HotReload_Stop(reload);
+}
+
+
+static void
+Test_WriteFile(char const* path, char const* text)
+{
+    if (FILE* file = fopen(path, "wb"))
+    {
+        fputs(text, file);
+        fclose(file);
+    }
+}
+
+
+// Errors come back to the caller, from the first compile, or through
+// on_error from the watcher; the library itself never prints.
+static void
+Test_HotReloadErrors()
+{
+    std::string error;
+    HotReload   missing;
+    CHECK(!HotReload_Start(missing, "/nonexistent/effects.pfx", &error));
+    CHECK(error.find("can't read") != std::string::npos);
+
+    char path[] = "/tmp/test_particles_XXXXXX";
+    int  fd     = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+    {
+        return;
+    }
+    close(fd);
+
+    Test_WriteFile(path, "effect puff\n    shape blob\nend\n");
+    HotReload broken;
+    CHECK(!HotReload_Start(broken, path, &error));
+    CHECK(error.find("line 2: unknown shape") != std::string::npos);
+
+    std::atomic<int> reported { 0 };
+    HotReload        reload;
+    reload.on_error      = [](void* user, char const*) { static_cast<std::atomic<int>*>(user)->fetch_add(1); };
+    reload.on_error_user = &reported;
+    Test_WriteFile(path, "effect puff\nend\n");
+    CHECK(HotReload_Start(reload, path, &error));
+    CHECK(HotReload_Take(reload) != nullptr);
+
+    // The watch goes up on the watcher thread, so keep saving until it sees one.
+    for (int wait = 0; wait < 50 && reported.load() == 0; ++wait)
+    {
+        Test_WriteFile(path, "effect puff\n    rate\nend\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    CHECK(reported.load() > 0);
+    CHECK(HotReload_Take(reload) == nullptr);
+
+    HotReload_Stop(reload);
+    remove(path);
+}
+
+
+// Splitting integration across threads, events included, must not change
+// the result.
+static std::vector<uint64>
+Trace_Fireworks(int n_threads)
+{
+    std::vector<uint64> trace;
+
+    ParticleSystem system;
+    system.seed = 7;
+
+    Event_Queue events;
+    EventQueue_Init(events, n_threads, 256);
+    system.events = &events;
+
+    Thread_Pool pool;
+    ThreadPool_Init(pool, n_threads);
+
+    auto rockets = ParticleSystem_CreateEmitter(system);
+    auto sparks  = ParticleSystem_CreateEmitter(system);
+
+    system.emitters[rockets.index].rate                = 0.05f;
+    system.emitters[rockets.index].params.lifetime_sec = 1.0f;
+    system.emitters[sparks.index].paused               = true;
+
+    Sub_Emitter burst;
+    burst.parent           = rockets.index;
+    burst.inherit_velocity = 0.5f;
+
+    for (int tick = 0; tick < N_Ticks / 2; ++tick)
+    {
+        ParticleSystem_Integrate(system, Tick_Sec, &pool);
+        ParticleSystem_SpawnFromEvents(system, sparks, burst, events.merged);
+        trace.push_back(ParticleSystem_Hash(system));
+    }
+
+    ThreadPool_Free(pool);
+    return trace;
+}
+
+
+static void
+Test_ThreadCountIsInvisible()
+{
+    CHECK(Trace_Fireworks(1) == Trace_Fireworks(4));
+}
+
+
+// Under a budget the system never grows past its ceiling, and the lowest
+// priority gives way first.
+static void
+Test_BudgetCeiling()
+{
+    ParticleSystem system;
+    system.seed = 3;
+    ParticleSystem_SetBudget(system, 1000 * (sizeof(Particle) + sizeof(uint32)));
+    CHECK(system.budget.max_particles == 1000);
+
+    Budget_Priority const priorities[] = { Budget_Priority_Low, Budget_Priority_Normal, Budget_Priority_High };
+    for (auto priority : priorities)
+    {
+        auto  id               = ParticleSystem_CreateEmitter(system);
+        auto& emitter          = system.emitters[id.index];
+        emitter.rate           = 0.001f;
+        emitter.quota.priority = priority;
+    }
+    system.emitters[2].quota.policy = Budget_Policy_RecycleOldest;
+
+    auto capacity = system.particles.capacity();
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        ParticleSystem_Integrate(system, Tick_Sec);
+        CHECK(system.particles.size() <= system.budget.max_particles);
+        CHECK(system.budget.used == system.particles.size());
+    }
+    CHECK(system.particles.capacity() == capacity);
+    CHECK(system.emitters[0].live_count < system.emitters[2].live_count);
+    CHECK(system.budget.throttled > 0);
+    CHECK(system.budget.recycled > 0);
+}
+
+
+// Sub-emitter spawns are admitted like the child's own, so a child sharing
+// a budget stays within its quota, deaths give back exactly what was taken,
+// and recycled particles respawn at the event.
+static void
+Test_SubEmitterBudget()
+{
+    Particle_Budget budget;
+    budget.max_particles = 100;
+
+    Event_Buffer events;
+    Emitter      parent;
+    Emitter      child;
+    Emitter_Seed(parent, 11);
+    Emitter_Seed(child, 12);
+    parent.budget              = &budget;
+    parent.events              = &events;
+    parent.rate                = 0.05f;
+    parent.params.lifetime_sec = 0.3f;
+    child.budget               = &budget;
+    child.quota.quota          = 30;
+    child.paused               = true;
+    child.params.lifetime_sec  = 0.5f;
+
+    Sub_Emitter sub;
+    sub.count = 16;
+    for (int tick = 0; tick < N_Ticks / 2; ++tick)
+    {
+        events.events.clear();
+        Emitter_Integrate(parent, Tick_Sec);
+        Emitter_SpawnFromEvents(child, sub, events.events);
+        Emitter_Integrate(child, Tick_Sec);
+        CHECK(child.particles.size() <= 30);
+        CHECK(budget.used == parent.particles.size() + child.particles.size());
+    }
+    CHECK(budget.throttled > 0);
+
+    // Fill the child, then recycle its oldest into a distant event.
+    auto far = [&child] {
+        int n = 0;
+        for (auto& particle : child.particles)
+        {
+            n += (particle.pos.x > 900.0f) ? 1 : 0;
+        }
+        return n;
+    };
+    Particle_Event const burst { Vec { 1000.0f, 0.0f, 0.0f }, Vec { 0.0f, 0.0f, 0.0f }, 0, Particle_Event_Death };
+    child.params.lifetime_sec = 100.0f;
+    Emitter_SpawnFromEvents(child, sub, { burst, burst });
+    CHECK(child.particles.size() == 30);
+
+    auto before        = far();
+    auto recycled      = budget.recycled;
+    child.quota.policy = Budget_Policy_RecycleOldest;
+    sub.count          = 4;
+    Emitter_SpawnFromEvents(child, sub, { burst });
+    CHECK(child.particles.size() == 30 && budget.recycled == recycled + 4);
+    CHECK(budget.used == parent.particles.size() + child.particles.size());
+    CHECK(far() == before + 4);
+    CHECK(child.bounds.box.max.x > 900.0f);
+}
+
+
+// Every half survives a round trip through float, and a compact emitter
+// stays close to the full precision one.
+static void
+Test_CompactStorage()
+{
+    int mismatches = 0;
+    for (uint32 h = 0; h < 0x10000; ++h)
+    {
+        float value = Half_ToFloat(static_cast<uint16>(h));
+        if (!isnan(value) && Half_FromFloat(value) != h)
+        {
+            mismatches += 1;
+        }
+    }
+    CHECK(mismatches == 0);
+    CHECK(Half_FromFloat(65520.0f) == 0x7c00);
+
+    Emitter full;
+    Emitter_Seed(full, 5);
+
+    Compact_Emitter_Of<Particle_Features_Default, 40> compact;
+    CompactEmitter_Init(compact, Vec { 0.0f, 0.0f, 0.0f }, 128.0f);
+    Random_Seed(compact.rng, 5);
+
+    for (int tick = 0; tick < N_Ticks / 2; ++tick)
+    {
+        Emitter_Integrate(full, Tick_Sec);
+        CompactEmitter_Integrate(compact, Tick_Sec);
+    }
+    CHECK(full.particles.size() == compact.count);
+
+    float full_y    = 0.0f;
+    float compact_y = 0.0f;
+    for (auto const& particle : full.particles)
+    {
+        full_y += particle.pos.y;
+    }
+    for (uint32 i = 0; i < compact.count; ++i)
+    {
+        compact_y += CompactEmitter_Load(compact, i).pos.y;
+    }
+    CHECK(fabsf(full_y - compact_y) < 0.02f * fabsf(full_y));
+}
+
+
+// The reader only ever sees whole, in order publishes, and keeps its slot
+// when nothing new has been published.
+static void
+Test_TripleBuffer()
+{
+    Triple_Buffer<int> buffer;
+    CHECK(!TripleBuffer_Acquire(buffer));
+
+    TripleBuffer_Back(buffer) = 1;
+    TripleBuffer_Publish(buffer);
+    TripleBuffer_Back(buffer) = 2;
+    TripleBuffer_Publish(buffer);
+    CHECK(TripleBuffer_Acquire(buffer));
+    CHECK(TripleBuffer_Front(buffer) == 2);
+    CHECK(!TripleBuffer_Acquire(buffer));
+    CHECK(TripleBuffer_Front(buffer) == 2);
+
+    // The writer never gets the slot the reader holds.
+    TripleBuffer_Back(buffer) = 3;
+    TripleBuffer_Publish(buffer);
+    TripleBuffer_Back(buffer) = 4;
+    CHECK(TripleBuffer_Front(buffer) == 2);
+    TripleBuffer_Publish(buffer);
+    CHECK(TripleBuffer_Acquire(buffer));
+    CHECK(TripleBuffer_Front(buffer) == 4);
+}
+
+
+struct Pipeline_Counts
+{
+    std::atomic<int> fast { 0 };
+    std::atomic<int> slow { 0 };
+    std::atomic<int> steps { 0 };
+    std::atomic<int> off_main { 0 };
+    std::thread::id  main_thread;
+};
+
+
+static Stage_Task
+Test_Step(Pipeline_Counts& counts)
+{
+    counts.steps += 1;
+    co_return;
+}
+
+
+static Stage_Task
+Test_FastStage(Frame_Pipeline& pipeline, Pipeline_Counts& counts)
+{
+    auto clock = StageClock_FromRate(400.0f);
+    for (;;)
+    {
+        co_await Pipeline_Tick { pipeline, clock, Pipeline_Any };
+        counts.fast += 1;
+    }
+}
+
+
+static Stage_Task
+Test_SlowStage(Frame_Pipeline& pipeline, Pipeline_Counts& counts)
+{
+    auto clock = StageClock_FromRate(50.0f);
+    for (;;)
+    {
+        co_await Pipeline_Tick { pipeline, clock, Pipeline_Any };
+        co_await Test_Step(counts);
+        co_await Pipeline_Switch { pipeline, Pipeline_Main };
+        if (std::this_thread::get_id() != counts.main_thread)
+        {
+            counts.off_main += 1;
+        }
+        counts.slow += 1;
+    }
+}
+
+
+static Stage_Task
+Test_QuitStage(Frame_Pipeline& pipeline, float seconds)
+{
+    auto clock = StageClock_FromRate(1.0f / seconds);
+    co_await Pipeline_Tick { pipeline, clock, Pipeline_Main };
+    co_await Pipeline_Tick { pipeline, clock, Pipeline_Main };
+    Pipeline_Quit(pipeline);
+}
+
+
+// Sub-steps close in on the exact arc, and slow particles are stepped once.
+static void
+Test_Substeps()
+{
+    Emitter_Params params;
+    params.substep_cell = 0.05f;
+    params.max_substeps = 64;
+
+    Particle_Of<Particle_Features_Spark> coarse;
+    Particle_Init(coarse);
+    coarse.vel = Vec { 20.0f, 0.0f, 0.0f };
+    auto fine  = coarse;
+
+    float t     = 0.5f;
+    int   steps = Particle_SubstepCount(20.0f, t, params);
+    CHECK(steps == 64);
+    CHECK(Particle_SubstepCount(0.1f, Tick_Sec, params) == 1);
+    CHECK(Particle_SubstepCount(20.0f, t, Emitter_Params_Default) == 1);
+
+    Particle_Integrate(coarse, t, params);
+    Particle_IntegrateSubsteps(fine, t, steps, params);
+
+    float exact = 0.5f * params.gravity.y * t * t;
+    CHECK(fabsf(fine.pos.x - coarse.pos.x) < 1e-4f);
+    CHECK(fabsf(fine.pos.y - exact) < fabsf(coarse.pos.y - exact) / 32.0f);
+
+    float speed2[67];
+    for (int i = 0; i < 67; ++i)
+    {
+        speed2[i] = float((i * 37) % 67);
+    }
+    CHECK(Particle_MaxSpeedSquared(speed2, 67) == 66.0f);
+    CHECK(Particle_MaxSpeedSquared(speed2, 3) == 37.0f);
+}
+
+
+static void
+Test_Collision()
+{
+    // A bump in the middle of a flat field.
+    Height_Field ground;
+    HeightField_Init(ground, Vec { -4.0f, 0.0f, -4.0f }, 1.0f, 8, 8);
+    HeightField_At(ground, 4, 4) = 2.0f;
+    HeightField_BuildMips(ground);
+
+    CHECK(HeightField_MaxOver(ground, -4.0f, -4.0f, 4.0f, 4.0f) == 2.0f);
+    CHECK(HeightField_MaxOver(ground, -3.5f, -3.5f, -2.5f, -2.5f) == 0.0f);
+    CHECK(HeightField_MaxOver(ground, 10.0f, 10.0f, 11.0f, 11.0f) < -1e30f);
+
+    float height;
+    Vec   normal;
+    CHECK(HeightField_Sample(ground, 0.0f, 0.0f, height, normal) && height == 2.0f);
+    CHECK(HeightField_Sample(ground, 0.5f, 0.0f, height, normal) && height == 1.0f && normal.x > 0.0f);
+    CHECK(!HeightField_Sample(ground, 5.0f, 0.0f, height, normal));
+
+    Collision_World world;
+    world.ground = &ground;
+    world.cylinders.push_back({ Vec { 10.0f, 0.0f, 0.0f }, 2.0f, 0.0f, 4.0f });
+    world.capsules.push_back({ Vec { -10.0f, 1.0f, 0.0f }, Vec { -10.0f, 5.0f, 0.0f }, 1.0f });
+
+    Event_Buffer  events;
+    Spark_Emitter emitter;
+    Emitter_Init(emitter);
+    emitter.events   = &events;
+    emitter.event_id = 3;
+
+    // Below flat ground, in the cone, in the capsule, and in the air.
+    Vec starts[4] = { { -3.0f, -0.1f, -3.0f }, { 10.5f, 1.0f, 0.0f }, { -10.5f, 3.0f, 0.0f }, { 2.0f, 5.0f, 2.0f } };
+    for (auto& start : starts)
+    {
+        emitter.particles.allocate();
+        auto& particle = emitter.particles.back();
+        Particle_Init(particle);
+        particle.pos = start;
+        particle.vel = Vec { 1.0f, -2.0f, 0.0f };
+    }
+
+    Collision_Material bounce;
+    Emitter_Collide(emitter, world, bounce);
+
+    auto& floor = emitter.particles[0];
+    CHECK(fabsf(floor.pos.y) < 1e-6f);
+    CHECK(fabsf(floor.vel.y - 2.0f * bounce.restitution) < 1e-6f);
+    CHECK(fabsf(floor.vel.x - (1.0f - bounce.friction)) < 1e-6f);
+
+    // Out onto the cone's surface: radius 2 at the base, 0 at height 4.
+    auto& cone = emitter.particles[1];
+    float dx   = cone.pos.x - 10.0f;
+    float r    = 2.0f * (1.0f - cone.pos.y / 4.0f);
+    CHECK(fabsf(sqrtf(dx * dx + cone.pos.z * cone.pos.z) - r) < 1e-4f);
+
+    auto& capsule = emitter.particles[2];
+    CHECK(fabsf(capsule.pos.x + 11.0f) < 1e-6f && capsule.pos.y == 3.0f);
+
+    CHECK(emitter.particles[3].pos.y == 5.0f);
+    CHECK(events.events.size() == 3 && events.events[0].type == Particle_Event_Collision && events.events[0].emitter == 3);
+
+    // A kill is one death, raised at the contact, on both paths.
+    Collision_Material kill;
+    kill.response = Collision_Kill;
+
+    auto count = [](std::vector<Particle_Event> const& list, uint32 type) {
+        return std::count_if(list.begin(), list.end(), [type](Particle_Event const& event) { return event.type == type; });
+    };
+
+    events.events.clear();
+    floor.pos.y        = -1.0f;
+    floor.lifetime_sec = 1.0f;
+    Emitter_Collide(emitter, world, kill);
+    auto deaths = count(events.events, Particle_Event_Death);
+    CHECK(deaths >= 1 && deaths == count(events.events, Particle_Event_Collision));
+    CHECK(emitter.particles.size() == 4 - size_t(deaths));
+    for (auto& particle : emitter.particles)
+    {
+        CHECK(particle.pos.y != 0.0f || particle.pos.x != -3.0f);
+    }
+
+    Height_Field plane;
+    HeightField_Init(plane, Vec { -50.0f, -1.0f, -50.0f }, 10.0f, 10, 10);
+    HeightField_BuildMips(plane);
+    Collision_World below;
+    below.ground = &plane;
+
+    Event_Queue queue;
+    EventQueue_Init(queue, 1, 256);
+
+    ParticleSystem system;
+    system.seed   = 5;
+    system.events = &queue;
+
+    auto  id                   = ParticleSystem_CreateEmitter(system);
+    auto& pooled               = system.emitters[id.index];
+    pooled.rate                = 0.05f;
+    pooled.params.lifetime_sec = 100.0f;
+    pooled.params.velocity     = Vec { 0.0f, -10.0f, 0.0f };
+    pooled.params.spread_deg   = 0;
+
+    ptrdiff_t kills = 0;
+    for (int tick = 0; tick < 120; ++tick)
+    {
+        ParticleSystem_Integrate(system, Tick_Sec);
+        CHECK(count(queue.merged, Particle_Event_Death) == 0);
+        ParticleSystem_Collide(system, below, kill);
+        auto collisions = count(queue.merged, Particle_Event_Collision);
+        CHECK(count(queue.merged, Particle_Event_Death) == collisions);
+        kills += collisions;
+    }
+    CHECK(kills > 0);
+
+    // A cylinder without height is never touched, and never divides by it.
+    Collision_Cylinder flat { Vec { 0.0f, 0.0f, 0.0f }, 1.0f, 1.0f, 0.0f };
+    CHECK(Bounds_IsEmpty(Collision_CylinderBounds(flat)));
+
+    float              px[4] = { 0.5f, 0.0f, -0.5f, 0.2f };
+    float              py[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float              pz[4] = { 0.0f, 0.5f, 0.0f, 0.2f };
+    Collision_Contacts contacts {};
+    Collision_CylinderContacts(flat, px, py, pz, 4, contacts);
+    for (int i = 0; i < 4; ++i)
+    {
+        CHECK(contacts.depth[i] == 0.0f);
+    }
+}
+
+
+// Stages keep their own rates, nested stages run in line, and main thread
+// work stays on the main thread.
+template <uint32 Features, size_t Capacity>
+static bool
+Bounds_Hold(Emitter_Of<Features, Capacity> const& emitter, Bounds_Box const& box)
+{
+    for (auto& particle : emitter.particles)
+    {
+        auto& p = particle.pos;
+        if (p.x < box.min.x || p.y < box.min.y || p.z < box.min.z || p.x > box.max.x || p.y > box.max.y || p.z > box.max.z)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Emitter boxes hold their particles, tightly after a tick and still after
+// skipped ticks, and the tree finds what a brute force search does.
+static void
+Test_Bounds()
+{
+    Emitter_Of<Particle_Features_Default, 512> emitter;
+    Emitter_Seed(emitter, 5);
+    emitter.rate                 = 0.01f;
+    emitter.quota.quota          = 512;
+    emitter.params.spawn.shape   = Spawn_Shape_Sphere;
+    emitter.params.spawn.extents = Vec { 2.0f, 0.0f, 0.0f };
+    emitter.params.speed         = 6.0f;
+
+    LOD_Settings settings;
+    Emitter_LOD  lod;
+    lod.divisor = 6;
+
+    int skipped = 0;
+    for (int tick = 0; tick < N_Ticks / 2; ++tick)
+    {
+        Emitter_TickLOD(emitter, lod, settings, Tick_Sec);
+        if (lod.counter == 0)
+        {
+            // Just ticked, so the box is the measured one, and tight.
+            auto& box = emitter.bounds.box;
+            CHECK(Bounds_Hold(emitter, box));
+            CHECK(emitter.particles.size() == 0 || !Bounds_Hold(emitter, Bounds_Inflate(box, -1e-3f)));
+            continue;
+        }
+
+        // Catch up a copy now; wherever its particles land must be inside
+        // the grown box.
+        auto copy        = emitter;
+        auto copy_lod    = lod;
+        copy_lod.counter = copy_lod.divisor - 1;
+        Emitter_TickLOD(copy, copy_lod, settings, 0.0f);
+        CHECK(Bounds_Hold(copy, emitter.bounds.box));
+        skipped += 1;
+    }
+    CHECK(skipped > N_Ticks / 4);
+
+    Random rng;
+    Random_Seed(rng, 17);
+    std::vector<Bounds_Box> boxes(300);
+    for (size_t i = 0; i < boxes.size(); ++i)
+    {
+        if (i % 10 == 0)
+        {
+            continue; // Left empty.
+        }
+        Vec c = { 100.0f * Random_Float(rng), 10.0f * Random_Float(rng), 100.0f * Random_Float(rng) };
+        Bounds_Add(boxes[i], c);
+        boxes[i] = Bounds_Inflate(boxes[i], 0.5f + 2.0f * Random_Float(rng));
+    }
+
+    Bounds_Tree tree;
+    BoundsTree_Build(tree, boxes.data(), boxes.size());
+
+    Bounds_Box query = { Vec { 20.0f, 0.0f, 20.0f }, Vec { 45.0f, 5.0f, 30.0f } };
+    auto       check = [&] {
+        std::vector<uint32> found;
+        BoundsTree_Overlapping(tree, boxes.data(), query, found);
+        std::sort(found.begin(), found.end());
+
+        std::vector<uint32> expected;
+        for (uint32 i = 0; i < boxes.size(); ++i)
+        {
+            if (!Bounds_IsEmpty(boxes[i]) && Bounds_Overlap(boxes[i], query))
+            {
+                expected.push_back(i);
+            }
+        }
+        CHECK(!expected.empty());
+        CHECK(found == expected);
+    };
+    check();
+
+    // Everything drifts; a refit keeps the same answers.
+    for (auto& box : boxes)
+    {
+        if (!Bounds_IsEmpty(box))
+        {
+            box.min.x += 7.0f;
+            box.max.x += 7.0f;
+        }
+    }
+    BoundsTree_Refit(tree, boxes.data());
+    check();
+
+    // An emitter that was empty at build starts spawning inside the query.
+    Bounds_Add(boxes[0], Bounds_Center(query));
+    boxes[0] = Bounds_Inflate(boxes[0], 1.0f);
+    BoundsTree_Refit(tree, boxes.data());
+    check();
+    std::vector<uint32> found;
+    BoundsTree_Overlapping(tree, boxes.data(), query, found);
+    CHECK(std::find(found.begin(), found.end(), 0u) != found.end());
+
+    // Nothing in anything at build, for a leaf root and for a deeper tree,
+    // then everything at once.
+    for (size_t n : { size_t(0), size_t(3), size_t(40) })
+    {
+        std::vector<Bounds_Box> none(n);
+        Bounds_Tree             empty;
+        BoundsTree_Build(empty, none.data(), none.size());
+        BoundsTree_Refit(empty, none.data());
+        CHECK(empty.items.size() == n);
+
+        found.clear();
+        BoundsTree_Overlapping(empty, none.data(), query, found);
+        CHECK(found.empty());
+
+        for (auto& box : none)
+        {
+            box = query;
+        }
+        BoundsTree_Refit(empty, none.data());
+        found.clear();
+        BoundsTree_Overlapping(empty, none.data(), query, found);
+        CHECK(found.size() == n);
+    }
+
+    auto                camera = LOD_CameraFromLookAt(Vec { 50.0f, 50.0f, -40.0f }, Vec { 50.0f, 0.0f, 50.0f }, 30.0f, 1.0f);
+    std::vector<uint32> visible;
+    BoundsTree_Visible(tree, boxes.data(), camera, visible);
+    size_t expected = 0;
+    for (auto& box : boxes)
+    {
+        expected += !Bounds_IsEmpty(box) && LOD_Visible(camera, Bounds_Center(box), Bounds_Radius(box));
+    }
+    CHECK(visible.size() == expected && expected > 0 && expected < boxes.size() * 9 / 10);
+}
+
+
+// Reordering sorts an emitter into Z-order over a few sweeps, without
+// losing or duplicating a particle.
+static void
+Test_MortonReorder()
+{
+    CHECK(Morton_Encode(1, 0, 0) == 1 && Morton_Encode(0, 1, 0) == 2 && Morton_Encode(0, 0, 1) == 4);
+    CHECK(Morton_Encode(1023, 1023, 1023) == (1u << 30) - 1);
+    CHECK(Morton_Encode(2, 0, 0) == 8);
+
+    Emitter_Of<Particle_Features_Default, 2048> emitter;
+    Emitter_Seed(emitter, 11);
+    emitter.rate                       = 0.001f;
+    emitter.quota.quota                = 2048;
+    emitter.params.spawn.shape         = Spawn_Shape_Box;
+    emitter.params.spawn.extents       = Vec { 30.0f, 30.0f, 30.0f };
+    emitter.params.lifetime_sec        = 1.0f;
+    emitter.params.lifetime_jitter_sec = 0.5f;
+
+    // Enough deaths for removal to have shuffled the array.
+    for (int tick = 0; tick < 120; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+    }
+
+    // Adjacent pairs out of Z-order.
+    auto descents = [&] {
+        auto&  particles = emitter.particles;
+        size_t count     = 0;
+        uint32 last      = 0;
+        for (size_t i = 0; i < particles.size(); ++i)
+        {
+            auto&  pos = particles[i].pos;
+            uint32 code;
+            Morton_Codes(emitter.bounds.measured, &pos.x, &pos.y, &pos.z, &code, 1);
+            count += (i > 0 && code < last);
+            last = code;
+        }
+        return count;
+    };
+    auto sorted = [&] { return descents() == 0; };
+    auto lifetimes = [&] {
+        std::vector<float> out;
+        for (auto& particle : emitter.particles)
+        {
+            out.push_back(particle.lifetime_sec);
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    };
+
+    CHECK(emitter.particles.size() > 500);
+    CHECK(!sorted());
+    auto before = lifetimes();
+
+    emitter.reorder.budget = 512;
+    emitter.reorder.window = 128;
+    int ticks              = 0;
+    while (!sorted() && ticks < 1000)
+    {
+        Emitter_Reorder(emitter);
+        ticks += 1;
+    }
+    CHECK(sorted());
+    CHECK(ticks > 1);
+    CHECK(lifetimes() == before);
+    CHECK(emitter.reorder.sorted == 512);
+
+    // Fewer particles than a window: one pass a tick, whatever the budget.
+    Emitter small;
+    Emitter_Seed(small, 12);
+    small.rate = 0.05f;
+    for (int tick = 0; tick < 60; ++tick)
+    {
+        Emitter_Integrate(small, Tick_Sec);
+    }
+    CHECK(small.particles.size() > 2 && small.particles.size() < 40);
+    small.reorder.budget = 4096;
+    small.reorder.window = 256;
+    Emitter_Reorder(small);
+    CHECK(small.reorder.sorted == small.particles.size());
+
+    // Once sorted, integrating with reordering on keeps it close, where
+    // without it deaths and spawns would undo it.
+    for (int tick = 0; tick < 30; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+    }
+    CHECK(descents() < emitter.particles.size() / 10);
+}
+
+
+// Handles follow their particle through backfilling, recycling and
+// reordering, and go stale when it dies, even once the slot is reused.
+static void
+Test_Handles()
+{
+    Emitter_Of<Particle_Features_Spark | Particle_Feature_Handle, 512> emitter;
+    Emitter_Seed(emitter, 5);
+    emitter.rate                       = 0.002f;
+    emitter.quota.quota                = 400;
+    emitter.quota.policy               = Budget_Policy_RecycleOldest;
+    emitter.params.spawn.shape         = Spawn_Shape_Box;
+    emitter.params.spawn.extents       = Vec { 10.0f, 10.0f, 10.0f };
+    emitter.params.lifetime_sec        = 0.5f;
+    emitter.params.lifetime_jitter_sec = 0.4f;
+    emitter.reorder.budget             = 256;
+    emitter.reorder.window             = 64;
+
+    // Each particle is tagged with an id in its color, alpha zero. Spawning
+    // resets the color, so untagged particles are the new ones.
+    struct Tracked
+    {
+        Particle_Handle handle;
+        uint32          id;
+    };
+    std::vector<Tracked> tracked;
+    uint32               next_id = 0;
+    Particle_Handle      dead;
+    bool                 reused  = false;
+
+    for (int tick = 0; tick < 200; ++tick)
+    {
+        Emitter_Integrate(emitter, Tick_Sec);
+
+        size_t found = 0;
+        for (size_t k = 0; k < tracked.size();)
+        {
+            auto* particle = Emitter_Find(emitter, tracked[k].handle);
+            if (!particle)
+            {
+                dead          = tracked[k].handle;
+                tracked[k]    = tracked.back();
+                tracked.pop_back();
+                continue;
+            }
+            CHECK(size_t(particle - emitter.particles.begin()) < emitter.particles.size());
+            auto& c = particle->color;
+            CHECK(c.a == 0 && (uint32(c.r) | uint32(c.g) << 8 | uint32(c.b) << 16) == tracked[k].id);
+            found += 1;
+            k += 1;
+        }
+
+        size_t tagged = 0;
+        for (size_t i = 0; i < emitter.particles.size(); ++i)
+        {
+            auto& c = emitter.particles[i].color;
+            if (c.a == 0)
+            {
+                tagged += 1;
+                continue;
+            }
+            c = Particle_Color { uint8(next_id), uint8(next_id >> 8), uint8(next_id >> 16), 0 };
+            tracked.push_back({ Emitter_Handle(emitter, i), next_id });
+            next_id += 1;
+        }
+        CHECK(tagged == found);
+
+        for (auto& t : tracked)
+        {
+            reused = reused || (dead.slot == t.handle.slot);
+        }
+        CHECK(dead.slot == Handle_None || !Emitter_Find(emitter, dead));
+    }
+
+    CHECK(next_id > 1000);
+    CHECK(reused);
+    CHECK(emitter.handles.index.size() <= 400);
+    CHECK(emitter.handles.free_slots.size() + emitter.particles.size() == emitter.handles.index.size());
+}
+
+
+// Runs one emitter setup on every backend, side by side, and checks that
+// particles, events and billboard vertices match the scalar reference bit
+// for bit on every tick.
+template <uint32 Features, size_t Capacity>
+static void
+Check_Backends(char const* name, Emitter_Params const& params, float rate, float event_age, Thread_Pool& pool)
+{
+    struct Run
+    {
+        Particle_Backend               backend;
+        Emitter_Of<Features, Capacity> emitter;
+        Event_Buffer                   events;
+        std::vector<Particle_Vertex>   vertices;
+    };
+
+    std::vector<Run> runs(Backend_Kind_Count);
+    for (uint32 k = 0; k < Backend_Kind_Count; ++k)
+    {
+        auto& run                  = runs[k];
+        run.backend                = { static_cast<Backend_Kind>(k), &pool };
+        run.emitter.params         = params;
+        run.emitter.rate           = rate;
+        run.emitter.event_age      = event_age;
+        run.emitter.events         = &run.events;
+        run.emitter.render_mode    = Render_Mode_Billboard;
+        run.emitter.quota.quota    = static_cast<uint32>(Capacity);
+        Emitter_Seed(run.emitter, 99);
+        run.vertices.resize(4 * Capacity);
+    }
+
+    auto camera = Billboard_CameraFromLookAt(Vec { 10.0f, 5.0f, 10.0f }, Vec { 0.0f, 0.0f, 0.0f }, Vec { 0.0f, 1.0f, 0.0f });
+
+    size_t most = 0;
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        for (auto& run : runs)
+        {
+            run.events.events.clear();
+            Backend_Integrate(run.backend, run.emitter, Tick_Sec);
+        }
+        auto quads = Backend_WriteBillboards(runs[0].backend, runs[0].vertices.data(), Capacity, runs[0].emitter, camera, 0.5f, Particle_Color {});
+        most       = (quads > most) ? quads : most;
+
+        auto& reference = runs[0];
+        for (size_t k = 1; k < runs.size(); ++k)
+        {
+            auto& run = runs[k];
+            auto  n   = Backend_WriteBillboards(run.backend, run.vertices.data(), Capacity, run.emitter, camera, 0.5f, Particle_Color {});
+
+            bool same = Emitter_Hash(run.emitter) == Emitter_Hash(reference.emitter)
+                        && run.events.events.size() == reference.events.events.size()
+                        && (run.events.events.empty()
+                            || memcmp(run.events.events.data(), reference.events.events.data(), run.events.events.size() * sizeof(Particle_Event)) == 0)
+                        && memcmp(&run.emitter.bounds, &reference.emitter.bounds, sizeof(Emitter_Bounds)) == 0
+                        && n == quads
+                        && memcmp(run.vertices.data(), reference.vertices.data(), 4 * n * sizeof(Particle_Vertex)) == 0;
+            if (!same)
+            {
+                printf("%s: %s backend diverged at tick %d\n", name, Backend_Names[k], tick);
+                failures += 1;
+                return;
+            }
+        }
+    }
+
+    // Enough particles for several batches, so the pool had work to split.
+    CHECK(most > 3 * 64);
+}
+
+
+static void
+Test_BackendEquivalence()
+{
+    Thread_Pool pool;
+    ThreadPool_Init(pool, 3);
+
+    Emitter_Params fountain;
+    Check_Backends<Particle_Features_Default, 512>("fountain", fountain, 0.01f, 0.5f, pool);
+
+    Emitter_Params fast;
+    fast.speed        = 40.0f;
+    fast.drag         = 0.3f;
+    fast.substep_cell = 0.1f;
+    Check_Backends<Particle_Features_Default, 512>("substeps", fast, 0.005f, -1.0f, pool);
+
+    Emitter_Params sparks;
+    sparks.lifetime_sec        = 1.0f;
+    sparks.lifetime_jitter_sec = 0.5f;
+    sparks.drag                = 2.0f;
+    Check_Backends<Particle_Features_Spark | Particle_Feature_Size, 512>("sparks", sparks, 0.002f, 0.25f, pool);
+
+    ThreadPool_Free(pool);
+
+    Backend_Kind kind = Backend_Scalar;
+    CHECK(Backend_Parse("threaded", kind) && kind == Backend_Threaded);
+    CHECK(!Backend_Parse("gpu", kind) && kind == Backend_Threaded);
+}
+
+
+// One seeded scene of several emitters, run whole on each backend. The
+// state hashes of the three runs have to agree with each other on every
+// tick, not just each emitter with its scalar twin.
+static void
+Test_BackendSceneHash()
+{
+    using Scene_Emitter = Emitter_Of<Particle_Features_Default, 512>;
+
+    Thread_Pool pool;
+    ThreadPool_Init(pool, 3);
+
+    struct Scene
+    {
+        Particle_Backend           backend;
+        std::vector<Scene_Emitter> emitters;
+        Event_Buffer               events;
+    };
+
+    std::vector<Scene> scenes(Backend_Kind_Count);
+    for (uint32 k = 0; k < Backend_Kind_Count; ++k)
+    {
+        auto& scene   = scenes[k];
+        scene.backend = { static_cast<Backend_Kind>(k), &pool };
+        scene.emitters.resize(3);
+        for (size_t e = 0; e < scene.emitters.size(); ++e)
+        {
+            auto& emitter                      = scene.emitters[e];
+            emitter.rate                       = 0.004f * (e + 1);
+            emitter.params.speed               = 5.0f + 15.0f * e;
+            emitter.params.drag                = 0.2f * e;
+            emitter.params.lifetime_jitter_sec = 0.5f;
+            emitter.params.substep_cell        = (e == 1) ? 0.1f : 0.0f;
+            emitter.event_age                  = 0.5f;
+            emitter.events                     = &scene.events;
+            emitter.quota.quota                = 512;
+            Emitter_Seed(emitter, 1234 + static_cast<uint32>(e));
+        }
+    }
+
+    auto scene_hash = [](Scene const& scene) {
+        uint64 hash = Hash_Seed;
+        for (auto const& emitter : scene.emitters)
+        {
+            uint64 h = Emitter_Hash(emitter);
+            hash     = Hash_Bytes(hash, &h, sizeof(h));
+        }
+        return hash;
+    };
+
+    size_t most = 0;
+    for (int tick = 0; tick < N_Ticks; ++tick)
+    {
+        uint64 hashes[Backend_Kind_Count];
+        for (uint32 k = 0; k < Backend_Kind_Count; ++k)
+        {
+            for (auto& emitter : scenes[k].emitters)
+            {
+                Backend_Integrate(scenes[k].backend, emitter, Tick_Sec);
+            }
+            hashes[k] = scene_hash(scenes[k]);
+        }
+        most = (scenes[0].emitters[2].particles.size() > most) ? scenes[0].emitters[2].particles.size() : most;
+
+        if (hashes[Backend_SIMD] != hashes[Backend_Scalar] || hashes[Backend_Threaded] != hashes[Backend_SIMD])
+        {
+            printf("scene: backend state hashes diverged at tick %d\n", tick);
+            failures += 1;
+            break;
+        }
+    }
+    CHECK(most > 3 * 64);
+    CHECK(!scenes[0].events.events.empty());
+    CHECK(scenes[0].events.events.size() == scenes[Backend_Threaded].events.events.size());
+
+    ThreadPool_Free(pool);
+}
+
+
+static void
+Test_FramePipeline()
+{
+    Frame_Pipeline  pipeline;
+    Pipeline_Counts counts;
+    counts.main_thread = std::this_thread::get_id();
+
+    Pipeline_Init(pipeline, 2);
+    Pipeline_Start(pipeline, Test_FastStage(pipeline, counts), Pipeline_Any);
+    Pipeline_Start(pipeline, Test_SlowStage(pipeline, counts), Pipeline_Any);
+    Pipeline_Start(pipeline, Test_QuitStage(pipeline, 0.25f), Pipeline_Main);
+    Pipeline_RunMain(pipeline);
+    Pipeline_Free(pipeline);
+
+    CHECK(counts.slow > 0);
+    CHECK(counts.fast > 4 * counts.slow);
+    CHECK(counts.steps >= counts.slow);
+    CHECK(counts.off_main == 0);
+}
+
+
+int
+main(int argc, char** argv)
+{
+    bool        record = false;
+    std::string dir    = "test/golden";
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--record") == 0)
+        {
+            record = true;
+        }
+        else
+        {
+            dir = argv[i];
+        }
+    }
+
+    Test_Curves();
+    Test_LOD();
+    Test_DepthSort();
+    Test_SpawnMesh();
+    Test_Trails();
+    Test_Billboards();
+    Test_Atlas();
+    Test_SameSeedIsIdentical();
+    Test_DifferentSeedDiffers();
+    Test_EffectRoundTrip();
+    Test_EffectLoadAndSpawn();
+    Test_EffectZeroRanges();
+    Test_HotReload();
+    Test_HotReloadErrors();
+    Test_ThreadCountIsInvisible();
+    Test_BudgetCeiling();
+    Test_SubEmitterBudget();
+    Test_CompactStorage();
+    Test_TripleBuffer();
+    Test_Substeps();
+    Test_Collision();
+    Test_BackendEquivalence();
+    Test_BackendSceneHash();
+    Test_Bounds();
+    Test_MortonReorder();
+    Test_Handles();
+    Test_FramePipeline();
+
+    Trace_Check(dir, "emitter_seed_1234", Trace_Emitter(1234), record);
+    Trace_Check(dir, "system_seed_42", Trace_System(42), record);
+
+    if (failures)
+    {
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}